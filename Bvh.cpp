@@ -0,0 +1,413 @@
+#include "Bvh.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <utility>
+
+namespace gps {
+
+    namespace {
+
+        const uint32_t MAX_LEAF_ITEMS = 4;
+        const int BIN_COUNT = 12;
+        const unsigned int ALL_PLANES = 0x3Fu;
+
+        BoundingBox Merge(const BoundingBox &a, const BoundingBox &b) {
+            BoundingBox box = { glm::min(a.min, b.min), glm::max(a.max, b.max) };
+            return box;
+        }
+
+        bool Same(const BoundingBox &a, const BoundingBox &b) {
+            return a.min == b.min && a.max == b.max;
+        }
+
+        float SurfaceArea(const BoundingBox &box) {
+            if (Bvh::IsEmpty(box)) {
+                return 0.0f;
+            }
+            glm::vec3 size = box.max - box.min;
+            return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+        }
+
+        bool Overlaps(const BoundingBox &a, const BoundingBox &b) {
+            return a.min.x <= b.max.x && a.max.x >= b.min.x &&
+                   a.min.y <= b.max.y && a.max.y >= b.min.y &&
+                   a.min.z <= b.max.z && a.max.z >= b.min.z;
+        }
+
+        // false when the box is outside one of the planes in mask; otherwise clears the bits
+        // of the planes the box lies entirely inside of
+        bool ClassifyBox(const Frustum &frustum, const BoundingBox &box, unsigned int &mask) {
+            glm::vec3 center = (box.min + box.max) * 0.5f;
+            glm::vec3 extent = (box.max - box.min) * 0.5f;
+            for (int p = 0; p < 6; p++) {
+                if (!(mask & (1u << p))) {
+                    continue;
+                }
+                const glm::vec4 &plane = frustum.planes[p];
+                float distance = glm::dot(glm::vec3(plane), center) + plane.w;
+                float reach = glm::dot(glm::abs(glm::vec3(plane)), extent);
+                if (distance + reach < 0.0f) {
+                    return false;
+                }
+                if (distance - reach >= 0.0f) {
+                    mask &= ~(1u << p);
+                }
+            }
+            return true;
+        }
+
+        // parallel axes get a huge finite inverse so the slabs never produce 0 * inf
+        float SafeInverse(float value) {
+            if (std::fabs(value) < 1e-20f) {
+                return value < 0.0f ? -1e30f : 1e30f;
+            }
+            return 1.0f / value;
+        }
+
+        // slab test; entry is the distance where the ray enters the box, clamped to 0
+        bool RayBox(const BoundingBox &box, const glm::vec3 &origin, const glm::vec3 &inverseDirection,
+                    float maxDistance, float &entry) {
+            glm::vec3 t0 = (box.min - origin) * inverseDirection;
+            glm::vec3 t1 = (box.max - origin) * inverseDirection;
+            glm::vec3 nearT = glm::min(t0, t1);
+            glm::vec3 farT = glm::max(t0, t1);
+            entry = std::max(std::max(nearT.x, nearT.y), std::max(nearT.z, 0.0f));
+            float exit = std::min(std::min(farT.x, farT.y), std::min(farT.z, maxDistance));
+            return entry <= exit;
+        }
+    }
+
+    void Bvh::Clear() {
+        nodes.clear();
+        order.clear();
+        leafOf.clear();
+        itemBounds.clear();
+        leafBoxes.Clear();
+    }
+
+    void Bvh::Build(const std::vector<BoundingBox> &boxes) {
+        Clear();
+        itemBounds = boxes;
+        uint32_t count = (uint32_t)boxes.size();
+        if (count == 0) {
+            return;
+        }
+        order.resize(count);
+        leafOf.resize(count);
+        std::vector<glm::vec3> centroids(count);
+        for (uint32_t i = 0; i < count; i++) {
+            order[i] = i;
+            centroids[i] = IsEmpty(boxes[i]) ? glm::vec3(0.0f) : (boxes[i].min + boxes[i].max) * 0.5f;
+        }
+
+        nodes.reserve(2 * count);
+        Node root;
+        root.first = 0;
+        root.count = count;
+        root.child = 0;
+        root.parent = 0;
+        root.bounds = UnionOf(0, count);
+        nodes.push_back(root);
+        Subdivide(0, centroids);
+
+        for (uint32_t i = 0; i < count; i++) {
+            leafBoxes.Add(itemBounds[order[i]]);
+        }
+    }
+
+    void Bvh::Subdivide(uint32_t root, const std::vector<glm::vec3> &centroids) {
+        std::vector<uint32_t> stack(1, root);
+        while (!stack.empty()) {
+            uint32_t index = stack.back();
+            stack.pop_back();
+            // copied, the children below may reallocate the nodes
+            Node node = nodes[index];
+
+            if (node.count <= MAX_LEAF_ITEMS) {
+                for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                    leafOf[order[i]] = index;
+                }
+                continue;
+            }
+
+            // split along the longest axis of the centroids
+            glm::vec3 centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                centroidMin = glm::min(centroidMin, centroids[order[i]]);
+                centroidMax = glm::max(centroidMax, centroids[order[i]]);
+            }
+            glm::vec3 size = centroidMax - centroidMin;
+            int axis = (size.x >= size.y && size.x >= size.z) ? 0 : (size.y >= size.z ? 1 : 2);
+            float extent = size[axis];
+
+            uint32_t middle = node.first;
+            if (extent > 0.0f) {
+                // binned surface area heuristic: bin the centroids, then sweep the bin boundaries
+                uint32_t binCount[BIN_COUNT] = {};
+                BoundingBox binBounds[BIN_COUNT];
+                for (int b = 0; b < BIN_COUNT; b++) {
+                    binBounds[b] = EmptyBox();
+                }
+                float scale = BIN_COUNT / extent;
+                for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                    uint32_t item = order[i];
+                    int bin = std::min((int)((centroids[item][axis] - centroidMin[axis]) * scale), BIN_COUNT - 1);
+                    binCount[bin]++;
+                    binBounds[bin] = Merge(binBounds[bin], itemBounds[item]);
+                }
+
+                float leftArea[BIN_COUNT - 1];
+                uint32_t leftCount[BIN_COUNT - 1];
+                BoundingBox sweep = EmptyBox();
+                uint32_t swept = 0;
+                for (int b = 0; b < BIN_COUNT - 1; b++) {
+                    sweep = Merge(sweep, binBounds[b]);
+                    swept += binCount[b];
+                    leftArea[b] = SurfaceArea(sweep);
+                    leftCount[b] = swept;
+                }
+                int bestSplit = -1;
+                float bestCost = FLT_MAX;
+                sweep = EmptyBox();
+                swept = 0;
+                for (int b = BIN_COUNT - 1; b > 0; b--) {
+                    sweep = Merge(sweep, binBounds[b]);
+                    swept += binCount[b];
+                    if (leftCount[b - 1] == 0 || swept == 0) {
+                        continue;
+                    }
+                    float cost = leftCount[b - 1] * leftArea[b - 1] + swept * SurfaceArea(sweep);
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        bestSplit = b - 1;
+                    }
+                }
+
+                if (bestSplit != -1) {
+                    uint32_t *begin = &order[0] + node.first;
+                    uint32_t *split = std::partition(begin, begin + node.count, [&](uint32_t item) {
+                        int bin = std::min((int)((centroids[item][axis] - centroidMin[axis]) * scale), BIN_COUNT - 1);
+                        return bin <= bestSplit;
+                    });
+                    middle = node.first + (uint32_t)(split - begin);
+                }
+            }
+            if (middle == node.first || middle == node.first + node.count) {
+                // coincident centroids or no useful bin boundary: halve at the median
+                middle = node.first + node.count / 2;
+                uint32_t *begin = &order[0] + node.first;
+                std::nth_element(begin, &order[0] + middle, begin + node.count, [&](uint32_t a, uint32_t b) {
+                    return centroids[a][axis] < centroids[b][axis];
+                });
+            }
+
+            uint32_t left = (uint32_t)nodes.size();
+            Node child;
+            child.child = 0;
+            child.parent = index;
+            child.first = node.first;
+            child.count = middle - node.first;
+            child.bounds = UnionOf(child.first, child.count);
+            nodes.push_back(child);
+            child.first = middle;
+            child.count = node.first + node.count - middle;
+            child.bounds = UnionOf(child.first, child.count);
+            nodes.push_back(child);
+            nodes[index].child = left;
+
+            stack.push_back(left + 1);
+            stack.push_back(left);
+        }
+    }
+
+    void Bvh::Update(uint32_t item, const BoundingBox &box) {
+        itemBounds[item] = box;
+        uint32_t index = leafOf[item];
+        for (uint32_t i = nodes[index].first; i < nodes[index].first + nodes[index].count; i++) {
+            if (order[i] == item) {
+                leafBoxes.Set(i, box);
+                break;
+            }
+        }
+        nodes[index].bounds = UnionOf(nodes[index].first, nodes[index].count);
+        // ancestors stop changing as soon as one of them keeps its bounds
+        while (index != 0) {
+            index = nodes[index].parent;
+            Node &node = nodes[index];
+            BoundingBox merged = Merge(nodes[node.child].bounds, nodes[node.child + 1].bounds);
+            if (Same(merged, node.bounds)) {
+                break;
+            }
+            node.bounds = merged;
+        }
+    }
+
+    void Bvh::QueryFrustum(const Frustum &frustum, std::vector<uint32_t> &items) const {
+        if (nodes.empty()) {
+            return;
+        }
+        struct Entry {
+            uint32_t node;
+            unsigned int mask;
+        };
+        std::vector<Entry> stack;
+        // [first, end) ranges of order whose leaves cross a plane; leaves are visited in order,
+        // so neighbouring ones merge into longer batches
+        std::vector<std::pair<uint32_t, uint32_t> > batches;
+        Entry root = { 0, ALL_PLANES };
+        stack.push_back(root);
+        while (!stack.empty()) {
+            Entry entry = stack.back();
+            stack.pop_back();
+            const Node &node = nodes[entry.node];
+            if (IsEmpty(node.bounds) || !ClassifyBox(frustum, node.bounds, entry.mask)) {
+                continue;
+            }
+            if (entry.mask == 0) {
+                AppendItems(node, items);
+                continue;
+            }
+            if (node.child == 0) {
+                if (!batches.empty() && batches.back().second == node.first) {
+                    batches.back().second += node.count;
+                } else {
+                    batches.push_back(std::make_pair(node.first, node.first + node.count));
+                }
+                continue;
+            }
+            Entry right = { node.child + 1, entry.mask };
+            Entry left = { node.child, entry.mask };
+            stack.push_back(right);
+            stack.push_back(left);
+        }
+
+        std::vector<uint8_t> visible;
+        for (size_t b = 0; b < batches.size(); b++) {
+            uint32_t first = batches[b].first;
+            leafBoxes.Cull(frustum, first, batches[b].second - first, visible);
+            for (uint32_t i = 0; i < visible.size(); i++) {
+                uint32_t item = order[first + i];
+                if (visible[i] && !IsEmpty(itemBounds[item])) {
+                    items.push_back(item);
+                }
+            }
+        }
+    }
+
+    void Bvh::QueryOverlap(const BoundingBox &box, std::vector<uint32_t> &items) const {
+        if (nodes.empty() || IsEmpty(box)) {
+            return;
+        }
+        std::vector<uint32_t> stack(1, 0u);
+        while (!stack.empty()) {
+            const Node &node = nodes[stack.back()];
+            stack.pop_back();
+            if (IsEmpty(node.bounds) || !Overlaps(node.bounds, box)) {
+                continue;
+            }
+            if (node.child == 0) {
+                for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                    const BoundingBox &bounds = itemBounds[order[i]];
+                    if (!IsEmpty(bounds) && Overlaps(bounds, box)) {
+                        items.push_back(order[i]);
+                    }
+                }
+                continue;
+            }
+            stack.push_back(node.child + 1);
+            stack.push_back(node.child);
+        }
+    }
+
+    bool Bvh::RayCast(const Ray &ray, float maxDistance, RayHit &hit, const ItemRayTest &test) const {
+        if (nodes.empty()) {
+            return false;
+        }
+        glm::vec3 inverseDirection(SafeInverse(ray.direction.x), SafeInverse(ray.direction.y), SafeInverse(ray.direction.z));
+        float nearest = maxDistance;
+        bool found = false;
+
+        std::vector<uint32_t> stack(1, 0u);
+        while (!stack.empty()) {
+            const Node &node = nodes[stack.back()];
+            stack.pop_back();
+            float entry;
+            if (IsEmpty(node.bounds) || !RayBox(node.bounds, ray.origin, inverseDirection, nearest, entry)) {
+                continue;
+            }
+            if (node.child == 0) {
+                for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                    uint32_t item = order[i];
+                    float distance;
+                    if (IsEmpty(itemBounds[item]) || !RayBox(itemBounds[item], ray.origin, inverseDirection, nearest, distance)) {
+                        continue;
+                    }
+                    if (test && (!test(item, ray, distance) || distance < 0.0f || distance > nearest)) {
+                        continue;
+                    }
+                    nearest = distance;
+                    hit.item = item;
+                    hit.distance = distance;
+                    found = true;
+                }
+                continue;
+            }
+            // the nearer child is popped first so its hits shorten the search of the other
+            float leftEntry, rightEntry;
+            const Node &left = nodes[node.child];
+            const Node &right = nodes[node.child + 1];
+            bool hitLeft = !IsEmpty(left.bounds) && RayBox(left.bounds, ray.origin, inverseDirection, nearest, leftEntry);
+            bool hitRight = !IsEmpty(right.bounds) && RayBox(right.bounds, ray.origin, inverseDirection, nearest, rightEntry);
+            if (hitLeft && hitRight) {
+                bool leftFirst = leftEntry <= rightEntry;
+                stack.push_back(leftFirst ? node.child + 1 : node.child);
+                stack.push_back(leftFirst ? node.child : node.child + 1);
+            } else if (hitLeft) {
+                stack.push_back(node.child);
+            } else if (hitRight) {
+                stack.push_back(node.child + 1);
+            }
+        }
+        return found;
+    }
+
+    size_t Bvh::getItemCount() const {
+        return itemBounds.size();
+    }
+
+    size_t Bvh::getNodeCount() const {
+        return nodes.size();
+    }
+
+    const BoundingBox &Bvh::getItemBounds(uint32_t item) const {
+        return itemBounds[item];
+    }
+
+    BoundingBox Bvh::EmptyBox() {
+        BoundingBox box = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+        return box;
+    }
+
+    bool Bvh::IsEmpty(const BoundingBox &box) {
+        return box.min.x > box.max.x || box.min.y > box.max.y || box.min.z > box.max.z;
+    }
+
+    BoundingBox Bvh::UnionOf(uint32_t first, uint32_t count) const {
+        BoundingBox box = EmptyBox();
+        for (uint32_t i = first; i < first + count; i++) {
+            box = Merge(box, itemBounds[order[i]]);
+        }
+        return box;
+    }
+
+    void Bvh::AppendItems(const Node &node, std::vector<uint32_t> &items) const {
+        for (uint32_t i = node.first; i < node.first + node.count; i++) {
+            if (!IsEmpty(itemBounds[order[i]])) {
+                items.push_back(order[i]);
+            }
+        }
+    }
+
+}
@@ -0,0 +1,87 @@
+#ifndef Bvh_hpp
+#define Bvh_hpp
+
+#include "FrustumCuller.hpp"
+#include "Mesh.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace gps {
+
+    // Ray for the spatial queries; distances are measured in units of direction
+    struct Ray {
+        glm::vec3 origin;
+        glm::vec3 direction;
+    };
+
+    struct RayHit {
+        uint32_t item;
+        float distance;
+    };
+
+    // Bounding volume hierarchy over world-space boxes, item i being the i-th box given to Build.
+    // Items are moved with Update, which refits only the path from their leaf to the root; an
+    // item given an empty box stays in the tree but is never returned by the queries
+    class Bvh {
+
+    public:
+        // refines a hit on the box of an item against its geometry: returns false on a miss,
+        // otherwise sets distance to the nearest hit along the ray
+        typedef std::function<bool(uint32_t item, const Ray &ray, float &distance)> ItemRayTest;
+
+        void Clear();
+        // binned SAH build over the boxes
+        void Build(const std::vector<BoundingBox> &boxes);
+        // moves an item and refits its ancestors
+        void Update(uint32_t item, const BoundingBox &box);
+
+        // appends the items whose boxes intersect the frustum; subtrees inside every plane are
+        // taken whole without testing their items, the items of leaves crossing a plane are
+        // tested in batches through FrustumCuller
+        void QueryFrustum(const Frustum &frustum, std::vector<uint32_t> &items) const;
+        // appends the items whose boxes overlap the box
+        void QueryOverlap(const BoundingBox &box, std::vector<uint32_t> &items) const;
+        // nearest item hit closer than maxDistance, visiting the nearer child first; without a
+        // test the hit is on the item's box
+        bool RayCast(const Ray &ray, float maxDistance, RayHit &hit, const ItemRayTest &test = ItemRayTest()) const;
+
+        size_t getItemCount() const;
+        size_t getNodeCount() const;
+        const BoundingBox &getItemBounds(uint32_t item) const;
+
+        // box containing nothing, for hidden items
+        static BoundingBox EmptyBox();
+        static bool IsEmpty(const BoundingBox &box);
+
+    private:
+        struct Node {
+            BoundingBox bounds;
+            // the items of the subtree are order[first, first + count)
+            uint32_t first;
+            uint32_t count;
+            // index of the left child, the right one follows it; 0 for a leaf
+            uint32_t child;
+            uint32_t parent;
+        };
+
+        std::vector<Node> nodes;
+        // item indices grouped by leaf
+        std::vector<uint32_t> order;
+        std::vector<uint32_t> leafOf;
+        std::vector<BoundingBox> itemBounds;
+        // item boxes in order's sequence, so the items of adjacent leaves form one SIMD batch
+        FrustumCuller leafBoxes;
+
+        void Subdivide(uint32_t node, const std::vector<glm::vec3> &centroids);
+        BoundingBox UnionOf(uint32_t first, uint32_t count) const;
+        void AppendItems(const Node &node, std::vector<uint32_t> &items) const;
+    };
+
+}
+
+#endif /* Bvh_hpp */
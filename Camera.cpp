@@ -93,6 +93,14 @@ namespace gps {
         this->maxBoundary = maxBound;
     }
 
+    glm::vec3 Camera::getMovementMin() {
+        return this->minBoundary;
+    }
+
+    glm::vec3 Camera::getMovementMax() {
+        return this->maxBoundary;
+    }
+
     float Camera::getMaxHeight() {
         return this->maxHeight;
     }
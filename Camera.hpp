@@ -28,6 +28,8 @@ namespace gps {
         void setTarget(const glm::vec3& target);
         // set movement bounds (min and max allowed camera coordinates)
         void setMovementBounds(const glm::vec3& minBound, const glm::vec3& maxBound);
+        glm::vec3 getMovementMin();
+        glm::vec3 getMovementMax();
         
     private:
         glm::vec3 cameraPosition;
@@ -0,0 +1,169 @@
+#include "FrustumCuller.hpp"
+
+#include <cmath>
+
+#if defined(__AVX__)
+#define GPS_CULL_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GPS_CULL_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace gps {
+
+    Frustum Frustum::FromMatrix(const glm::mat4 &viewProjection) {
+        // rows of the column-major matrix; a clip-space point is inside when -w <= x, y, z <= w
+        glm::vec4 rows[4];
+        for (int r = 0; r < 4; r++) {
+            rows[r] = glm::vec4(viewProjection[0][r], viewProjection[1][r], viewProjection[2][r], viewProjection[3][r]);
+        }
+        Frustum frustum;
+        for (int axis = 0; axis < 3; axis++) {
+            frustum.planes[axis * 2] = rows[3] + rows[axis];
+            frustum.planes[axis * 2 + 1] = rows[3] - rows[axis];
+        }
+        return frustum;
+    }
+
+    void FrustumCuller::Clear() {
+        centerX.clear();
+        centerY.clear();
+        centerZ.clear();
+        extentX.clear();
+        extentY.clear();
+        extentZ.clear();
+    }
+
+    size_t FrustumCuller::Add(const BoundingBox &bounds, const glm::mat4 &transform) {
+        glm::vec3 center = (bounds.min + bounds.max) * 0.5f;
+        glm::vec3 extent = (bounds.max - bounds.min) * 0.5f;
+        // the world box of a transformed box: moved center, extents through the absolute matrix
+        glm::vec3 worldCenter(transform * glm::vec4(center, 1.0f));
+        glm::vec3 worldExtent(0.0f);
+        for (int column = 0; column < 3; column++) {
+            for (int row = 0; row < 3; row++) {
+                worldExtent[row] += std::fabs(transform[column][row]) * extent[column];
+            }
+        }
+        centerX.push_back(worldCenter.x);
+        centerY.push_back(worldCenter.y);
+        centerZ.push_back(worldCenter.z);
+        extentX.push_back(worldExtent.x);
+        extentY.push_back(worldExtent.y);
+        extentZ.push_back(worldExtent.z);
+        return centerX.size() - 1;
+    }
+
+    size_t FrustumCuller::Add(const BoundingBox &worldBounds) {
+        centerX.push_back(0.0f);
+        centerY.push_back(0.0f);
+        centerZ.push_back(0.0f);
+        extentX.push_back(0.0f);
+        extentY.push_back(0.0f);
+        extentZ.push_back(0.0f);
+        Set(centerX.size() - 1, worldBounds);
+        return centerX.size() - 1;
+    }
+
+    void FrustumCuller::Set(size_t index, const BoundingBox &worldBounds) {
+        glm::vec3 center = (worldBounds.min + worldBounds.max) * 0.5f;
+        glm::vec3 extent = (worldBounds.max - worldBounds.min) * 0.5f;
+        centerX[index] = center.x;
+        centerY[index] = center.y;
+        centerZ[index] = center.z;
+        extentX[index] = extent.x;
+        extentY[index] = extent.y;
+        extentZ[index] = extent.z;
+    }
+
+    size_t FrustumCuller::Cull(const Frustum &frustum, std::vector<uint8_t> &visible) const {
+        return Cull(frustum, 0, centerX.size(), visible);
+    }
+
+    size_t FrustumCuller::Cull(const Frustum &frustum, size_t first, size_t count, std::vector<uint8_t> &visible) const {
+        visible.assign(count, 0);
+        if (count == 0) {
+            return 0;
+        }
+        size_t visibleCount = 0;
+        size_t i = 0;
+        // the SoA arrays are read from first on, results are written from 0
+        const float *centerX = &this->centerX[first], *centerY = &this->centerY[first], *centerZ = &this->centerZ[first];
+        const float *extentX = &this->extentX[first], *extentY = &this->extentY[first], *extentZ = &this->extentZ[first];
+
+        // a box is outside a plane when its center lies farther behind it than the box reaches:
+        // dot(n, c) + d < -dot(|n|, e)
+#if defined(GPS_CULL_AVX)
+        for (; i + 8 <= count; i += 8) {
+            __m256 cx = _mm256_loadu_ps(&centerX[i]), cy = _mm256_loadu_ps(&centerY[i]), cz = _mm256_loadu_ps(&centerZ[i]);
+            __m256 ex = _mm256_loadu_ps(&extentX[i]), ey = _mm256_loadu_ps(&extentY[i]), ez = _mm256_loadu_ps(&extentZ[i]);
+            __m256 outside = _mm256_setzero_ps();
+            for (int p = 0; p < 6; p++) {
+                const glm::vec4 &plane = frustum.planes[p];
+                __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(plane.x)),
+                                                              _mm256_mul_ps(cy, _mm256_set1_ps(plane.y))),
+                                                _mm256_add_ps(_mm256_mul_ps(cz, _mm256_set1_ps(plane.z)),
+                                                              _mm256_set1_ps(plane.w)));
+                __m256 reach = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ex, _mm256_set1_ps(std::fabs(plane.x))),
+                                                           _mm256_mul_ps(ey, _mm256_set1_ps(std::fabs(plane.y)))),
+                                             _mm256_mul_ps(ez, _mm256_set1_ps(std::fabs(plane.z))));
+                outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, reach), _mm256_setzero_ps(), _CMP_LT_OQ));
+            }
+            int mask = _mm256_movemask_ps(outside);
+            for (int lane = 0; lane < 8; lane++) {
+                uint8_t inside = (mask & (1 << lane)) ? 0 : 1;
+                visible[i + lane] = inside;
+                visibleCount += inside;
+            }
+        }
+#elif defined(GPS_CULL_SSE2)
+        for (; i + 4 <= count; i += 4) {
+            __m128 cx = _mm_loadu_ps(&centerX[i]), cy = _mm_loadu_ps(&centerY[i]), cz = _mm_loadu_ps(&centerZ[i]);
+            __m128 ex = _mm_loadu_ps(&extentX[i]), ey = _mm_loadu_ps(&extentY[i]), ez = _mm_loadu_ps(&extentZ[i]);
+            __m128 outside = _mm_setzero_ps();
+            for (int p = 0; p < 6; p++) {
+                const glm::vec4 &plane = frustum.planes[p];
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)), _mm_mul_ps(cy, _mm_set1_ps(plane.y))),
+                                             _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+                __m128 reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(std::fabs(plane.x))),
+                                                     _mm_mul_ps(ey, _mm_set1_ps(std::fabs(plane.y)))),
+                                          _mm_mul_ps(ez, _mm_set1_ps(std::fabs(plane.z))));
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, reach), _mm_setzero_ps()));
+            }
+            int mask = _mm_movemask_ps(outside);
+            for (int lane = 0; lane < 4; lane++) {
+                uint8_t inside = (mask & (1 << lane)) ? 0 : 1;
+                visible[i + lane] = inside;
+                visibleCount += inside;
+            }
+        }
+#endif
+        for (; i < count; i++) {
+            uint8_t inside = 1;
+            for (int p = 0; p < 6 && inside; p++) {
+                const glm::vec4 &plane = frustum.planes[p];
+                float distance = centerX[i] * plane.x + centerY[i] * plane.y + centerZ[i] * plane.z + plane.w;
+                float reach = extentX[i] * std::fabs(plane.x) + extentY[i] * std::fabs(plane.y) + extentZ[i] * std::fabs(plane.z);
+                if (distance + reach < 0.0f) {
+                    inside = 0;
+                }
+            }
+            visible[i] = inside;
+            visibleCount += inside;
+        }
+        return visibleCount;
+    }
+
+    size_t FrustumCuller::getCount() const {
+        return centerX.size();
+    }
+
+    BoundingBox FrustumCuller::getBounds(size_t index) const {
+        glm::vec3 center(centerX[index], centerY[index], centerZ[index]);
+        glm::vec3 extent(extentX[index], extentY[index], extentZ[index]);
+        BoundingBox box = { center - extent, center + extent };
+        return box;
+    }
+
+}
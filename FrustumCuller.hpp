@@ -0,0 +1,50 @@
+#ifndef FrustumCuller_hpp
+#define FrustumCuller_hpp
+
+#include "Mesh.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    // Clip-space planes of a view-projection matrix, as (normal, distance) with the inside positive
+    struct Frustum {
+        glm::vec4 planes[6];
+
+        static Frustum FromMatrix(const glm::mat4 &viewProjection);
+    };
+
+    // World-space boxes kept as structure of arrays (centers and half extents) and tested
+    // against a frustum eight (AVX) or four (SSE) at a time
+    class FrustumCuller {
+
+    public:
+        void Clear();
+        // appends the world bounds of a model-space box under transform and returns its index
+        size_t Add(const BoundingBox &bounds, const glm::mat4 &transform);
+        // appends a box already in world space and returns its index
+        size_t Add(const BoundingBox &worldBounds);
+        // replaces the index-th box
+        void Set(size_t index, const BoundingBox &worldBounds);
+        // sets visible[i] to 1 for the boxes intersecting the frustum, 0 for the others;
+        // returns the number of visible boxes
+        size_t Cull(const Frustum &frustum, std::vector<uint8_t> &visible) const;
+        // same for the count boxes from first on, visible[i] standing for box first + i
+        size_t Cull(const Frustum &frustum, size_t first, size_t count, std::vector<uint8_t> &visible) const;
+
+        size_t getCount() const;
+        // world box of the index-th added box
+        BoundingBox getBounds(size_t index) const;
+
+    private:
+        std::vector<float> centerX, centerY, centerZ;
+        std::vector<float> extentX, extentY, extentZ;
+    };
+
+}
+
+#endif /* FrustumCuller_hpp */
@@ -0,0 +1,253 @@
+#include "GLState.hpp"
+
+namespace gps {
+
+    namespace {
+
+        // marks a value GL has not been told yet, so the first call always goes through
+        const GLuint UNKNOWN = 0xFFFFFFFFu;
+        const int MAX_TEXTURE_UNITS = 16;
+        const int TEXTURE_TARGETS = 4;
+        const int MAX_UNIFORM_BINDINGS = 8;
+        // capabilities toggled by the renderer; others are forwarded untracked
+        const GLenum TRACKED_CAPABILITIES[] = { GL_BLEND, GL_DEPTH_TEST, GL_CULL_FACE, GL_FRAMEBUFFER_SRGB, GL_POLYGON_OFFSET_FILL };
+        const int CAPABILITY_COUNT = sizeof(TRACKED_CAPABILITIES) / sizeof(TRACKED_CAPABILITIES[0]);
+
+        struct BufferRange {
+            GLuint buffer;
+            GLintptr offset;
+            GLsizeiptr size;
+        };
+
+        struct State {
+            GLuint program;
+            GLuint vertexArray;
+            GLuint activeUnit;
+            GLuint textures[MAX_TEXTURE_UNITS][TEXTURE_TARGETS];
+            BufferRange uniformBuffers[MAX_UNIFORM_BINDINGS];
+            GLuint capabilities[CAPABILITY_COUNT];
+            GLuint blendSource;
+            GLuint blendDestination;
+            GLuint depthFunction;
+            GLuint depthMask;
+            GLuint cullFace;
+            GLuint polygonMode;
+
+            State() {
+                Reset();
+            }
+
+            void Reset() {
+                program = UNKNOWN;
+                vertexArray = UNKNOWN;
+                activeUnit = UNKNOWN;
+                for (int unit = 0; unit < MAX_TEXTURE_UNITS; unit++) {
+                    for (int target = 0; target < TEXTURE_TARGETS; target++) {
+                        textures[unit][target] = UNKNOWN;
+                    }
+                }
+                for (int i = 0; i < MAX_UNIFORM_BINDINGS; i++) {
+                    uniformBuffers[i].buffer = UNKNOWN;
+                    uniformBuffers[i].offset = 0;
+                    uniformBuffers[i].size = 0;
+                }
+                for (int i = 0; i < CAPABILITY_COUNT; i++) {
+                    capabilities[i] = UNKNOWN;
+                }
+                blendSource = UNKNOWN;
+                blendDestination = UNKNOWN;
+                depthFunction = UNKNOWN;
+                depthMask = UNKNOWN;
+                cullFace = UNKNOWN;
+                polygonMode = UNKNOWN;
+            }
+        };
+
+        State state;
+        GLStateStats frameStats;
+        GLStateStats lastFrameStats;
+
+        // updates the shadow value and reports whether GL has to be called
+        bool Change(GLuint &current, GLuint value) {
+            if (current == value) {
+                frameStats.saved++;
+                return false;
+            }
+            current = value;
+            frameStats.issued++;
+            return true;
+        }
+
+        int TargetIndex(GLenum target) {
+            switch (target) {
+            case GL_TEXTURE_2D: return 0;
+            case GL_TEXTURE_CUBE_MAP: return 1;
+            case GL_TEXTURE_2D_ARRAY: return 2;
+            case GL_TEXTURE_BUFFER: return 3;
+            default: return -1;
+            }
+        }
+
+        int CapabilityIndex(GLenum capability) {
+            for (int i = 0; i < CAPABILITY_COUNT; i++) {
+                if (TRACKED_CAPABILITIES[i] == capability) {
+                    return i;
+                }
+            }
+            return -1;
+        }
+
+        void SetCapability(GLenum capability, bool enabled) {
+            int index = CapabilityIndex(capability);
+            if (index != -1 && !Change(state.capabilities[index], enabled ? 1 : 0)) {
+                return;
+            }
+            if (index == -1) {
+                frameStats.issued++;
+            }
+            if (enabled) {
+                glEnable(capability);
+            } else {
+                glDisable(capability);
+            }
+        }
+    }
+
+    void GLState::UseProgram(GLuint program) {
+        if (Change(state.program, program)) {
+            glUseProgram(program);
+        }
+    }
+
+    void GLState::BindVertexArray(GLuint vertexArray) {
+        if (Change(state.vertexArray, vertexArray)) {
+            glBindVertexArray(vertexArray);
+        }
+    }
+
+    void GLState::BindTexture(GLuint unit, GLenum target, GLuint texture) {
+        int targetIndex = TargetIndex(target);
+        if (unit >= (GLuint)MAX_TEXTURE_UNITS || targetIndex == -1) {
+            // untracked binding: forward it and forget the active unit
+            glActiveTexture(GL_TEXTURE0 + unit);
+            glBindTexture(target, texture);
+            state.activeUnit = unit;
+            frameStats.issued += 2;
+            return;
+        }
+        if (!Change(state.textures[unit][targetIndex], texture)) {
+            return;
+        }
+        if (Change(state.activeUnit, unit)) {
+            glActiveTexture(GL_TEXTURE0 + unit);
+        }
+        glBindTexture(target, texture);
+    }
+
+    void GLState::BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+        if (target == GL_UNIFORM_BUFFER && index < (GLuint)MAX_UNIFORM_BINDINGS) {
+            BufferRange &range = state.uniformBuffers[index];
+            if (range.buffer == buffer && range.offset == offset && range.size == size) {
+                frameStats.saved++;
+                return;
+            }
+            range.buffer = buffer;
+            range.offset = offset;
+            range.size = size;
+        }
+        frameStats.issued++;
+        glBindBufferRange(target, index, buffer, offset, size);
+    }
+
+    void GLState::Enable(GLenum capability) {
+        SetCapability(capability, true);
+    }
+
+    void GLState::Disable(GLenum capability) {
+        SetCapability(capability, false);
+    }
+
+    void GLState::BlendFunc(GLenum sourceFactor, GLenum destinationFactor) {
+        if (state.blendSource == sourceFactor && state.blendDestination == destinationFactor) {
+            frameStats.saved++;
+            return;
+        }
+        state.blendSource = sourceFactor;
+        state.blendDestination = destinationFactor;
+        frameStats.issued++;
+        glBlendFunc(sourceFactor, destinationFactor);
+    }
+
+    void GLState::DepthFunc(GLenum function) {
+        if (Change(state.depthFunction, function)) {
+            glDepthFunc(function);
+        }
+    }
+
+    void GLState::DepthMask(GLboolean enabled) {
+        if (Change(state.depthMask, enabled)) {
+            glDepthMask(enabled);
+        }
+    }
+
+    void GLState::CullFace(GLenum face) {
+        if (Change(state.cullFace, face)) {
+            glCullFace(face);
+        }
+    }
+
+    void GLState::PolygonMode(GLenum mode) {
+        if (Change(state.polygonMode, mode)) {
+            glPolygonMode(GL_FRONT_AND_BACK, mode);
+        }
+    }
+
+    void GLState::OnTextureDeleted(GLuint texture) {
+        for (int unit = 0; unit < MAX_TEXTURE_UNITS; unit++) {
+            for (int target = 0; target < TEXTURE_TARGETS; target++) {
+                if (state.textures[unit][target] == texture) {
+                    state.textures[unit][target] = 0;
+                }
+            }
+        }
+    }
+
+    void GLState::OnBufferDeleted(GLuint buffer) {
+        for (int i = 0; i < MAX_UNIFORM_BINDINGS; i++) {
+            if (state.uniformBuffers[i].buffer == buffer) {
+                state.uniformBuffers[i].buffer = 0;
+            }
+        }
+    }
+
+    void GLState::OnVertexArrayDeleted(GLuint vertexArray) {
+        if (state.vertexArray == vertexArray) {
+            state.vertexArray = 0;
+        }
+    }
+
+    void GLState::OnProgramDeleted(GLuint program) {
+        // a deleted program stays in use until another one is bound, only the name is freed
+        if (state.program == program) {
+            state.program = UNKNOWN;
+        }
+    }
+
+    void GLState::Invalidate() {
+        state.Reset();
+    }
+
+    void GLState::BeginFrame() {
+        lastFrameStats = frameStats;
+        frameStats = GLStateStats();
+    }
+
+    GLStateStats GLState::getFrameStats() {
+        return frameStats;
+    }
+
+    GLStateStats GLState::getLastFrameStats() {
+        return lastFrameStats;
+    }
+
+}
@@ -0,0 +1,60 @@
+#ifndef GLState_hpp
+#define GLState_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <cstddef>
+
+namespace gps {
+
+    // Calls forwarded to GL and calls dropped because they would not change anything
+    struct GLStateStats {
+        size_t issued = 0;
+        size_t saved = 0;
+    };
+
+    // Shadow of the GL state the renderer touches, for the single context of the application.
+    // Every change of programs, VAOs, texture and uniform buffer bindings, blend/depth/cull state and polygon mode
+    // goes through here so that calls setting the current value are skipped.
+    class GLState {
+
+    public:
+        static void UseProgram(GLuint program);
+        static void BindVertexArray(GLuint vertexArray);
+        // selects the unit with glActiveTexture only when the binding actually changes
+        static void BindTexture(GLuint unit, GLenum target, GLuint texture);
+        // indexed buffer ranges; only GL_UNIFORM_BUFFER binding points are tracked
+        static void BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+        static void Enable(GLenum capability);
+        static void Disable(GLenum capability);
+        static void BlendFunc(GLenum sourceFactor, GLenum destinationFactor);
+        static void DepthFunc(GLenum function);
+        static void DepthMask(GLboolean enabled);
+        static void CullFace(GLenum face);
+        // applies to GL_FRONT_AND_BACK, the only face core profiles accept
+        static void PolygonMode(GLenum mode);
+
+        // forget bindings of deleted objects, GL resets them to 0
+        static void OnTextureDeleted(GLuint texture);
+        static void OnBufferDeleted(GLuint buffer);
+        static void OnVertexArrayDeleted(GLuint vertexArray);
+        static void OnProgramDeleted(GLuint program);
+        // forget everything, for code that changed GL state behind the cache
+        static void Invalidate();
+
+        // starts a new frame: the counters of the one just finished become getLastFrameStats
+        static void BeginFrame();
+        static GLStateStats getFrameStats();
+        static GLStateStats getLastFrameStats();
+    };
+
+}
+
+#endif /* GLState_hpp */
@@ -0,0 +1,112 @@
+#include "MappedFile.hpp"
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace gps {
+
+    MappedFile::MappedFile() {
+        mappedData = NULL;
+        mappedSize = 0;
+#if defined(_WIN32)
+        fileHandle = NULL;
+        mappingHandle = NULL;
+#endif
+    }
+
+    MappedFile::~MappedFile() {
+        Close();
+    }
+
+    bool MappedFile::Open(const std::string &fileName) {
+        Close();
+
+#if defined(_WIN32)
+        HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+            CloseHandle(file);
+            return false;
+        }
+
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL) {
+            CloseHandle(file);
+            return false;
+        }
+
+        void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (view == NULL) {
+            CloseHandle(mapping);
+            CloseHandle(file);
+            return false;
+        }
+
+        fileHandle = file;
+        mappingHandle = mapping;
+        mappedData = (const char *)view;
+        mappedSize = (size_t)fileSize.QuadPart;
+#else
+        int fd = open(fileName.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat fileInfo;
+        if (fstat(fd, &fileInfo) != 0 || fileInfo.st_size == 0) {
+            close(fd);
+            return false;
+        }
+
+        void *view = mmap(NULL, (size_t)fileInfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // the mapping keeps its own reference to the file
+        close(fd);
+        if (view == MAP_FAILED) {
+            return false;
+        }
+
+        mappedData = (const char *)view;
+        mappedSize = (size_t)fileInfo.st_size;
+#endif
+        return true;
+    }
+
+    void MappedFile::Close() {
+        if (mappedData == NULL) {
+            return;
+        }
+
+#if defined(_WIN32)
+        UnmapViewOfFile(mappedData);
+        CloseHandle(mappingHandle);
+        CloseHandle(fileHandle);
+        mappingHandle = NULL;
+        fileHandle = NULL;
+#else
+        munmap((void *)mappedData, mappedSize);
+#endif
+        mappedData = NULL;
+        mappedSize = 0;
+    }
+
+    const char *MappedFile::data() const {
+        return mappedData;
+    }
+
+    size_t MappedFile::size() const {
+        return mappedSize;
+    }
+
+}
@@ -0,0 +1,37 @@
+#ifndef MappedFile_hpp
+#define MappedFile_hpp
+
+#include <cstddef>
+#include <string>
+
+namespace gps {
+
+    // Read-only memory mapping of a whole file
+    class MappedFile {
+
+    public:
+        MappedFile();
+        ~MappedFile();
+
+        // maps the file into memory, returns false if it cannot be opened
+        bool Open(const std::string &fileName);
+        void Close();
+
+        const char *data() const;
+        size_t size() const;
+
+    private:
+        MappedFile(const MappedFile &);
+        MappedFile &operator=(const MappedFile &);
+
+        const char *mappedData;
+        size_t mappedSize;
+#if defined(_WIN32)
+        void *fileHandle;
+        void *mappingHandle;
+#endif
+    };
+
+}
+
+#endif /* MappedFile_hpp */
@@ -1,7 +1,33 @@
 #include "Mesh.hpp"
+#include "GLState.hpp"
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GPS_MESH_SSE2
+#include <emmintrin.h>
+#endif
+
 namespace gps {
 
+	namespace {
+
+		// Fixed texture unit per sampler name, so every mesh drawn with a program agrees
+		// with the sampler uniforms set when its binding was built
+		GLint TextureUnitFor(const std::string &type) {
+			if (type == "diffuseTexture") return 0;
+			if (type == "specularTexture") return 1;
+			if (type == "ambientTexture") return 2;
+			return -1;
+		}
+
+		glm::vec3 TransformPoint(const glm::mat4 &transform, glm::vec3 point) {
+			return glm::vec3(transform * glm::vec4(point, 1.0f));
+		}
+	}
+
 	/* Mesh Constructor */
 	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures, Material material) {
 
@@ -10,88 +36,292 @@ namespace gps {
 		this->textures = textures;
 		this->material = material;
 
-		this->setupMesh();
+		this->bounds = ComputeBounds(this->vertices);
+		this->sphere.center = (this->bounds.min + this->bounds.max) * 0.5f;
+		this->sphere.radius = this->vertices.empty() ? 0.0f :
+			ComputeRadius(&this->vertices[0], this->vertices.size(), this->sphere.center);
+
+		this->classifyTextures();
+		this->setupMesh(this->vertices, this->indices);
+	}
+
+	Mesh::Mesh(const MeshData &data, bool keepGeometry) {
+
+		if (keepGeometry) {
+			this->vertices = data.vertices;
+			this->indices = data.indices;
+		}
+		this->textures = data.textures;
+		this->material = data.material;
+		this->bounds = data.bounds;
+		this->sphere.center = (this->bounds.min + this->bounds.max) * 0.5f;
+		this->sphere.radius = data.radius;
+
+		this->classifyTextures();
+		this->setupMesh(data.vertices, data.indices);
+	}
+
+	Mesh::Mesh(const Vertex *vertexData, size_t vertexCount, const void *indexData, size_t indexCount, GLenum indexType,
+	           std::vector<Texture> textures, Material material, BoundingBox bounds, float radius, bool keepGeometry) {
+
+		// widened copies only for the passes that rebuild or inspect the geometry
+		if (keepGeometry) {
+			this->vertices.assign(vertexData, vertexData + vertexCount);
+			if (indexType == GL_UNSIGNED_SHORT) {
+				const GLushort *shortIndices = (const GLushort *)indexData;
+				this->indices.assign(shortIndices, shortIndices + indexCount);
+			} else {
+				const GLuint *intIndices = (const GLuint *)indexData;
+				this->indices.assign(intIndices, intIndices + indexCount);
+			}
+		}
+		this->textures = textures;
+		this->material = material;
+		this->bounds = bounds;
+		this->sphere.center = (bounds.min + bounds.max) * 0.5f;
+		this->sphere.radius = radius;
+		this->classifyTextures();
+
+		// upload straight from the caller's ranges, no conversion needed
+		this->indexType = indexType;
+		this->uploadBuffers(vertexData, vertexCount, indexData, indexCount);
+	}
+
+	ArenaRange Mesh::getArenaRange() {
+	    return this->range;
+	}
+
+	GLenum Mesh::getIndexType() {
+		return this->indexType;
+	}
+
+	GLint Mesh::getFirstInstance() {
+		return this->firstInstance;
+	}
+
+	void Mesh::SetInstances(const std::vector<glm::mat4> &transforms) {
+
+		if (this->firstInstance != -1) {
+			MeshArena::Shared().FreeInstances(this->firstInstance, this->instances.size());
+		}
+		this->instances = transforms;
+		this->firstInstance = (GLint)MeshArena::Shared().AllocateInstances(&transforms[0], transforms.size());
+
+		// union of the transformed corners of the stored bounds
+		BoundingBox local = ComputeBounds(this->vertices);
+		BoundingBox all = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+		for (size_t i = 0; i < transforms.size(); i++) {
+			for (int corner = 0; corner < 8; corner++) {
+				glm::vec3 point((corner & 1) ? local.max.x : local.min.x,
+				                (corner & 2) ? local.max.y : local.min.y,
+				                (corner & 4) ? local.max.z : local.min.z);
+				point = TransformPoint(transforms[i], point);
+				all.min = glm::min(all.min, point);
+				all.max = glm::max(all.max, point);
+			}
+		}
+		this->bounds = all;
+
+		// rigid placements keep the stored radius around each moved center
+		BoundingSphere localSphere;
+		localSphere.center = (local.min + local.max) * 0.5f;
+		localSphere.radius = ComputeRadius(&this->vertices[0], this->vertices.size(), localSphere.center);
+		this->sphere.center = (all.min + all.max) * 0.5f;
+		this->sphere.radius = 0.0f;
+		for (size_t i = 0; i < transforms.size(); i++) {
+			float reach = glm::length(TransformPoint(transforms[i], localSphere.center) - this->sphere.center) + localSphere.radius;
+			this->sphere.radius = std::max(this->sphere.radius, reach);
+		}
+	}
+
+	Mesh Mesh::ShareGeometry(const std::vector<glm::mat4> &transforms) {
+
+		Mesh shared(*this);
+		shared.instances.clear();
+		shared.firstInstance = -1;
+		++*this->rangeOwners;
+		shared.SetInstances(transforms);
+		return shared;
+	}
+
+	void Mesh::Release() {
+
+		if (this->rangeOwners && --*this->rangeOwners == 0) {
+			MeshArena::Shared().Free(this->range);
+		}
+		this->rangeOwners.reset();
+		if (this->firstInstance != -1) {
+			MeshArena::Shared().FreeInstances(this->firstInstance, this->instances.size());
+			this->firstInstance = -1;
+		}
+	}
+
+	GLenum Mesh::ChooseIndexType(size_t vertexCount) {
+		return (vertexCount <= 65536) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	}
+
+	BoundingBox Mesh::ComputeBounds(const std::vector<Vertex> &vertices) {
+		if (vertices.empty()) {
+			return ComputeBounds(NULL, 0);
+		}
+		return ComputeBounds(&vertices[0], vertices.size());
+	}
+
+	BoundingBox Mesh::ComputeBounds(const Vertex *vertices, size_t count) {
+		BoundingBox box;
+		box.min = glm::vec3(FLT_MAX);
+		box.max = glm::vec3(-FLT_MAX);
+		size_t i = 0;
+#if defined(GPS_MESH_SSE2)
+		// each load takes Position plus Normal.x, the fourth lane is ignored;
+		// two accumulator pairs keep the min/max dependency chains short
+		__m128 min0 = _mm_set1_ps(FLT_MAX), min1 = min0;
+		__m128 max0 = _mm_set1_ps(-FLT_MAX), max1 = max0;
+		for (; i + 2 <= count; i += 2) {
+			__m128 p0 = _mm_loadu_ps(&vertices[i].Position.x);
+			__m128 p1 = _mm_loadu_ps(&vertices[i + 1].Position.x);
+			min0 = _mm_min_ps(min0, p0);
+			max0 = _mm_max_ps(max0, p0);
+			min1 = _mm_min_ps(min1, p1);
+			max1 = _mm_max_ps(max1, p1);
+		}
+		float lanes[4];
+		_mm_storeu_ps(lanes, _mm_min_ps(min0, min1));
+		box.min = glm::vec3(lanes[0], lanes[1], lanes[2]);
+		_mm_storeu_ps(lanes, _mm_max_ps(max0, max1));
+		box.max = glm::vec3(lanes[0], lanes[1], lanes[2]);
+#endif
+		for (; i < count; i++) {
+			box.min = glm::min(box.min, vertices[i].Position);
+			box.max = glm::max(box.max, vertices[i].Position);
+		}
+		return box;
 	}
 
-	Buffers Mesh::getBuffers() {
-	    return this->buffers;
+	float Mesh::ComputeRadius(const Vertex *vertices, size_t count, glm::vec3 center) {
+		float maxDistance2 = 0.0f;
+		size_t i = 0;
+#if defined(GPS_MESH_SSE2)
+		// the fourth lane is masked out before the horizontal sum
+		const __m128 mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+		const __m128 c = _mm_set_ps(0.0f, center.z, center.y, center.x);
+		__m128 best = _mm_setzero_ps();
+		for (; i < count; i++) {
+			__m128 d = _mm_and_ps(_mm_sub_ps(_mm_loadu_ps(&vertices[i].Position.x), c), mask);
+			d = _mm_mul_ps(d, d);
+			d = _mm_add_ps(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(2, 3, 0, 1)));
+			d = _mm_add_ps(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(1, 0, 3, 2)));
+			best = _mm_max_ps(best, d);
+		}
+		maxDistance2 = _mm_cvtss_f32(best);
+#endif
+		for (; i < count; i++) {
+			glm::vec3 d = vertices[i].Position - center;
+			maxDistance2 = std::max(maxDistance2, glm::dot(d, d));
+		}
+		return std::sqrt(maxDistance2);
 	}
 
 	/* Mesh drawing function - also applies associated textures */
-	void Mesh::Draw(gps::Shader shader, int flatShading) {
+	void Mesh::Draw(gps::Shader shader) {
 
 		shader.useShaderProgram();
 
-		// flatShading uniform is set after the shader program is active
-		GLint flatLoc = glGetUniformLocation(shader.shaderProgram, "flatShading");
-		if (flatLoc != -1) {
-			glUniform1i(flatLoc, flatShading);
+		const MaterialBinding &binding = getBinding(shader);
+
+		// bind only the textures the program samples; GLState drops the ones already bound
+		for (size_t i = 0; i < binding.textureIds.size(); i++) {
+			GLState::BindTexture(binding.textureUnits[i], GL_TEXTURE_2D, binding.textureIds[i]);
 		}
 
-		// set material uniforms
-		GLint matDiffLoc = glGetUniformLocation(shader.shaderProgram, "materialDiffuse");
-		if (matDiffLoc != -1) {
-			glUniform3fv(matDiffLoc, 1, glm::value_ptr(this->material.diffuse));
+		// every mesh shares the arena VAO, so after the first draw of a frame the bind is dropped
+		GLState::BindVertexArray(MeshArena::Shared().getVertexArray());
+		if (this->instances.empty()) {
+			glDrawElementsBaseVertex(GL_TRIANGLES, this->indexCount, this->indexType,
+				(GLvoid*)this->range.indexOffset, this->range.baseVertex);
+			return;
 		}
 
-		// detect presence of diffuse/specular textures
-		bool hasDiffuse = false;
-		bool hasSpecular = false;
-		for (GLuint i = 0; i < textures.size(); i++) {
-			if (this->textures[i].type == "diffuseTexture") hasDiffuse = true;
-			if (this->textures[i].type == "specularTexture") hasSpecular = true;
+		// the vertex shader reads the placements from the first instance set in the DrawBlock
+		GLState::BindTexture(INSTANCE_TEXTURE_UNIT, GL_TEXTURE_BUFFER, MeshArena::Shared().getInstanceTexture());
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, this->indexCount, this->indexType,
+			(GLvoid*)this->range.indexOffset, (GLsizei)this->instances.size(), this->range.baseVertex);
+	}
+
+	void Mesh::DrawDepth() {
+
+		// no textures, no material, 12-byte vertices
+		GLState::BindVertexArray(MeshArena::Shared().getDepthVertexArray());
+		if (this->instances.empty()) {
+			glDrawElementsBaseVertex(GL_TRIANGLES, this->indexCount, this->indexType,
+				(GLvoid*)this->range.indexOffset, this->range.baseVertex);
+			return;
 		}
-		GLint hasDiffLoc = glGetUniformLocation(shader.shaderProgram, "hasDiffuseTexture");
-		if (hasDiffLoc != -1) glUniform1i(hasDiffLoc, hasDiffuse ? 1 : 0);
-		GLint hasSpecLoc = glGetUniformLocation(shader.shaderProgram, "hasSpecularTexture");
-		if (hasSpecLoc != -1) glUniform1i(hasSpecLoc, hasSpecular ? 1 : 0);
 
-		// bind textures
-		for (GLuint i = 0; i < textures.size(); i++) {
-			glActiveTexture(GL_TEXTURE0 + i);
-			glUniform1i(glGetUniformLocation(shader.shaderProgram, this->textures[i].type.c_str()), i);
-			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
+		GLState::BindTexture(INSTANCE_TEXTURE_UNIT, GL_TEXTURE_BUFFER, MeshArena::Shared().getInstanceTexture());
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, this->indexCount, this->indexType,
+			(GLvoid*)this->range.indexOffset, (GLsizei)this->instances.size(), this->range.baseVertex);
+	}
+
+	const MaterialBinding &Mesh::getBinding(gps::Shader &shader) {
+
+		for (size_t i = 0; i < this->bindings.size(); i++) {
+			if (this->bindings[i].program == shader.shaderProgram) {
+				return this->bindings[i];
+			}
 		}
 
-		glBindVertexArray(this->buffers.VAO);
-		glDrawElements(GL_TRIANGLES, (GLsizei)this->indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+		MaterialBinding binding;
+		binding.program = shader.shaderProgram;
 
-        for(GLuint i = 0; i < this->textures.size(); i++) {
+		for (size_t i = 0; i < this->textures.size(); i++) {
+			const Texture &texture = this->textures[i];
+			GLint unit = TextureUnitFor(texture.type);
+			Uniform<int> sampler = shader.getUniform<int>(texture.type);
+			if (unit == -1 || !sampler.isValid()) {
+				continue;
+			}
+			// sampler uniforms are program state and identical for every mesh
+			shader.setUniform(sampler, unit);
+			binding.textureIds.push_back(texture.id);
+			binding.textureUnits.push_back(unit);
+		}
 
-            glActiveTexture(GL_TEXTURE0 + i);
-            glBindTexture(GL_TEXTURE_2D, 0);
-        }
+		Uniform<int> instanceSampler = shader.getUniform<int>("instanceTransforms");
+		if (instanceSampler.isValid()) {
+			shader.setUniform(instanceSampler, INSTANCE_TEXTURE_UNIT);
+		}
 
-    }
+		this->bindings.push_back(binding);
+		return this->bindings.back();
+	}
 
-	// Initializes all the buffer objects/arrays
-	void Mesh::setupMesh() {
+	void Mesh::classifyTextures() {
 
-		// Create buffers/arrays
-		glGenVertexArrays(1, &this->buffers.VAO);
-		glGenBuffers(1, &this->buffers.VBO);
-		glGenBuffers(1, &this->buffers.EBO);
+		for (size_t i = 0; i < this->textures.size(); i++) {
+			if (this->textures[i].type == "diffuseTexture") this->hasDiffuseTexture = 1;
+			if (this->textures[i].type == "specularTexture") this->hasSpecularTexture = 1;
+		}
+	}
 
-		glBindVertexArray(this->buffers.VAO);
-		// Load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.VBO);
-		glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
+	// Copies the vertices and indices into the shared arena
+	void Mesh::setupMesh(const std::vector<Vertex> &vertexData, const std::vector<GLuint> &indexData) {
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->buffers.EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
+		this->indexType = ChooseIndexType(vertexData.size());
+		if (this->indexType == GL_UNSIGNED_SHORT) {
+			std::vector<GLushort> shortIndices(indexData.begin(), indexData.end());
+			this->uploadBuffers(vertexData.data(), vertexData.size(), shortIndices.data(), shortIndices.size());
+		} else {
+			this->uploadBuffers(vertexData.data(), vertexData.size(), indexData.data(), indexData.size());
+		}
+	}
 
-		// Set the vertex attribute pointers
-		// Vertex Positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
-		// Vertex Normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
-		// Vertex Texture Coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+	void Mesh::uploadBuffers(const Vertex *vertexData, size_t vertexCount, const void *indexData, size_t indexCount) {
 
-		glBindVertexArray(0);
+		// indices stay relative to the mesh, the draw adds the base vertex
+		size_t indexSize = (this->indexType == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+		this->indexCount = (GLsizei)indexCount;
+		this->range = MeshArena::Shared().Allocate(vertexData, vertexCount, indexData, indexCount * indexSize);
+		this->rangeOwners = std::make_shared<size_t>(1);
 	}
-}
+}
\ No newline at end of file
@@ -12,13 +12,18 @@
 #include <glm/glm.hpp>
 
 #include "Shader.hpp"
+#include "MeshArena.hpp"
 
+#include <memory>
 #include <string>
 #include <vector>
 
 
 namespace gps {
 
+    // texture unit of the instance transform buffer texture read by the vertex shaders
+    const GLint INSTANCE_TEXTURE_UNIT = 6;
+
     struct Vertex {
 
         glm::vec3 Position;
@@ -41,32 +46,111 @@ namespace gps {
         glm::vec3 specular;
     };
 
-    struct Buffers {
-        GLuint VAO;
-        GLuint VBO;
-        GLuint EBO;
+    // Axis-aligned bounds in model space
+    struct BoundingBox {
+        glm::vec3 min;
+        glm::vec3 max;
+    };
+
+    // Bounding sphere in model space
+    struct BoundingSphere {
+        glm::vec3 center;
+        float radius;
+    };
+
+    // CPU-side mesh description, built without touching GL so it can be produced on any thread
+    struct MeshData {
+        std::vector<Vertex> vertices;
+        std::vector<GLuint> indices;
+        // texture ids are assigned once the textures are uploaded
+        std::vector<Texture> textures;
+        Material material;
+        BoundingBox bounds;
+        // distance from the center of bounds to the farthest vertex
+        float radius = 0.0f;
+    };
+
+    // Texture state of a mesh resolved against one shader program
+    struct MaterialBinding {
+        GLuint program = 0;
+        // textures the program samples, with their fixed texture units
+        std::vector<GLuint> textureIds;
+        std::vector<GLint> textureUnits;
     };
 
     class Mesh {
 
     public:
+        // CPU copies of the uploaded geometry, for the load-time passes that read it back;
+        // empty when the mesh was built with keepGeometry off
         std::vector<Vertex> vertices;
         std::vector<GLuint> indices;
         std::vector<Texture> textures;
         Material material;
+        BoundingBox bounds;
+        // centered on the box, radius reaching the farthest vertex
+        BoundingSphere sphere;
+        // 1 when textures holds a map of that kind
+        int hasDiffuseTexture = 0;
+        int hasSpecularTexture = 0;
+        // model-space placements of an instanced mesh, empty when it is drawn once as stored;
+        // bounds and sphere then enclose every instance
+        std::vector<glm::mat4> instances;
 
     	Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures, Material material);
-
-	    Buffers getBuffers();
-
-    	void Draw(gps::Shader shader, int flatShading = 0);
+    	explicit Mesh(const MeshData &data, bool keepGeometry = true);
+    	// Builds the mesh from ready-to-upload ranges (e.g. a mapped mesh cache) and their stored
+    	// bounds and radius; the index data must already be in the format returned by ChooseIndexType
+    	Mesh(const Vertex *vertexData, size_t vertexCount, const void *indexData, size_t indexCount, GLenum indexType,
+    	     std::vector<Texture> textures, Material material, BoundingBox bounds, float radius, bool keepGeometry);
+
+	    ArenaRange getArenaRange();
+	    GLenum getIndexType();
+	    // index of the first transform in the arena instance buffer, -1 when not instanced
+	    GLint getFirstInstance();
+
+	    // turns the mesh into one instance per transform, drawn with glDrawElementsInstanced
+	    void SetInstances(const std::vector<glm::mat4> &transforms);
+	    // another instanced mesh drawing the same arena geometry with its own placements
+	    Mesh ShareGeometry(const std::vector<glm::mat4> &transforms);
+	    // hands the arena ranges back, the geometry once the last mesh sharing it is released;
+	    // the mesh must not be drawn afterwards
+	    void Release();
+
+	    // 16-bit indices whenever every vertex is addressable by them
+	    static GLenum ChooseIndexType(size_t vertexCount);
+	    // SIMD min/max reduction over the vertex positions
+	    static BoundingBox ComputeBounds(const std::vector<Vertex> &vertices);
+	    static BoundingBox ComputeBounds(const Vertex *vertices, size_t count);
+	    // distance from center to the farthest vertex
+	    static float ComputeRadius(const Vertex *vertices, size_t count, glm::vec3 center);
+
+    	// binds the textures and draws; material constants are read from the DrawBlock the caller bound
+    	void Draw(gps::Shader shader);
+    	// draws the positions only, through the arena's depth stream; the caller has bound a
+    	// depth program whose instanceTransforms sampler reads INSTANCE_TEXTURE_UNIT
+    	void DrawDepth();
 
     private:
         /*  Render data  */
-        Buffers buffers;
-
-	    // Initializes all the buffer objects/arrays
-	    void setupMesh();
+        // vertices and indices inside MeshArena::Shared()
+        ArenaRange range;
+        // meshes built by ShareGeometry that still hold range
+        std::shared_ptr<size_t> rangeOwners;
+        GLint firstInstance = -1;
+        // GL_UNSIGNED_SHORT when the mesh fits 16-bit indices, GL_UNSIGNED_INT otherwise
+        GLenum indexType;
+        GLsizei indexCount = 0;
+        // one record per program the mesh was drawn with
+        std::vector<MaterialBinding> bindings;
+
+	    // Sets the texture presence flags
+	    void classifyTextures();
+	    // Copies the vertices and indices into the shared arena
+	    void setupMesh(const std::vector<Vertex> &vertexData, const std::vector<GLuint> &indexData);
+	    void uploadBuffers(const Vertex *vertexData, size_t vertexCount, const void *indexData, size_t indexCount);
+	    // Resolves uniform handles and texture units the first time a program is used
+	    const MaterialBinding &getBinding(gps::Shader &shader);
 
     };
 
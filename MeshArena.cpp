@@ -0,0 +1,297 @@
+#include "MeshArena.hpp"
+#include "GLState.hpp"
+#include "Mesh.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+namespace gps {
+
+    namespace {
+
+        // first reservation (32 MB of vertices, 8 MB of indices), doubled whenever a mesh does not fit
+        const size_t INITIAL_VERTICES = 1 << 20;
+        const size_t INITIAL_INDEX_BYTES = 1 << 23;
+        const size_t INDEX_ALIGNMENT = 4;
+        const size_t INITIAL_INSTANCES = 1 << 12;
+
+        size_t GrownCapacity(size_t capacity, size_t minimum, size_t required) {
+            size_t grown = std::max(capacity * 2, minimum);
+            return std::max(grown, capacity + required);
+        }
+    }
+
+    RangeAllocator::RangeAllocator(size_t capacity) {
+        this->capacity = 0;
+        used = 0;
+        Grow(capacity);
+    }
+
+    size_t RangeAllocator::Allocate(size_t size, size_t alignment) {
+        for (std::map<size_t, size_t>::iterator it = freeRanges.begin(); it != freeRanges.end(); ++it) {
+            size_t start = it->first;
+            size_t end = it->first + it->second;
+            size_t aligned = (start + alignment - 1) / alignment * alignment;
+            if (aligned + size > end) {
+                continue;
+            }
+            freeRanges.erase(it);
+            if (aligned > start) {
+                freeRanges[start] = aligned - start;
+            }
+            if (aligned + size < end) {
+                freeRanges[aligned + size] = end - (aligned + size);
+            }
+            used += size;
+            return aligned;
+        }
+        return NO_SPACE;
+    }
+
+    void RangeAllocator::Free(size_t offset, size_t size) {
+        if (size == 0) {
+            return;
+        }
+        used -= size;
+        Insert(offset, size);
+    }
+
+    void RangeAllocator::Grow(size_t newCapacity) {
+        if (newCapacity <= capacity) {
+            return;
+        }
+        size_t oldCapacity = capacity;
+        capacity = newCapacity;
+        Insert(oldCapacity, newCapacity - oldCapacity);
+    }
+
+    size_t RangeAllocator::getCapacity() const {
+        return capacity;
+    }
+
+    size_t RangeAllocator::getUsed() const {
+        return used;
+    }
+
+    void RangeAllocator::Insert(size_t offset, size_t size) {
+        std::map<size_t, size_t>::iterator next = freeRanges.lower_bound(offset);
+        // merge with the range ending where this one starts
+        if (next != freeRanges.begin()) {
+            std::map<size_t, size_t>::iterator previous = next;
+            --previous;
+            if (previous->first + previous->second == offset) {
+                offset = previous->first;
+                size += previous->second;
+                freeRanges.erase(previous);
+            }
+        }
+        // and with the range starting where it ends
+        if (next != freeRanges.end() && offset + size == next->first) {
+            size += next->second;
+            freeRanges.erase(next);
+        }
+        freeRanges[offset] = size;
+    }
+
+    MeshArena::MeshArena() {
+        vao = 0;
+        vbo = 0;
+        ebo = 0;
+        depthVao = 0;
+        positionVbo = 0;
+        instanceBuffer = 0;
+        instanceTexture = 0;
+        maxInstances = 0;
+    }
+
+    ArenaRange MeshArena::Allocate(const void *vertices, size_t vertexCount, const void *indices, size_t indexBytes) {
+        size_t vertexOffset = vertexSpace.Allocate(vertexCount);
+        size_t indexOffset = indexSpace.Allocate(indexBytes, INDEX_ALIGNMENT);
+        if (vertexOffset == RangeAllocator::NO_SPACE || indexOffset == RangeAllocator::NO_SPACE) {
+            if (vertexOffset != RangeAllocator::NO_SPACE) {
+                vertexSpace.Free(vertexOffset, vertexCount);
+            }
+            if (indexOffset != RangeAllocator::NO_SPACE) {
+                indexSpace.Free(indexOffset, indexBytes);
+            }
+            Reserve(GrownCapacity(vertexSpace.getCapacity(), INITIAL_VERTICES, vertexCount),
+                    GrownCapacity(indexSpace.getCapacity(), INITIAL_INDEX_BYTES, indexBytes + INDEX_ALIGNMENT));
+            vertexOffset = vertexSpace.Allocate(vertexCount);
+            indexOffset = indexSpace.Allocate(indexBytes, INDEX_ALIGNMENT);
+        }
+
+        ArenaRange range;
+        range.baseVertex = (GLint)vertexOffset;
+        range.vertexCount = vertexCount;
+        range.indexOffset = indexOffset;
+        range.indexBytes = indexBytes;
+
+        // the copy targets leave the element binding of whichever VAO is bound untouched
+        glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, vertexOffset * sizeof(Vertex), vertexCount * sizeof(Vertex), vertices);
+        std::vector<glm::vec3> positions(vertexCount);
+        const Vertex *source = (const Vertex *)vertices;
+        for (size_t i = 0; i < vertexCount; i++) {
+            positions[i] = source[i].Position;
+        }
+        if (vertexCount > 0) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, positionVbo);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, vertexOffset * sizeof(glm::vec3), vertexCount * sizeof(glm::vec3), &positions[0]);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, ebo);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, indexOffset, indexBytes, indices);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        return range;
+    }
+
+    void MeshArena::Free(const ArenaRange &range) {
+        vertexSpace.Free(range.baseVertex, range.vertexCount);
+        indexSpace.Free(range.indexOffset, range.indexBytes);
+    }
+
+    size_t MeshArena::AllocateInstances(const glm::mat4 *transforms, size_t count) {
+        size_t first = instanceSpace.Allocate(count);
+        if (first == RangeAllocator::NO_SPACE) {
+            // the buffer texture addresses only GL_MAX_TEXTURE_BUFFER_SIZE texels, four per transform;
+            // past it texelFetch would silently return zeros
+            if (maxInstances == 0) {
+                GLint maxTexels = 0;
+                glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+                maxInstances = (size_t)std::max(maxTexels, 0) / 4;
+            }
+            size_t capacity = std::min(GrownCapacity(instanceSpace.getCapacity(), INITIAL_INSTANCES, count), maxInstances);
+            if (capacity > instanceSpace.getCapacity()) {
+                ReserveInstances(capacity);
+                first = instanceSpace.Allocate(count);
+            }
+            if (first == RangeAllocator::NO_SPACE) {
+                throw std::runtime_error("Instance transforms exceed GL_MAX_TEXTURE_BUFFER_SIZE!");
+            }
+        }
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, instanceBuffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, first * sizeof(glm::mat4), count * sizeof(glm::mat4), transforms);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return first;
+    }
+
+    void MeshArena::FreeInstances(size_t first, size_t count) {
+        instanceSpace.Free(first, count);
+    }
+
+    GLuint MeshArena::getVertexArray() const {
+        return vao;
+    }
+
+    GLuint MeshArena::getDepthVertexArray() const {
+        return depthVao;
+    }
+
+    GLuint MeshArena::getInstanceTexture() const {
+        return instanceTexture;
+    }
+
+    size_t MeshArena::getVertexCapacity() const {
+        return vertexSpace.getCapacity();
+    }
+
+    size_t MeshArena::getUsedVertices() const {
+        return vertexSpace.getUsed();
+    }
+
+    MeshArena &MeshArena::Shared() {
+        static MeshArena *arena = new MeshArena();
+        return *arena;
+    }
+
+    void MeshArena::Reserve(size_t vertexCapacity, size_t indexCapacity) {
+        GLuint newVbo, newEbo, newPositionVbo;
+        glGenBuffers(1, &newVbo);
+        glGenBuffers(1, &newEbo);
+        glGenBuffers(1, &newPositionVbo);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, newVbo);
+        glBufferData(GL_COPY_WRITE_BUFFER, vertexCapacity * sizeof(Vertex), NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, newPositionVbo);
+        glBufferData(GL_COPY_WRITE_BUFFER, vertexCapacity * sizeof(glm::vec3), NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, newEbo);
+        glBufferData(GL_COPY_WRITE_BUFFER, indexCapacity, NULL, GL_STATIC_DRAW);
+
+        if (vbo != 0) {
+            // keep the meshes already placed at their offsets
+            glBindBuffer(GL_COPY_READ_BUFFER, vbo);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, newVbo);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, vertexSpace.getCapacity() * sizeof(Vertex));
+            glBindBuffer(GL_COPY_READ_BUFFER, ebo);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, newEbo);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, indexSpace.getCapacity());
+            glBindBuffer(GL_COPY_READ_BUFFER, positionVbo);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, newPositionVbo);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, vertexSpace.getCapacity() * sizeof(glm::vec3));
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glDeleteBuffers(1, &vbo);
+            glDeleteBuffers(1, &ebo);
+            glDeleteBuffers(1, &positionVbo);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        vbo = newVbo;
+        ebo = newEbo;
+        positionVbo = newPositionVbo;
+        vertexSpace.Grow(vertexCapacity);
+        indexSpace.Grow(indexCapacity);
+
+        if (vao == 0) {
+            glGenVertexArrays(1, &vao);
+        }
+        // point the VAO at the new buffers
+        GLState::BindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        // Vertex Positions
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
+        // Vertex Normals
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
+        // Vertex Texture Coords
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+
+        if (depthVao == 0) {
+            glGenVertexArrays(1, &depthVao);
+        }
+        // positions only, 12 bytes per vertex instead of 32
+        GLState::BindVertexArray(depthVao);
+        glBindBuffer(GL_ARRAY_BUFFER, positionVbo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (GLvoid*)0);
+        GLState::BindVertexArray(0);
+    }
+
+    void MeshArena::ReserveInstances(size_t instanceCapacity) {
+        GLuint newBuffer;
+        glGenBuffers(1, &newBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, instanceCapacity * sizeof(glm::mat4), NULL, GL_STATIC_DRAW);
+
+        if (instanceBuffer != 0) {
+            glBindBuffer(GL_COPY_READ_BUFFER, instanceBuffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, instanceSpace.getCapacity() * sizeof(glm::mat4));
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glDeleteBuffers(1, &instanceBuffer);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        instanceBuffer = newBuffer;
+        instanceSpace.Grow(instanceCapacity);
+
+        if (instanceTexture == 0) {
+            glGenTextures(1, &instanceTexture);
+        }
+        // same texture name wherever it is bound, only its storage moves to the new buffer
+        GLState::BindTexture(0, GL_TEXTURE_BUFFER, instanceTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, instanceBuffer);
+    }
+
+}
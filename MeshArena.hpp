@@ -0,0 +1,111 @@
+#ifndef MeshArena_hpp
+#define MeshArena_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <map>
+
+namespace gps {
+
+    // First-fit allocator over a linear address space; freed ranges merge with their neighbours
+    class RangeAllocator {
+
+    public:
+        static const size_t NO_SPACE = (size_t)-1;
+
+        explicit RangeAllocator(size_t capacity = 0);
+
+        // returns the offset of the range, or NO_SPACE when no free range fits
+        size_t Allocate(size_t size, size_t alignment = 1);
+        void Free(size_t offset, size_t size);
+        // adds the space between the old and the new capacity at the end
+        void Grow(size_t capacity);
+
+        size_t getCapacity() const;
+        size_t getUsed() const;
+
+    private:
+        void Insert(size_t offset, size_t size);
+
+        // offset -> size of every free range
+        std::map<size_t, size_t> freeRanges;
+        size_t capacity;
+        size_t used;
+    };
+
+    // Place of one mesh inside the arena buffers
+    struct ArenaRange {
+        GLint baseVertex = 0;
+        size_t vertexCount = 0;
+        // byte offset into the index buffer, aligned to 4 so both index types fit
+        size_t indexOffset = 0;
+        size_t indexBytes = 0;
+    };
+
+    // Shared vertex and index buffers for every mesh with the gps::Vertex format, behind one VAO.
+    // Meshes index their vertices from 0 and are drawn with glDrawElementsBaseVertex.
+    // A tightly packed copy of the positions, at the same vertex offsets, sits behind a second
+    // VAO sharing the index buffer, for passes that only read vPosition.
+    // Instanced meshes keep their per-instance transforms in a buffer texture of mat4 columns,
+    // fetched by the vertex shader at the mesh's first instance plus gl_InstanceID.
+    // GL thread only.
+    class MeshArena {
+
+    public:
+        MeshArena();
+
+        // copies the mesh into free ranges of the buffers, growing them when needed
+        ArenaRange Allocate(const void *vertices, size_t vertexCount, const void *indices, size_t indexBytes);
+        // returns the ranges for later meshes; the buffers do not shrink
+        void Free(const ArenaRange &range);
+
+        // copies the transforms into the instance buffer and returns the index of the first one;
+        // throws std::runtime_error when they do not fit in GL_MAX_TEXTURE_BUFFER_SIZE texels
+        size_t AllocateInstances(const glm::mat4 *transforms, size_t count);
+        void FreeInstances(size_t first, size_t count);
+
+        GLuint getVertexArray() const;
+        // position-only stream at attribute 0, indexed like getVertexArray
+        GLuint getDepthVertexArray() const;
+        // GL_TEXTURE_BUFFER texture over the instance transforms, four RGBA32F texels per mat4
+        GLuint getInstanceTexture() const;
+        size_t getVertexCapacity() const;
+        size_t getUsedVertices() const;
+
+        // arena of the static scene meshes, never destroyed so global models can free into it
+        static MeshArena &Shared();
+
+    private:
+        MeshArena(const MeshArena &);
+        MeshArena &operator=(const MeshArena &);
+
+        // reallocates the buffers with the given capacities and copies the old contents over
+        void Reserve(size_t vertexCapacity, size_t indexCapacity);
+        void ReserveInstances(size_t instanceCapacity);
+
+        GLuint vao;
+        GLuint vbo;
+        GLuint ebo;
+        GLuint depthVao;
+        GLuint positionVbo;
+        RangeAllocator vertexSpace;   // in vertices
+        RangeAllocator indexSpace;    // in bytes
+        GLuint instanceBuffer;
+        GLuint instanceTexture;
+        RangeAllocator instanceSpace; // in transforms
+        // transforms the buffer texture can address, queried on the first growth
+        size_t maxInstances;
+    };
+
+}
+
+#endif /* MeshArena_hpp */
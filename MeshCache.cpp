@@ -0,0 +1,310 @@
+#include "MeshCache.hpp"
+
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+namespace gps {
+
+    namespace {
+
+        const char CACHE_MAGIC[4] = { 'G', 'P', 'S', 'M' };
+        // bump whenever the layout below or the vertex format changes
+        const uint32_t CACHE_VERSION = 3;
+
+        struct CacheHeader {
+            char magic[4];
+            uint32_t version;
+            uint32_t vertexSize;
+            uint32_t meshCount;
+            // .mtl files stamped after the header
+            uint32_t materialCount;
+            uint32_t pad;
+            uint64_t sourceSize;
+            int64_t sourceModified;
+            uint64_t sourceVertexCount;
+        };
+
+        // follows the path of each .mtl file
+        struct CacheStamp {
+            uint64_t size;
+            int64_t modified;
+        };
+
+        struct CacheMeshHeader {
+            uint32_t vertexCount;
+            uint32_t indexCount;
+            uint32_t indexType;
+            uint32_t textureCount;
+            float ambient[3];
+            float diffuse[3];
+            float specular[3];
+            float boundsMin[3];
+            float boundsMax[3];
+            // bounding sphere radius around the center of the bounds
+            float radius;
+        };
+
+        bool StatSource(const std::string &fileName, uint64_t &size, int64_t &modified) {
+            struct stat fileInfo;
+            if (stat(fileName.c_str(), &fileInfo) != 0) {
+                return false;
+            }
+            size = (uint64_t)fileInfo.st_size;
+            modified = (int64_t)fileInfo.st_mtime;
+            return true;
+        }
+
+        // all sections are kept 4-byte aligned so the mapped data can be used in place
+        size_t Align4(size_t offset) {
+            return (offset + 3) & ~(size_t)3;
+        }
+
+        void WritePadding(FILE *out, size_t written) {
+            static const char zeros[4] = { 0, 0, 0, 0 };
+            size_t padding = Align4(written) - written;
+            if (padding > 0) {
+                fwrite(zeros, 1, padding, out);
+            }
+        }
+
+        void WriteString(FILE *out, const std::string &value) {
+            uint32_t length = (uint32_t)value.size();
+            fwrite(&length, sizeof(length), 1, out);
+            fwrite(value.data(), 1, value.size(), out);
+            WritePadding(out, value.size());
+        }
+
+        bool ReadString(const char *data, size_t size, size_t &offset, std::string &value) {
+            uint32_t length;
+            if (offset + sizeof(length) > size) {
+                return false;
+            }
+            std::memcpy(&length, data + offset, sizeof(length));
+            offset += sizeof(length);
+            if (offset + length > size) {
+                return false;
+            }
+            value.assign(data + offset, length);
+            offset = Align4(offset + length);
+            return true;
+        }
+    }
+
+    MeshCache::MeshCache() {
+        sourceVertexCount = 0;
+    }
+
+    std::string MeshCache::CachePath(const std::string &objFileName) {
+        size_t dot = objFileName.find_last_of('.');
+        size_t slash = objFileName.find_last_of('/');
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+            return objFileName + ".gpsmesh";
+        }
+        return objFileName.substr(0, dot) + ".gpsmesh";
+    }
+
+    bool MeshCache::Open(const std::string &objFileName) {
+        Close();
+
+        uint64_t sourceSize;
+        int64_t sourceModified;
+        if (!StatSource(objFileName, sourceSize, sourceModified)) {
+            return false;
+        }
+        if (!file.Open(CachePath(objFileName))) {
+            return false;
+        }
+
+        const char *data = file.data();
+        size_t size = file.size();
+
+        CacheHeader header;
+        if (size < sizeof(header)) {
+            Close();
+            return false;
+        }
+        std::memcpy(&header, data, sizeof(header));
+        if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+            header.version != CACHE_VERSION ||
+            header.vertexSize != sizeof(Vertex) ||
+            header.sourceSize != sourceSize ||
+            header.sourceModified != sourceModified) {
+            Close();
+            return false;
+        }
+
+        sourceVertexCount = (size_t)header.sourceVertexCount;
+        size_t offset = sizeof(header);
+
+        // the materials and texture paths come from the .mtl files, so they must be unchanged too
+        for (uint32_t i = 0; i < header.materialCount; i++) {
+            std::string path;
+            CacheStamp stamp;
+            CacheStamp current;
+            if (!ReadString(data, size, offset, path) || offset + sizeof(stamp) > size) {
+                Close();
+                return false;
+            }
+            std::memcpy(&stamp, data + offset, sizeof(stamp));
+            offset += sizeof(stamp);
+            if (!StatSource(path, current.size, current.modified) ||
+                current.size != stamp.size || current.modified != stamp.modified) {
+                Close();
+                return false;
+            }
+        }
+
+        records.resize(header.meshCount);
+
+        for (uint32_t m = 0; m < header.meshCount; m++) {
+            CacheMeshHeader meshHeader;
+            if (offset + sizeof(meshHeader) > size) {
+                Close();
+                return false;
+            }
+            std::memcpy(&meshHeader, data + offset, sizeof(meshHeader));
+            offset += sizeof(meshHeader);
+
+            MeshCacheRecord &record = records[m];
+            record.material.ambient = glm::vec3(meshHeader.ambient[0], meshHeader.ambient[1], meshHeader.ambient[2]);
+            record.material.diffuse = glm::vec3(meshHeader.diffuse[0], meshHeader.diffuse[1], meshHeader.diffuse[2]);
+            record.material.specular = glm::vec3(meshHeader.specular[0], meshHeader.specular[1], meshHeader.specular[2]);
+            record.bounds.min = glm::vec3(meshHeader.boundsMin[0], meshHeader.boundsMin[1], meshHeader.boundsMin[2]);
+            record.bounds.max = glm::vec3(meshHeader.boundsMax[0], meshHeader.boundsMax[1], meshHeader.boundsMax[2]);
+            record.radius = meshHeader.radius;
+
+            for (uint32_t t = 0; t < meshHeader.textureCount; t++) {
+                std::string type;
+                std::string path;
+                if (!ReadString(data, size, offset, type) || !ReadString(data, size, offset, path)) {
+                    Close();
+                    return false;
+                }
+                record.textures.push_back(std::make_pair(type, path));
+            }
+
+            record.indexType = (GLenum)meshHeader.indexType;
+            size_t indexSize = (record.indexType == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+            size_t vertexBytes = (size_t)meshHeader.vertexCount * sizeof(Vertex);
+            size_t indexBytes = (size_t)meshHeader.indexCount * indexSize;
+            if (offset + vertexBytes + indexBytes > size) {
+                Close();
+                return false;
+            }
+
+            record.vertices = (const Vertex *)(data + offset);
+            record.vertexCount = meshHeader.vertexCount;
+            offset += vertexBytes;
+            record.indices = data + offset;
+            record.indexCount = meshHeader.indexCount;
+            offset = Align4(offset + indexBytes);
+        }
+
+        return true;
+    }
+
+    void MeshCache::Close() {
+        records.clear();
+        file.Close();
+        sourceVertexCount = 0;
+    }
+
+    const std::vector<MeshCacheRecord> &MeshCache::getRecords() const {
+        return records;
+    }
+
+    size_t MeshCache::getSourceVertexCount() const {
+        return sourceVertexCount;
+    }
+
+    bool MeshCache::Write(const std::string &objFileName, const std::vector<std::string> &materialFiles,
+                          const std::vector<MeshData> &meshes, size_t sourceVertexCount) {
+        CacheHeader header;
+        std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        header.version = CACHE_VERSION;
+        header.vertexSize = sizeof(Vertex);
+        header.meshCount = (uint32_t)meshes.size();
+        header.materialCount = (uint32_t)materialFiles.size();
+        header.pad = 0;
+        header.sourceVertexCount = sourceVertexCount;
+        if (!StatSource(objFileName, header.sourceSize, header.sourceModified)) {
+            return false;
+        }
+        std::vector<CacheStamp> materialStamps(materialFiles.size());
+        for (size_t i = 0; i < materialFiles.size(); i++) {
+            if (!StatSource(materialFiles[i], materialStamps[i].size, materialStamps[i].modified)) {
+                return false;
+            }
+        }
+
+        // write to a temporary file first so a partially written cache is never picked up
+        std::string cachePath = CachePath(objFileName);
+        std::string tempPath = cachePath + ".tmp";
+        FILE *out = fopen(tempPath.c_str(), "wb");
+        if (!out) {
+            return false;
+        }
+
+        fwrite(&header, sizeof(header), 1, out);
+        for (size_t i = 0; i < materialFiles.size(); i++) {
+            WriteString(out, materialFiles[i]);
+            fwrite(&materialStamps[i], sizeof(CacheStamp), 1, out);
+        }
+
+        for (size_t m = 0; m < meshes.size(); m++) {
+            const MeshData &mesh = meshes[m];
+            GLenum indexType = Mesh::ChooseIndexType(mesh.vertices.size());
+
+            CacheMeshHeader meshHeader;
+            std::memset(&meshHeader, 0, sizeof(meshHeader));
+            meshHeader.vertexCount = (uint32_t)mesh.vertices.size();
+            meshHeader.indexCount = (uint32_t)mesh.indices.size();
+            meshHeader.indexType = (uint32_t)indexType;
+            meshHeader.textureCount = (uint32_t)mesh.textures.size();
+            meshHeader.radius = mesh.radius;
+            for (int i = 0; i < 3; i++) {
+                meshHeader.ambient[i] = mesh.material.ambient[i];
+                meshHeader.diffuse[i] = mesh.material.diffuse[i];
+                meshHeader.specular[i] = mesh.material.specular[i];
+                meshHeader.boundsMin[i] = mesh.bounds.min[i];
+                meshHeader.boundsMax[i] = mesh.bounds.max[i];
+            }
+            fwrite(&meshHeader, sizeof(meshHeader), 1, out);
+
+            for (size_t t = 0; t < mesh.textures.size(); t++) {
+                WriteString(out, mesh.textures[t].type);
+                WriteString(out, mesh.textures[t].path);
+            }
+
+            if (!mesh.vertices.empty()) {
+                fwrite(mesh.vertices.data(), sizeof(Vertex), mesh.vertices.size(), out);
+            }
+
+            // store indices in their GPU format so loading can upload them untouched
+            if (mesh.indices.empty()) {
+                continue;
+            }
+            if (indexType == GL_UNSIGNED_SHORT) {
+                std::vector<GLushort> shortIndices(mesh.indices.begin(), mesh.indices.end());
+                fwrite(shortIndices.data(), sizeof(GLushort), shortIndices.size(), out);
+                WritePadding(out, shortIndices.size() * sizeof(GLushort));
+            } else {
+                fwrite(mesh.indices.data(), sizeof(GLuint), mesh.indices.size(), out);
+            }
+        }
+
+        bool ok = (ferror(out) == 0);
+        ok = (fclose(out) == 0) && ok;
+        if (!ok) {
+            remove(tempPath.c_str());
+            return false;
+        }
+
+        remove(cachePath.c_str());
+        return rename(tempPath.c_str(), cachePath.c_str()) == 0;
+    }
+
+}
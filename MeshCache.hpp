@@ -0,0 +1,55 @@
+#ifndef MeshCache_hpp
+#define MeshCache_hpp
+
+#include "Mesh.hpp"
+#include "MappedFile.hpp"
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // One mesh as stored in the cache; the data pointers reference the mapped file
+    struct MeshCacheRecord {
+        const Vertex *vertices;
+        size_t vertexCount;
+        const void *indices;
+        size_t indexCount;
+        GLenum indexType;
+        Material material;
+        BoundingBox bounds;
+        float radius;
+        // texture type (ambientTexture, diffuseTexture, specularTexture) and path pairs
+        std::vector<std::pair<std::string, std::string> > textures;
+    };
+
+    // Versioned binary mesh cache written next to each .obj ("Model.obj" -> "Model.gpsmesh").
+    // A cache is only accepted while the size and modification time of its source file, and of
+    // every .mtl file the source was read with, match.
+    class MeshCache {
+
+    public:
+        MeshCache();
+
+        // maps the cache of the given .obj, returns false if it is missing, stale or corrupt
+        bool Open(const std::string &objFileName);
+        void Close();
+
+        const std::vector<MeshCacheRecord> &getRecords() const;
+        // face corners the source .obj had before welding
+        size_t getSourceVertexCount() const;
+
+        // serializes the meshes of a freshly parsed .obj and the .mtl files it read
+        static bool Write(const std::string &objFileName, const std::vector<std::string> &materialFiles,
+                          const std::vector<MeshData> &meshes, size_t sourceVertexCount);
+        static std::string CachePath(const std::string &objFileName);
+
+    private:
+        MappedFile file;
+        std::vector<MeshCacheRecord> records;
+        size_t sourceVertexCount;
+    };
+
+}
+
+#endif /* MeshCache_hpp */
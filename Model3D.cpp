@@ -1,49 +1,593 @@
 #include "Model3D.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
 
 namespace gps
 {
 
+	namespace
+	{
+
+		// Hashes the raw bit pattern of a vertex so identical face corners weld together
+		struct VertexHash
+		{
+			size_t operator()(const gps::Vertex &vertex) const
+			{
+				uint32_t words[8];
+				std::memcpy(words, &vertex, sizeof(words));
+
+				// FNV-1a over the eight 32-bit components
+				uint64_t hash = 14695981039346656037ULL;
+				for (int i = 0; i < 8; i++)
+				{
+					hash ^= words[i];
+					hash *= 1099511628211ULL;
+				}
+				return (size_t)hash;
+			}
+		};
+
+		struct VertexEqual
+		{
+			bool operator()(const gps::Vertex &a, const gps::Vertex &b) const
+			{
+				return std::memcmp(&a, &b, sizeof(gps::Vertex)) == 0;
+			}
+		};
+
+		// Reads .mtl files like tinyobj's own reader and keeps the paths it opened, so the mesh
+		// cache can stamp them next to the .obj
+		class RecordingMaterialReader : public tinyobj::MaterialFileReader
+		{
+
+		public:
+			RecordingMaterialReader(const std::string &basePath, std::vector<std::string> &paths)
+				: tinyobj::MaterialFileReader(basePath), basePath(basePath), paths(paths)
+			{
+			}
+
+			virtual bool operator()(const std::string &matId, std::vector<tinyobj::material_t> *materials,
+									std::map<std::string, int> *matMap, std::string *err)
+			{
+				paths.push_back(basePath + matId);
+				return tinyobj::MaterialFileReader::operator()(matId, materials, matMap, err);
+			}
+
+		private:
+			std::string basePath;
+			std::vector<std::string> &paths;
+		};
+
+		// Meshes binding the same textures with the same material constants draw identically
+		bool SameMaterial(const gps::Mesh &a, const gps::Mesh &b)
+		{
+			if (a.textures.size() != b.textures.size())
+				return false;
+			for (size_t i = 0; i < a.textures.size(); i++)
+			{
+				if (a.textures[i].id != b.textures[i].id || a.textures[i].type != b.textures[i].type)
+					return false;
+			}
+			return std::memcmp(&a.material, &b.material, sizeof(gps::Material)) == 0;
+		}
+
+		// Orthonormal frame spanned by three vertices, as a rigid matrix placing the frame axes;
+		// false when the vertices are (nearly) collinear
+		bool ReferenceFrame(const std::vector<gps::Vertex> &vertices, const size_t picks[3], glm::mat4 &frame)
+		{
+			glm::vec3 origin = vertices[picks[0]].Position;
+			glm::vec3 edge = vertices[picks[1]].Position - origin;
+			glm::vec3 normal = glm::cross(edge, vertices[picks[2]].Position - origin);
+			if (glm::length(edge) < 1e-6f || glm::length(normal) < 1e-6f * glm::dot(edge, edge))
+				return false;
+			glm::vec3 x = glm::normalize(edge);
+			glm::vec3 z = glm::normalize(normal);
+			glm::vec3 y = glm::cross(z, x);
+			frame = glm::mat4(glm::vec4(x, 0.0f), glm::vec4(y, 0.0f), glm::vec4(z, 0.0f), glm::vec4(origin, 1.0f));
+			return true;
+		}
+
+		// Inverse of a rotation plus translation: transposed rotation, rotated negated translation
+		glm::mat4 RigidInverse(const glm::mat4 &frame)
+		{
+			glm::vec3 x(frame[0]), y(frame[1]), z(frame[2]), origin(frame[3]);
+			return glm::mat4(glm::vec4(x.x, y.x, z.x, 0.0f),
+							 glm::vec4(x.y, y.y, z.y, 0.0f),
+							 glm::vec4(x.z, y.z, z.z, 0.0f),
+							 glm::vec4(-glm::dot(x, origin), -glm::dot(y, origin), -glm::dot(z, origin), 1.0f));
+		}
+
+		// Vertices that pin down a stable frame: the first one, the farthest from it and the
+		// one farthest off the line between them
+		void PickFrameVertices(const std::vector<gps::Vertex> &vertices, size_t picks[3])
+		{
+			picks[0] = picks[1] = picks[2] = 0;
+			glm::vec3 origin = vertices[0].Position;
+			float best = 0.0f;
+			for (size_t i = 1; i < vertices.size(); i++)
+			{
+				glm::vec3 d = vertices[i].Position - origin;
+				if (glm::dot(d, d) > best)
+				{
+					best = glm::dot(d, d);
+					picks[1] = i;
+				}
+			}
+			glm::vec3 edge = vertices[picks[1]].Position - origin;
+			best = 0.0f;
+			for (size_t i = 1; i < vertices.size(); i++)
+			{
+				glm::vec3 c = glm::cross(edge, vertices[i].Position - origin);
+				if (glm::dot(c, c) > best)
+				{
+					best = glm::dot(c, c);
+					picks[2] = i;
+				}
+			}
+		}
+
+		// True when transform maps every vertex of the prototype onto the candidate
+		bool IsPlacementOf(const gps::Mesh &prototype, const gps::Mesh &candidate, const glm::mat4 &transform, float tolerance)
+		{
+			for (size_t i = 0; i < prototype.vertices.size(); i++)
+			{
+				const gps::Vertex &a = prototype.vertices[i];
+				const gps::Vertex &b = candidate.vertices[i];
+				glm::vec3 position(transform * glm::vec4(a.Position, 1.0f));
+				glm::vec3 normal(transform * glm::vec4(a.Normal, 0.0f));
+				if (glm::length(position - b.Position) > tolerance || glm::length(normal - b.Normal) > 1e-3f)
+					return false;
+				if (std::fabs(a.TexCoords.x - b.TexCoords.x) > 1e-5f || std::fabs(a.TexCoords.y - b.TexCoords.y) > 1e-5f)
+					return false;
+			}
+			return true;
+		}
+	}
+
 	void Model3D::LoadModel(std::string fileName)
 	{
 
 		std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
-		ReadOBJ(fileName, basePath);
+		LoadModel(fileName, basePath);
 	}
 
 	glm::vec3 Model3D::getCenter()
 	{
 
-		if (meshes.empty())
-			return glm::vec3(0.0f);
+		return sphere.center;
+	}
+
+	glm::vec3 Model3D::getMinBounds()
+	{
+
+		return bounds.min;
+	}
+
+	glm::vec3 Model3D::getMaxBounds()
+	{
+
+		return bounds.max;
+	}
+
+	BoundingBox Model3D::getBounds()
+	{
+
+		return bounds;
+	}
+
+	BoundingSphere Model3D::getBoundingSphere()
+	{
+
+		return sphere;
+	}
+
+	void Model3D::setKeepsGeometry(bool keep)
+	{
+
+		keepsGeometry = keep;
+	}
+
+	void Model3D::LoadModel(std::string fileName, std::string basePath)
+	{
 
-		glm::vec3 minV(FLT_MAX);
-		glm::vec3 maxV(-FLT_MAX);
+		ParseModel(fileName, basePath);
+		UploadModel();
+	}
+
+	void Model3D::ParseModel(std::string fileName)
+	{
+
+		std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
+		ParseModel(fileName, basePath);
+	}
+
+	void Model3D::ParseModel(std::string fileName, std::string basePath)
+	{
 
-		for (size_t i = 0; i < meshes.size(); ++i)
+		pending = ModelData();
+
+		// prefer the binary cache, parse the .obj and refresh the cache otherwise
+		if (!ReadMeshCache(fileName))
+		{
+			ReadOBJ(fileName, basePath);
+			MeshCache::Write(fileName, pending.materialFiles, pending.meshes, pending.stats.sourceVertices);
+		}
+
+		DecodeTextures();
+	}
+
+	void Model3D::UploadModel()
+	{
+
+		if (pending.cache)
 		{
-			for (size_t v = 0; v < meshes[i].vertices.size(); ++v)
+
+			const std::vector<MeshCacheRecord> &records = pending.cache->getRecords();
+			for (size_t m = 0; m < records.size(); m++)
 			{
-				glm::vec3 p = meshes[i].vertices[v].Position;
-				minV = glm::min(minV, p);
-				maxV = glm::max(maxV, p);
+
+				const MeshCacheRecord &record = records[m];
+
+				std::vector<gps::Texture> textures;
+				for (size_t t = 0; t < record.textures.size(); t++)
+				{
+					textures.push_back(LoadTexture(record.textures[t].second, record.textures[t].first));
+				}
+
+				// the mapped ranges go straight to glBufferData
+				meshes.push_back(gps::Mesh(record.vertices, record.vertexCount, record.indices, record.indexCount,
+										   record.indexType, textures, record.material, record.bounds, record.radius,
+										   keepsGeometry));
 			}
 		}
+		else
+		{
 
-		return (minV + maxV) * 0.5f;
+			for (size_t m = 0; m < pending.meshes.size(); m++)
+			{
+
+				gps::MeshData &data = pending.meshes[m];
+				for (size_t t = 0; t < data.textures.size(); t++)
+				{
+					data.textures[t] = LoadTexture(data.textures[t].path, data.textures[t].type);
+				}
+
+				meshes.push_back(gps::Mesh(data, keepsGeometry));
+			}
+		}
+
+		vertexStats = pending.stats;
+		ComputeBounds();
+
+		// release the parsed data, the mapping and the decoded pixels
+		pending = ModelData();
 	}
 
-	void Model3D::LoadModel(std::string fileName, std::string basePath)
+	void Model3D::BuildStaticBatch(const std::vector<Model3D *> &sources)
 	{
 
-		ReadOBJ(fileName, basePath);
+		// group the source meshes by material, in order of first appearance
+		std::vector<std::vector<const gps::Mesh *> > groups;
+		for (size_t s = 0; s < sources.size(); s++)
+		{
+			const std::vector<gps::Mesh> &sourceMeshes = sources[s]->meshes;
+			for (size_t m = 0; m < sourceMeshes.size(); m++)
+			{
+				const gps::Mesh &mesh = sourceMeshes[m];
+				if (mesh.indices.empty() || !mesh.instances.empty())
+					continue;
+				size_t g = 0;
+				while (g < groups.size() && !SameMaterial(*groups[g][0], mesh))
+					g++;
+				if (g == groups.size())
+					groups.push_back(std::vector<const gps::Mesh *>());
+				groups[g].push_back(&mesh);
+			}
+		}
+
+		// one indexed range per group, the indices rebased onto the concatenated vertices
+		for (size_t g = 0; g < groups.size(); g++)
+		{
+
+			std::vector<gps::Vertex> vertices;
+			std::vector<GLuint> indices;
+			for (size_t m = 0; m < groups[g].size(); m++)
+			{
+				const gps::Mesh &mesh = *groups[g][m];
+				GLuint base = (GLuint)vertices.size();
+				vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+				for (size_t i = 0; i < mesh.indices.size(); i++)
+					indices.push_back(base + mesh.indices[i]);
+			}
+			meshes.push_back(gps::Mesh(vertices, indices, groups[g][0]->textures, groups[g][0]->material));
+		}
+
+		for (size_t s = 0; s < sources.size(); s++)
+		{
+
+			Model3D &source = *sources[s];
+			for (size_t m = 0; m < source.meshes.size(); m++)
+			{
+				// instanced meshes move over as they are
+				if (!source.meshes[m].instances.empty())
+					meshes.push_back(source.meshes[m]);
+				else
+					source.meshes[m].Release();
+			}
+			source.meshes.clear();
+
+			// take over the texture references, dropping the ones this model already holds
+			for (std::unordered_map<std::string, gps::Texture>::iterator it = source.loadedTextures.begin(); it != source.loadedTextures.end(); ++it)
+			{
+				if (loadedTextures.find(it->first) == loadedTextures.end())
+					loadedTextures[it->first] = it->second;
+				else
+					TextureRegistry::Shared().Release(it->second.id);
+			}
+			source.loadedTextures.clear();
+
+			vertexStats.sourceVertices += source.vertexStats.sourceVertices;
+			vertexStats.weldedVertices += source.vertexStats.weldedVertices;
+			vertexStats.indices += source.vertexStats.indices;
+		}
+
+		ComputeBounds();
+	}
+
+	void Model3D::InstanceRepeatedMeshes()
+	{
+
+		struct Prototype
+		{
+			size_t mesh;
+			size_t picks[3];
+			glm::mat4 inverseFrame;
+			float tolerance;
+			std::vector<glm::mat4> transforms;
+		};
+		std::vector<Prototype> prototypes;
+		std::vector<bool> copies(meshes.size(), false);
+
+		for (size_t m = 0; m < meshes.size(); m++)
+		{
+
+			gps::Mesh &mesh = meshes[m];
+			if (mesh.vertices.size() < 3 || !mesh.instances.empty())
+				continue;
+
+			for (size_t p = 0; p < prototypes.size() && !copies[m]; p++)
+			{
+				Prototype &prototype = prototypes[p];
+				const gps::Mesh &source = meshes[prototype.mesh];
+				if (source.vertices.size() != mesh.vertices.size() || source.indices != mesh.indices || !SameMaterial(source, mesh))
+					continue;
+				// the frame of the same three vertices gives the only candidate placement
+				glm::mat4 frame;
+				if (!ReferenceFrame(mesh.vertices, prototype.picks, frame))
+					continue;
+				glm::mat4 transform = frame * prototype.inverseFrame;
+				if (!IsPlacementOf(source, mesh, transform, prototype.tolerance))
+					continue;
+				prototype.transforms.push_back(transform);
+				copies[m] = true;
+			}
+			if (copies[m])
+				continue;
+
+			Prototype prototype;
+			prototype.mesh = m;
+			PickFrameVertices(mesh.vertices, prototype.picks);
+			glm::mat4 frame;
+			if (!ReferenceFrame(mesh.vertices, prototype.picks, frame))
+				continue;
+			prototype.inverseFrame = RigidInverse(frame);
+			prototype.tolerance = 1e-4f * glm::length(mesh.bounds.max - mesh.bounds.min) + 1e-6f;
+			prototype.transforms.push_back(glm::mat4(1.0f));
+			prototypes.push_back(prototype);
+		}
+
+		for (size_t p = 0; p < prototypes.size(); p++)
+		{
+			if (prototypes[p].transforms.size() > 1)
+				meshes[prototypes[p].mesh].SetInstances(prototypes[p].transforms);
+		}
+
+		// keep the prototypes and unique meshes, in their original order
+		std::vector<gps::Mesh> kept;
+		for (size_t m = 0; m < meshes.size(); m++)
+		{
+			if (copies[m])
+				meshes[m].Release();
+			else
+				kept.push_back(meshes[m]);
+		}
+		meshes.swap(kept);
+
+		ComputeBounds();
+	}
+
+	void Model3D::SplitIntoClusters(float maxExtent)
+	{
+
+		std::vector<gps::Mesh> split;
+		for (size_t m = 0; m < meshes.size(); m++)
+		{
+
+			gps::Mesh &mesh = meshes[m];
+			glm::vec3 size = mesh.bounds.max - mesh.bounds.min;
+			size_t triangleCount = mesh.indices.size() / 3;
+			if (mesh.instances.size() > 1 && std::max(size.x, std::max(size.y, size.z)) > maxExtent)
+			{
+				// placements are grouped by the grid cell holding their center, one instanced mesh per cell
+				gps::BoundingBox local = gps::Mesh::ComputeBounds(mesh.vertices);
+				glm::vec3 localCenter = (local.min + local.max) * 0.5f;
+				std::map<std::tuple<int, int, int>, std::vector<glm::mat4> > cells;
+				for (size_t i = 0; i < mesh.instances.size(); i++)
+				{
+					glm::vec3 cell = glm::floor(glm::vec3(mesh.instances[i] * glm::vec4(localCenter, 1.0f)) / maxExtent);
+					cells[std::make_tuple((int)cell.x, (int)cell.y, (int)cell.z)].push_back(mesh.instances[i]);
+				}
+				// every cell draws the uploaded geometry, only the instance ranges are per cell
+				std::map<std::tuple<int, int, int>, std::vector<glm::mat4> >::iterator cell = cells.begin();
+				mesh.SetInstances(cell->second);
+				split.push_back(mesh);
+				for (++cell; cell != cells.end(); ++cell)
+				{
+					split.push_back(mesh.ShareGeometry(cell->second));
+				}
+				continue;
+			}
+			if (!mesh.instances.empty() || triangleCount < 2 || std::max(size.x, std::max(size.y, size.z)) <= maxExtent)
+			{
+				split.push_back(mesh);
+				continue;
+			}
+
+			std::vector<glm::vec3> centroids(triangleCount);
+			std::vector<uint32_t> triangles(triangleCount);
+			for (size_t t = 0; t < triangleCount; t++)
+			{
+				triangles[t] = (uint32_t)t;
+				centroids[t] = (mesh.vertices[mesh.indices[t * 3]].Position +
+				                mesh.vertices[mesh.indices[t * 3 + 1]].Position +
+				                mesh.vertices[mesh.indices[t * 3 + 2]].Position) / 3.0f;
+			}
+
+			// halve the triangle ranges at the centroid median of their longest axis until each
+			// range fits the extent
+			std::vector<std::pair<size_t, size_t> > pending(1, std::make_pair((size_t)0, triangleCount));
+			std::vector<std::pair<size_t, size_t> > clusters;
+			while (!pending.empty())
+			{
+				std::pair<size_t, size_t> range = pending.back();
+				pending.pop_back();
+				gps::BoundingBox box = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+				for (size_t t = range.first; t < range.second; t++)
+				{
+					for (int corner = 0; corner < 3; corner++)
+					{
+						glm::vec3 position = mesh.vertices[mesh.indices[triangles[t] * 3 + corner]].Position;
+						box.min = glm::min(box.min, position);
+						box.max = glm::max(box.max, position);
+					}
+				}
+				glm::vec3 extent = box.max - box.min;
+				if (range.second - range.first < 2 || std::max(extent.x, std::max(extent.y, extent.z)) <= maxExtent)
+				{
+					clusters.push_back(range);
+					continue;
+				}
+				int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+				size_t middle = (range.first + range.second) / 2;
+				std::nth_element(triangles.begin() + range.first, triangles.begin() + middle, triangles.begin() + range.second,
+					[&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+				pending.push_back(std::make_pair(range.first, middle));
+				pending.push_back(std::make_pair(middle, range.second));
+			}
+
+			// each cluster keeps only the vertices its triangles reference
+			std::vector<GLuint> remap(mesh.vertices.size());
+			std::vector<uint32_t> stamp(mesh.vertices.size(), 0);
+			for (size_t c = 0; c < clusters.size(); c++)
+			{
+				std::vector<gps::Vertex> vertices;
+				std::vector<GLuint> indices;
+				for (size_t t = clusters[c].first; t < clusters[c].second; t++)
+				{
+					for (int corner = 0; corner < 3; corner++)
+					{
+						GLuint index = mesh.indices[triangles[t] * 3 + corner];
+						if (stamp[index] != c + 1)
+						{
+							stamp[index] = (uint32_t)(c + 1);
+							remap[index] = (GLuint)vertices.size();
+							vertices.push_back(mesh.vertices[index]);
+						}
+						indices.push_back(remap[index]);
+					}
+				}
+				split.push_back(gps::Mesh(vertices, indices, mesh.textures, mesh.material));
+			}
+			mesh.Release();
+		}
+		meshes.swap(split);
+
+		ComputeBounds();
+	}
+
+	// Combines the mesh bounds into the model bounds
+	void Model3D::ComputeBounds()
+	{
+
+		bool empty = true;
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			if (meshes[i].getArenaRange().vertexCount == 0)
+				continue;
+			if (empty)
+			{
+				bounds = meshes[i].bounds;
+				empty = false;
+			}
+			bounds.min = glm::min(bounds.min, meshes[i].bounds.min);
+			bounds.max = glm::max(bounds.max, meshes[i].bounds.max);
+		}
+		if (empty)
+			return;
+
+		// exact radius around the model center, not the looser union of the mesh spheres
+		sphere.center = (bounds.min + bounds.max) * 0.5f;
+		sphere.radius = 0.0f;
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			if (meshes[i].getArenaRange().vertexCount == 0)
+				continue;
+			// a mesh entirely inside the current radius cannot extend it
+			float reach = glm::length(meshes[i].sphere.center - sphere.center) + meshes[i].sphere.radius;
+			if (reach <= sphere.radius)
+				continue;
+			// the stored vertices are only one placement of an instanced mesh, and a mesh
+			// without CPU copies only has its own sphere to go by
+			if (!meshes[i].instances.empty() || meshes[i].vertices.empty())
+			{
+				sphere.radius = reach;
+				continue;
+			}
+			sphere.radius = std::max(sphere.radius,
+									 Mesh::ComputeRadius(&meshes[i].vertices[0], meshes[i].vertices.size(), sphere.center));
+		}
+	}
+
+	// vertex counts before and after welding, summed over all meshes
+	VertexStats Model3D::getVertexStats()
+	{
+
+		return vertexStats;
 	}
 
 	// Draw each mesh from the model
-	void Model3D::Draw(gps::Shader shaderProgram, int flatShading)
+	void Model3D::Draw(gps::Shader shaderProgram)
 	{
 
 		for (int i = 0; i < meshes.size(); i++)
-			meshes[i].Draw(shaderProgram, flatShading);
+			meshes[i].Draw(shaderProgram);
+	}
+
+	std::vector<gps::Mesh> &Model3D::getMeshes()
+	{
+
+		return meshes;
 	}
 
 	// Does the parsing of the .obj file and fills in the data structure
@@ -56,7 +600,25 @@ namespace gps
 		int materialId;
 
 		std::string err;
-		bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), GL_TRUE);
+		// tokenizes the memory-mapped file on the shared pool, output matches tinyobj::LoadObj; this
+		// thread parses the first chunk while the workers take the others, so concurrent loads
+		// share the pool's threads instead of each starting its own
+		ThreadPool &pool = ThreadPool::Shared();
+		tinyobj::ParallelFor parallelFor = [&pool](size_t count, const std::function<void(size_t)> &job) {
+			std::vector<std::future<void> > chunks;
+			for (size_t i = 1; i < count; i++)
+			{
+				chunks.push_back(pool.Submit([&job, i]() { job(i); }));
+			}
+			job(0);
+			for (size_t i = 0; i < chunks.size(); i++)
+			{
+				chunks[i].get();
+			}
+		};
+		RecordingMaterialReader materialReader(basePath, pending.materialFiles);
+		bool ret = tinyobj::LoadObjParallel(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), GL_TRUE,
+		                                    pool.getThreadCount(), parallelFor, &materialReader);
 
 		if (!err.empty())
 		{
@@ -76,6 +638,12 @@ namespace gps
 			std::vector<GLuint> indices;
 			std::vector<gps::Texture> textures;
 
+			// welds face corners sharing the same position/normal/texcoord tuple
+			std::unordered_map<gps::Vertex, GLuint, VertexHash, VertexEqual> uniqueVertices;
+			uniqueVertices.reserve(shapes[s].mesh.indices.size());
+			vertices.reserve(shapes[s].mesh.indices.size());
+			indices.reserve(shapes[s].mesh.indices.size());
+
 			// Loop over faces(polygon)
 			size_t index_offset = 0;
 			for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++)
@@ -83,9 +651,6 @@ namespace gps
 
 				int fv = shapes[s].mesh.num_face_vertices[f];
 
-				// gps::Texture currentTexture = LoadTexture("index1.png", "ambientTexture");
-				// textures.push_back(currentTexture);
-
 				// Loop over vertices in the face.
 				for (size_t v = 0; v < fv; v++)
 				{
@@ -96,35 +661,52 @@ namespace gps
 					float vx = attrib.vertices[3 * idx.vertex_index + 0];
 					float vy = attrib.vertices[3 * idx.vertex_index + 1];
 					float vz = attrib.vertices[3 * idx.vertex_index + 2];
-					float nx = attrib.normals[3 * idx.normal_index + 0];
-					float ny = attrib.normals[3 * idx.normal_index + 1];
-					float nz = attrib.normals[3 * idx.normal_index + 2];
+					float nx = 0.0f;
+					float ny = 0.0f;
+					float nz = 0.0f;
 					float tx = 0.0f;
 					float ty = 0.0f;
 
+					if (idx.normal_index != -1)
+					{
+						nx = attrib.normals[3 * idx.normal_index + 0];
+						ny = attrib.normals[3 * idx.normal_index + 1];
+						nz = attrib.normals[3 * idx.normal_index + 2];
+					}
+
 					if (idx.texcoord_index != -1)
 					{
 						tx = attrib.texcoords[2 * idx.texcoord_index + 0];
 						ty = attrib.texcoords[2 * idx.texcoord_index + 1];
 					}
 
-					glm::vec3 vertexPosition(vx, vy, vz);
-					glm::vec3 vertexNormal(nx, ny, nz);
-					glm::vec2 vertexTexCoords(tx, ty);
-
 					gps::Vertex currentVertex;
-					currentVertex.Position = vertexPosition;
-					currentVertex.Normal = vertexNormal;
-					currentVertex.TexCoords = vertexTexCoords;
-
-					vertices.push_back(currentVertex);
+					currentVertex.Position = glm::vec3(vx, vy, vz);
+					currentVertex.Normal = glm::vec3(nx, ny, nz);
+					currentVertex.TexCoords = glm::vec2(tx, ty);
+
+					// reuse the index of an identical vertex if one was already emitted
+					std::pair<std::unordered_map<gps::Vertex, GLuint, VertexHash, VertexEqual>::iterator, bool> inserted =
+						uniqueVertices.insert(std::make_pair(currentVertex, (GLuint)vertices.size()));
+					if (inserted.second)
+					{
+						vertices.push_back(currentVertex);
+					}
 
-					indices.push_back((GLuint)(index_offset + v));
+					indices.push_back(inserted.first->second);
 				}
 
 				index_offset += fv;
 			}
 
+			pending.stats.sourceVertices += index_offset;
+			pending.stats.weldedVertices += vertices.size();
+			pending.stats.indices += indices.size();
+
+			// shapes without faces (e.g. lines or points only) have nothing to draw
+			if (indices.empty())
+				continue;
+
 			// get material id
 			size_t a = shapes[s].mesh.material_ids.size();
 
@@ -152,7 +734,9 @@ namespace gps
 					{
 
 						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + ambientTexturePath, "ambientTexture");
+						currentTexture.id = 0;
+						currentTexture.type = "ambientTexture";
+						currentTexture.path = basePath + ambientTexturePath;
 						textures.push_back(currentTexture);
 					}
 
@@ -163,7 +747,9 @@ namespace gps
 					{
 
 						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + diffuseTexturePath, "diffuseTexture");
+						currentTexture.id = 0;
+						currentTexture.type = "diffuseTexture";
+						currentTexture.path = basePath + diffuseTexturePath;
 						textures.push_back(currentTexture);
 					}
 
@@ -174,145 +760,115 @@ namespace gps
 					{
 
 						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + specularTexturePath, "specularTexture");
+						currentTexture.id = 0;
+						currentTexture.type = "specularTexture";
+						currentTexture.path = basePath + specularTexturePath;
 						textures.push_back(currentTexture);
 					}
 				}
 			}
 
-			meshes.push_back(gps::Mesh(vertices, indices, textures, currentMaterial));
+			gps::MeshData meshData;
+			meshData.vertices.swap(vertices);
+			meshData.indices.swap(indices);
+			meshData.textures = textures;
+			meshData.material = currentMaterial;
+			meshData.bounds = gps::Mesh::ComputeBounds(meshData.vertices);
+			if (!meshData.vertices.empty())
+				meshData.radius = gps::Mesh::ComputeRadius(&meshData.vertices[0], meshData.vertices.size(),
+														   (meshData.bounds.min + meshData.bounds.max) * 0.5f);
+			pending.meshes.push_back(std::move(meshData));
 		}
 	}
 
-	// Retrieves a texture associated with the object
-	gps::Texture Model3D::LoadTexture(std::string path, std::string type)
+	// Maps the binary cache next to the .obj, if it is up to date
+	bool Model3D::ReadMeshCache(std::string fileName)
 	{
 
-		for (int i = 0; i < loadedTextures.size(); i++)
-		{
-
-			if (loadedTextures[i].path == path)
-			{
+		std::unique_ptr<MeshCache> cache(new MeshCache());
+		if (!cache->Open(fileName))
+			return false;
 
-				// already loaded texture
-				return loadedTextures[i];
-			}
+		const std::vector<MeshCacheRecord> &records = cache->getRecords();
+		for (size_t m = 0; m < records.size(); m++)
+		{
+			pending.stats.weldedVertices += records[m].vertexCount;
+			pending.stats.indices += records[m].indexCount;
 		}
-		gps::Texture currentTexture;
-		currentTexture.id = ReadTextureFromFile(path.c_str());
-		currentTexture.type = std::string(type);
-		currentTexture.path = path;
-
-		loadedTextures.push_back(currentTexture);
+		pending.stats.sourceVertices += cache->getSourceVertexCount();
 
-		return currentTexture;
+		pending.cache = std::move(cache);
+		return true;
 	}
 
-	// Reads the pixel data from an image file and loads it into the video memory
-	GLuint Model3D::ReadTextureFromFile(const char *file_name)
+	// Decodes every texture referenced by the pending meshes
+	void Model3D::DecodeTextures()
 	{
-		int x, y, n;
-		int force_channels = 4;
-		unsigned char *image_data = stbi_load(file_name, &x, &y, &n, force_channels);
-		if (!image_data)
+
+		std::vector<std::string> paths;
+		if (pending.cache)
 		{
-			// texture load failed
-			return false;
+			const std::vector<MeshCacheRecord> &records = pending.cache->getRecords();
+			for (size_t m = 0; m < records.size(); m++)
+				for (size_t t = 0; t < records[m].textures.size(); t++)
+					paths.push_back(records[m].textures[t].second);
 		}
-		// NPOT check
-		int width_in_bytes = x * 4;
-		unsigned char *top = NULL;
-		unsigned char *bottom = NULL;
-		unsigned char temp = 0;
-		int half_height = y / 2;
-
-		for (int row = 0; row < half_height; row++)
-		{
-			top = image_data + row * width_in_bytes;
-			bottom = image_data + (y - row - 1) * width_in_bytes;
+		for (size_t m = 0; m < pending.meshes.size(); m++)
+			for (size_t t = 0; t < pending.meshes[m].textures.size(); t++)
+				paths.push_back(pending.meshes[m].textures[t].path);
 
-			for (int col = 0; col < width_in_bytes; col++)
+		std::vector<std::string> unique;
+		for (size_t i = 0; i < paths.size(); i++)
+		{
+			if (pending.textureKeys.find(paths[i]) == pending.textureKeys.end())
 			{
-				temp = *top;
-				*top = *bottom;
-				*bottom = temp;
-				top++;
-				bottom++;
+				pending.textureKeys[paths[i]] = 0;
+				unique.push_back(paths[i]);
 			}
 		}
 
-		GLuint textureID;
-		glGenTextures(1, &textureID);
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(
-			GL_TEXTURE_2D,
-			0,
-			GL_SRGB, // GL_SRGB,//GL_RGBA,
-			x,
-			y,
-			0,
-			GL_RGBA,
-			GL_UNSIGNED_BYTE,
-			image_data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glBindTexture(GL_TEXTURE_2D, 0);
-
-		return textureID;
+		// images already known to the registry, from this or another model, are not decoded again
+		std::vector<TextureRegistry::Key> keys = TextureRegistry::Shared().Prepare(unique);
+		for (size_t i = 0; i < unique.size(); i++)
+			pending.textureKeys[unique[i]] = keys[i];
 	}
 
-	Model3D::~Model3D()
+	// Retrieves a texture associated with the object
+	gps::Texture Model3D::LoadTexture(std::string path, std::string type)
 	{
 
-		for (size_t i = 0; i < loadedTextures.size(); i++)
+		std::unordered_map<std::string, gps::Texture>::iterator loaded = loadedTextures.find(path);
+		if (loaded != loadedTextures.end())
 		{
-			glDeleteTextures(1, &loadedTextures.at(i).id);
-		}
 
-		for (size_t i = 0; i < meshes.size(); i++)
-		{
-			GLuint VBO = meshes.at(i).getBuffers().VBO;
-			GLuint EBO = meshes.at(i).getBuffers().EBO;
-			GLuint VAO = meshes.at(i).getBuffers().VAO;
-			glDeleteBuffers(1, &VBO);
-			glDeleteBuffers(1, &EBO);
-			glDeleteVertexArrays(1, &VAO);
+			// already loaded texture
+			return loaded->second;
 		}
+		gps::Texture currentTexture;
+		currentTexture.id = 0;
+		std::map<std::string, TextureRegistry::Key>::iterator key = pending.textureKeys.find(path);
+		if (key != pending.textureKeys.end())
+			currentTexture.id = TextureRegistry::Shared().Acquire(key->second);
+		currentTexture.type = std::string(type);
+		currentTexture.path = path;
+
+		loadedTextures[path] = currentTexture;
+
+		return currentTexture;
 	}
-}
 
-glm::vec3 gps::Model3D::getMinBounds()
-{
-	if (meshes.empty())
-		return glm::vec3(0.0f);
-	glm::vec3 minV(FLT_MAX);
-	for (size_t i = 0; i < meshes.size(); ++i)
+	Model3D::~Model3D()
 	{
-		for (size_t v = 0; v < meshes[i].vertices.size(); ++v)
+
+		for (std::unordered_map<std::string, gps::Texture>::iterator it = loadedTextures.begin(); it != loadedTextures.end(); ++it)
 		{
-			glm::vec3 p = meshes[i].vertices[v].Position;
-			minV = glm::min(minV, p);
+			TextureRegistry::Shared().Release(it->second.id);
 		}
-	}
-	return minV;
-}
 
-glm::vec3 gps::Model3D::getMaxBounds()
-{
-	if (meshes.empty())
-		return glm::vec3(0.0f);
-	glm::vec3 maxV(-FLT_MAX);
-	for (size_t i = 0; i < meshes.size(); ++i)
-	{
-		for (size_t v = 0; v < meshes[i].vertices.size(); ++v)
+		// hand the mesh ranges back for models loaded later
+		for (size_t i = 0; i < meshes.size(); i++)
 		{
-			glm::vec3 p = meshes[i].vertices[v].Position;
-			maxV = glm::max(maxV, p);
+			meshes.at(i).Release();
 		}
 	}
-	return maxV;
 }
@@ -2,44 +2,116 @@
 #define Model3D_hpp
 
 #include "Mesh.hpp"
+#include "MeshCache.hpp"
+#include "TextureRegistry.hpp"
 
 #include "tiny_obj_loader.h"
-#include "stb_image.h"
 
+#include <map>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace gps
 {
 
+	// Result of welding duplicated face corners at load time
+	struct VertexStats
+	{
+		size_t sourceVertices = 0; // face corners read from the .obj
+		size_t weldedVertices = 0; // unique vertices uploaded to the GPU
+		size_t indices = 0;
+	};
+
+	// GL-free description of a model produced by the CPU loading stage
+	struct ModelData
+	{
+		// meshes parsed from the .obj
+		std::vector<gps::MeshData> meshes;
+		// and the .mtl files they were read with
+		std::vector<std::string> materialFiles;
+		// or, when the binary cache was up to date, its mapped records
+		std::unique_ptr<gps::MeshCache> cache;
+		// registry keys of the referenced textures by path
+		std::map<std::string, TextureRegistry::Key> textureKeys;
+		VertexStats stats;
+	};
+
 	class Model3D
 	{
 
 	public:
 		~Model3D();
 
+		// Whether the meshes keep CPU copies of their vertices and indices after the upload (the
+		// default). Batching, instancing, clustering, occluders and the visibility set read them;
+		// a model none of them is given to can switch it off before it is parsed
+		void setKeepsGeometry(bool keep);
+
 		void LoadModel(std::string fileName);
 
 		void LoadModel(std::string fileName, std::string basePath);
 
-		void Draw(gps::Shader shaderProgram, int flatShading = 0);
+		// CPU stage: parses the model and decodes its textures without any GL call,
+		// safe to run on a worker thread
+		void ParseModel(std::string fileName);
+		void ParseModel(std::string fileName, std::string basePath);
+		// GL stage: uploads the parsed model, must run on the thread owning the context
+		void UploadModel();
 
-		// compute model center
+		// Merges the meshes of uploaded models drawn with one shared transform into this
+		// model, one mesh per material and texture set. The sources keep their bounds but
+		// hand over their meshes and textures, so they draw nothing afterwards
+		void BuildStaticBatch(const std::vector<Model3D *> &sources);
+
+		// Finds meshes that are rigid transforms of an earlier mesh with the same topology and
+		// material, keeps that one as an instanced mesh with a transform per copy and drops the copies
+		void InstanceRepeatedMeshes();
+
+		// Splits every mesh reaching further than maxExtent along an axis into spatial clusters of
+		// whole triangles, and every instanced mesh spread wider than that into one instanced mesh
+		// per maxExtent grid cell of placements, so culling can reject the parts of large assets separately
+		void SplitIntoClusters(float maxExtent);
+
+		void Draw(gps::Shader shaderProgram);
+
+		// component meshes, for renderers drawing them individually
+		std::vector<gps::Mesh> &getMeshes();
+
+		// bounds computed once by UploadModel
 		glm::vec3 getCenter();
 		glm::vec3 getMinBounds();
 		glm::vec3 getMaxBounds();
+		BoundingBox getBounds();
+		BoundingSphere getBoundingSphere();
+
+		// vertex reduction achieved by the welder
+		VertexStats getVertexStats();
 
 	private:
 		// Component meshes
 		std::vector<gps::Mesh> meshes;
-		// Associated textures
-		std::vector<gps::Texture> loadedTextures;
+		// Associated textures by path, each holding one registry reference
+		std::unordered_map<std::string, gps::Texture> loadedTextures;
+		// Welding statistics gathered by ReadOBJ
+		VertexStats vertexStats;
+		// Union of the mesh bounds, zero for an empty model
+		BoundingBox bounds = { glm::vec3(0.0f), glm::vec3(0.0f) };
+		BoundingSphere sphere = { glm::vec3(0.0f), 0.0f };
+		// Output of ParseModel waiting for UploadModel
+		ModelData pending;
+		bool keepsGeometry = true;
 		// Does the parsing of the .obj file and fills in the data structure
 		void ReadOBJ(std::string fileName, std::string basePath);
+		// Maps the binary cache of the .obj file, if it is up to date
+		bool ReadMeshCache(std::string fileName);
+		// Combines the mesh bounds into the model bounds
+		void ComputeBounds();
+		// Decodes every texture referenced by the pending meshes that the registry does not hold yet
+		void DecodeTextures();
 		// Retrieves a texture associated with the object
 		gps::Texture LoadTexture(std::string path, std::string type);
-		// Reads the pixel data from an image file and loads it into the video memory
-		GLuint ReadTextureFromFile(const char *file_name);
 	};
 }
 
@@ -0,0 +1,49 @@
+#include "ModelLoader.hpp"
+
+namespace gps {
+
+    ModelLoader::~ModelLoader() {
+        Finish();
+    }
+
+    void ModelLoader::Enqueue(gps::Model3D &model, std::string fileName) {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            outstanding++;
+        }
+
+        gps::Model3D *target = &model;
+        workers.push_back(std::thread([this, target, fileName]() {
+            target->ParseModel(fileName);
+
+            std::lock_guard<std::mutex> lock(queueMutex);
+            uploadQueue.push_back(target);
+            queueReady.notify_one();
+        }));
+    }
+
+    void ModelLoader::Finish() {
+        while (true) {
+            gps::Model3D *model = NULL;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                if (outstanding == 0) {
+                    break;
+                }
+                queueReady.wait(lock, [this]() { return !uploadQueue.empty(); });
+                model = uploadQueue.front();
+                uploadQueue.pop_front();
+                outstanding--;
+            }
+
+            // GL calls stay on the calling thread
+            model->UploadModel();
+        }
+
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+        workers.clear();
+    }
+
+}
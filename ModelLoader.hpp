@@ -0,0 +1,39 @@
+#ifndef ModelLoader_hpp
+#define ModelLoader_hpp
+
+#include "Model3D.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace gps {
+
+    // Loads several models concurrently: parsing and texture decoding run on worker
+    // threads, while the GL uploads are drained from a queue on the context thread.
+    class ModelLoader {
+
+    public:
+        ~ModelLoader();
+
+        // starts parsing the model on a worker thread
+        void Enqueue(gps::Model3D &model, std::string fileName);
+        // uploads models as they become ready, returns once every queued model is on the GPU;
+        // must be called on the thread owning the GL context
+        void Finish();
+
+    private:
+        std::vector<std::thread> workers;
+        std::mutex queueMutex;
+        std::condition_variable queueReady;
+        // parsed models waiting for their GL upload
+        std::deque<gps::Model3D *> uploadQueue;
+        size_t outstanding = 0;
+    };
+
+}
+
+#endif /* ModelLoader_hpp */
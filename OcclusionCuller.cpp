@@ -0,0 +1,300 @@
+#include "OcclusionCuller.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GPS_OCCLUSION_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace gps {
+
+    namespace {
+
+        // clip w below which a vertex counts as behind the camera
+        const float NEAR_W = 1e-3f;
+        // boxes must be this much farther than the occluder to be hidden, absorbing rounding
+        const float DEPTH_BIAS = 1.0f - 1e-4f;
+        const size_t PROJECT_CHUNK = 8192;
+        // triangles per binning job
+        const size_t BIN_CHUNK = 8192;
+        const int MAX_BANDS = 16;
+    }
+
+    OcclusionCuller::OcclusionCuller() {
+        depth.assign(WIDTH * HEIGHT, 0.0f);
+        viewProjection = glm::mat4(1.0f);
+        ready = false;
+        bandCount = 0;
+        rowsPerBand = HEIGHT;
+    }
+
+    OcclusionCuller::~OcclusionCuller() {
+        // the band jobs write into this object
+        Finish();
+    }
+
+    void OcclusionCuller::AddOccluder(Model3D &model) {
+        std::vector<Mesh> &meshes = model.getMeshes();
+        for (size_t m = 0; m < meshes.size(); m++) {
+            const Mesh &mesh = meshes[m];
+            std::vector<glm::mat4> placements = mesh.instances;
+            if (placements.empty()) {
+                placements.push_back(glm::mat4(1.0f));
+            }
+            for (size_t p = 0; p < placements.size(); p++) {
+                uint32_t base = (uint32_t)positions.size();
+                for (size_t i = 0; i < mesh.vertices.size(); i++) {
+                    positions.push_back(glm::vec3(placements[p] * glm::vec4(mesh.vertices[i].Position, 1.0f)));
+                }
+                for (size_t i = 0; i < mesh.indices.size(); i++) {
+                    indices.push_back(base + mesh.indices[i]);
+                }
+            }
+        }
+    }
+
+    void OcclusionCuller::Begin(const glm::mat4 &viewProjection, const glm::mat4 &occluderTransform) {
+        Finish();
+        this->viewProjection = viewProjection;
+        std::fill(depth.begin(), depth.end(), 0.0f);
+        ready = !indices.empty();
+        if (!ready) {
+            return;
+        }
+
+        // binning and every band read the projected vertices, so they are projected first
+        ThreadPool &pool = ThreadPool::Shared();
+        glm::mat4 occluderViewProjection = viewProjection * occluderTransform;
+        projected.resize(positions.size());
+        std::vector<std::future<void> > chunks;
+        for (size_t first = 0; first < positions.size(); first += PROJECT_CHUNK) {
+            size_t last = std::min(first + PROJECT_CHUNK, positions.size());
+            chunks.push_back(pool.Submit([this, first, last, occluderViewProjection]() {
+                ProjectVertices(first, last, occluderViewProjection);
+            }));
+        }
+        for (size_t i = 0; i < chunks.size(); i++) {
+            chunks[i].get();
+        }
+        chunks.clear();
+
+        // horizontal bands own disjoint rows of the buffer and need no locking
+        int requestedBands = std::max(1, std::min((int)pool.getThreadCount(), MAX_BANDS));
+        rowsPerBand = (HEIGHT + requestedBands - 1) / requestedBands;
+        bandCount = (HEIGHT + rowsPerBand - 1) / rowsPerBand;
+
+        // each triangle is listed in the bands its rows touch, so a band only visits its own
+        size_t triangleCount = indices.size() / 3;
+        size_t binChunks = (triangleCount + BIN_CHUNK - 1) / BIN_CHUNK;
+        bandTriangles.resize(binChunks * bandCount);
+        for (size_t i = 0; i < bandTriangles.size(); i++) {
+            bandTriangles[i].clear();
+        }
+        for (size_t chunk = 0; chunk < binChunks; chunk++) {
+            chunks.push_back(pool.Submit([this, chunk, triangleCount]() {
+                BinTriangles(chunk, chunk * BIN_CHUNK, std::min((chunk + 1) * BIN_CHUNK, triangleCount));
+            }));
+        }
+        for (size_t i = 0; i < chunks.size(); i++) {
+            chunks[i].get();
+        }
+
+        for (int band = 0; band < bandCount; band++) {
+            bands.push_back(pool.Submit([this, band]() {
+                RasterizeBand(band);
+            }));
+        }
+    }
+
+    void OcclusionCuller::Finish() {
+        for (size_t i = 0; i < bands.size(); i++) {
+            bands[i].get();
+        }
+        bands.clear();
+    }
+
+    bool OcclusionCuller::IsVisible(const BoundingBox &box) const {
+        if (!ready) {
+            return true;
+        }
+
+        // screen rectangle and nearest 1/w of the projected corners
+        float minX = (float)WIDTH, minY = (float)HEIGHT, maxX = 0.0f, maxY = 0.0f;
+        float nearest = 0.0f;
+        for (int corner = 0; corner < 8; corner++) {
+            glm::vec3 point((corner & 1) ? box.max.x : box.min.x,
+                            (corner & 2) ? box.max.y : box.min.y,
+                            (corner & 4) ? box.max.z : box.min.z);
+            glm::vec4 clip = viewProjection * glm::vec4(point, 1.0f);
+            if (clip.w <= NEAR_W) {
+                return true;
+            }
+            float inverseW = 1.0f / clip.w;
+            float x = (clip.x * inverseW * 0.5f + 0.5f) * WIDTH;
+            float y = (clip.y * inverseW * 0.5f + 0.5f) * HEIGHT;
+            minX = std::min(minX, x);
+            maxX = std::max(maxX, x);
+            minY = std::min(minY, y);
+            maxY = std::max(maxY, y);
+            nearest = std::max(nearest, inverseW);
+        }
+        int x0 = std::max(0, (int)std::floor(minX));
+        int x1 = std::min((int)WIDTH - 1, (int)std::floor(maxX));
+        int y0 = std::max(0, (int)std::floor(minY));
+        int y1 = std::min((int)HEIGHT - 1, (int)std::floor(maxY));
+        if (x0 > x1 || y0 > y1) {
+            // off screen, left to the frustum test
+            return true;
+        }
+
+        // hidden only if every covered pixel holds an occluder nearer than the box
+        float threshold = nearest * DEPTH_BIAS;
+        for (int y = y0; y <= y1; y++) {
+            const float *row = &depth[y * WIDTH];
+            int x = x0;
+#if defined(GPS_OCCLUSION_SSE2)
+            __m128 limit = _mm_set1_ps(threshold);
+            for (; x + 4 <= x1 + 1; x += 4) {
+                if (_mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(row + x), limit)) != 0) {
+                    return true;
+                }
+            }
+#endif
+            for (; x <= x1; x++) {
+                if (row[x] <= threshold) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    size_t OcclusionCuller::getOccluderTriangleCount() const {
+        return indices.size() / 3;
+    }
+
+    void OcclusionCuller::ProjectVertices(size_t first, size_t last, const glm::mat4 &occluderViewProjection) {
+        for (size_t i = first; i < last; i++) {
+            glm::vec4 clip = occluderViewProjection * glm::vec4(positions[i], 1.0f);
+            if (clip.w <= NEAR_W) {
+                projected[i] = glm::vec4(0.0f);
+                continue;
+            }
+            float inverseW = 1.0f / clip.w;
+            projected[i] = glm::vec4((clip.x * inverseW * 0.5f + 0.5f) * WIDTH,
+                                     (clip.y * inverseW * 0.5f + 0.5f) * HEIGHT,
+                                     inverseW, 1.0f);
+        }
+    }
+
+    void OcclusionCuller::BinTriangles(size_t chunk, size_t firstTriangle, size_t lastTriangle) {
+        std::vector<uint32_t> *lists = &bandTriangles[chunk * bandCount];
+        for (size_t triangle = firstTriangle; triangle < lastTriangle; triangle++) {
+            size_t t = triangle * 3;
+            const glm::vec4 &v0 = projected[indices[t]];
+            const glm::vec4 &v1 = projected[indices[t + 1]];
+            const glm::vec4 &v2 = projected[indices[t + 2]];
+            // triangles crossing the near plane are skipped, which only loses occlusion
+            if (v0.w == 0.0f || v1.w == 0.0f || v2.w == 0.0f) {
+                continue;
+            }
+            // back faces and degenerate triangles
+            float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+            if (area <= 0.0f) {
+                continue;
+            }
+
+            // rows and columns of pixel centers covered by the bounding rectangle
+            int x0 = std::max(0, (int)std::ceil(std::min(v0.x, std::min(v1.x, v2.x)) - 0.5f));
+            int x1 = std::min((int)WIDTH - 1, (int)std::floor(std::max(v0.x, std::max(v1.x, v2.x)) - 0.5f));
+            int y0 = std::max(0, (int)std::ceil(std::min(v0.y, std::min(v1.y, v2.y)) - 0.5f));
+            int y1 = std::min((int)HEIGHT - 1, (int)std::floor(std::max(v0.y, std::max(v1.y, v2.y)) - 0.5f));
+            if (x0 > x1 || y0 > y1) {
+                continue;
+            }
+            for (int band = y0 / rowsPerBand; band <= y1 / rowsPerBand; band++) {
+                lists[band].push_back((uint32_t)t);
+            }
+        }
+    }
+
+    void OcclusionCuller::RasterizeBand(int band) {
+        int firstRow = band * rowsPerBand;
+        int lastRow = std::min(firstRow + rowsPerBand, (int)HEIGHT);
+        for (size_t list = band; list < bandTriangles.size(); list += bandCount) {
+            const std::vector<uint32_t> &triangles = bandTriangles[list];
+            for (size_t i = 0; i < triangles.size(); i++) {
+                RasterizeTriangle(triangles[i], firstRow, lastRow);
+            }
+        }
+    }
+
+    void OcclusionCuller::RasterizeTriangle(uint32_t t, int firstRow, int lastRow) {
+        // binned triangles are in front of the near plane and face the camera
+        const glm::vec4 &v0 = projected[indices[t]];
+        const glm::vec4 &v1 = projected[indices[t + 1]];
+        const glm::vec4 &v2 = projected[indices[t + 2]];
+        float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+
+        // pixel centers covered by the bounding rectangle, clipped to the band
+        int x0 = std::max(0, (int)std::ceil(std::min(v0.x, std::min(v1.x, v2.x)) - 0.5f));
+        int x1 = std::min((int)WIDTH - 1, (int)std::floor(std::max(v0.x, std::max(v1.x, v2.x)) - 0.5f));
+        int y0 = std::max(firstRow, (int)std::ceil(std::min(v0.y, std::min(v1.y, v2.y)) - 0.5f));
+        int y1 = std::min(lastRow - 1, (int)std::floor(std::max(v0.y, std::max(v1.y, v2.y)) - 0.5f));
+        if (x0 > x1 || y0 > y1) {
+            return;
+        }
+
+        // edge functions a * x + b * y + c, positive inside; e12 weights v0, e20 v1, e01 v2
+        float a12 = v1.y - v2.y, b12 = v2.x - v1.x, c12 = v1.x * v2.y - v2.x * v1.y;
+        float a20 = v2.y - v0.y, b20 = v0.x - v2.x, c20 = v2.x * v0.y - v0.x * v2.y;
+        float a01 = v0.y - v1.y, b01 = v1.x - v0.x, c01 = v0.x * v1.y - v1.x * v0.y;
+        // 1/w is linear in screen space
+        float inverseArea = 1.0f / area;
+        float dzdx = (a12 * v0.z + a20 * v1.z + a01 * v2.z) * inverseArea;
+        float dzdy = (b12 * v0.z + b20 * v1.z + b01 * v2.z) * inverseArea;
+        float z0 = (c12 * v0.z + c20 * v1.z + c01 * v2.z) * inverseArea;
+
+        for (int y = y0; y <= y1; y++) {
+            float py = y + 0.5f;
+            float *row = &depth[y * WIDTH];
+            int x = x0;
+#if defined(GPS_OCCLUSION_SSE2)
+            // four pixels per step from the aligned column at or before x0
+            x = x0 & ~3;
+            const __m128 laneOffsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+            const __m128 zero = _mm_setzero_ps();
+            __m128 rowE12 = _mm_set1_ps(b12 * py + c12);
+            __m128 rowE20 = _mm_set1_ps(b20 * py + c20);
+            __m128 rowE01 = _mm_set1_ps(b01 * py + c01);
+            __m128 rowZ = _mm_set1_ps(dzdy * py + z0);
+            for (; x <= x1; x += 4) {
+                __m128 px = _mm_add_ps(_mm_set1_ps((float)x), laneOffsets);
+                __m128 e12 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a12), px), rowE12);
+                __m128 e20 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a20), px), rowE20);
+                __m128 e01 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a01), px), rowE01);
+                __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e12, zero), _mm_cmpge_ps(e20, zero)),
+                                           _mm_cmpge_ps(e01, zero));
+                if (_mm_movemask_ps(inside) == 0) {
+                    continue;
+                }
+                __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(dzdx), px), rowZ);
+                __m128 current = _mm_loadu_ps(row + x);
+                __m128 nearer = _mm_max_ps(current, z);
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, current)));
+            }
+#endif
+            for (; x <= x1; x++) {
+                float px = x + 0.5f;
+                if (a12 * px + b12 * py + c12 < 0.0f || a20 * px + b20 * py + c20 < 0.0f || a01 * px + b01 * py + c01 < 0.0f) {
+                    continue;
+                }
+                row[x] = std::max(row[x], dzdx * px + dzdy * py + z0);
+            }
+        }
+    }
+
+}
@@ -0,0 +1,69 @@
+#ifndef OcclusionCuller_hpp
+#define OcclusionCuller_hpp
+
+#include "Model3D.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <vector>
+
+namespace gps {
+
+    // Low-resolution software depth buffer: a few occluder models are rasterized into it on the
+    // shared thread pool, then world boxes are tested against it so meshes hidden behind the
+    // occluders are dropped before submission, without waiting on GPU queries
+    class OcclusionCuller {
+
+    public:
+        // multiple of four, rows are processed four pixels at a time
+        static const int WIDTH = 256;
+        static const int HEIGHT = 128;
+
+        OcclusionCuller();
+        ~OcclusionCuller();
+
+        // copies the positions and triangles of every mesh of the model (each placement of an
+        // instanced one), in model space
+        void AddOccluder(Model3D &model);
+        // clears the buffer and starts rasterizing the occluders, placed by occluderTransform and
+        // seen through viewProjection, on the worker threads
+        void Begin(const glm::mat4 &viewProjection, const glm::mat4 &occluderTransform);
+        // waits for the rasterization started by Begin
+        void Finish();
+        // false when the world box lies entirely behind the rasterized occluders; true when
+        // nothing was rasterized or the box crosses the near plane
+        bool IsVisible(const BoundingBox &box) const;
+
+        size_t getOccluderTriangleCount() const;
+
+    private:
+        OcclusionCuller(const OcclusionCuller &);
+        OcclusionCuller &operator=(const OcclusionCuller &);
+
+        std::vector<glm::vec3> positions;
+        std::vector<uint32_t> indices;
+        // occluder vertices in pixels, with 1/w in z; w holds 0 for vertices behind the near plane
+        std::vector<glm::vec4> projected;
+        // 1/w of the nearest occluder per pixel, 0 where none was drawn; rows bottom to top
+        std::vector<float> depth;
+        glm::mat4 viewProjection;
+        std::vector<std::future<void> > bands;
+        int bandCount;
+        int rowsPerBand;
+        // first index of each front-facing triangle touching a band, one list per binning chunk
+        // and band at [chunk * bandCount + band]
+        std::vector<std::vector<uint32_t> > bandTriangles;
+        bool ready;
+
+        void ProjectVertices(size_t first, size_t last, const glm::mat4 &occluderViewProjection);
+        void BinTriangles(size_t chunk, size_t firstTriangle, size_t lastTriangle);
+        void RasterizeBand(int band);
+        void RasterizeTriangle(uint32_t t, int firstRow, int lastRow);
+    };
+
+}
+
+#endif /* OcclusionCuller_hpp */
@@ -0,0 +1,401 @@
+#include "PotentiallyVisibleSet.hpp"
+#include "Bvh.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <map>
+
+namespace gps {
+
+    namespace {
+
+        const char PVS_MAGIC[4] = { 'G', 'P', 'S', 'V' };
+        // bump whenever the layout below or the sampling changes
+        const uint32_t PVS_VERSION = 2;
+        const float MAX_RAY_DISTANCE = 1000.0f;
+        const float GOLDEN_ANGLE = 2.39996323f;
+        const float TWO_PI = 6.28318531f;
+
+        struct PvsHeader {
+            char magic[4];
+            uint32_t version;
+            uint64_t key;
+            int32_t cellsX;
+            int32_t cellsY;
+            int32_t cellsZ;
+            uint32_t objectCount;
+            uint32_t rowCount;
+            uint32_t rowWords;
+        };
+
+        uint64_t HashBytes(uint64_t hash, const void *data, size_t size) {
+            const unsigned char *bytes = (const unsigned char *)data;
+            for (size_t i = 0; i < size; i++) {
+                hash ^= bytes[i];
+                hash *= 1099511628211ULL;
+            }
+            return hash;
+        }
+
+        // radical inverse, for sample positions that fill the cell evenly
+        float Halton(uint32_t index, uint32_t base) {
+            float fraction = 1.0f;
+            float result = 0.0f;
+            while (index > 0) {
+                fraction /= (float)base;
+                result += fraction * (float)(index % base);
+                index /= base;
+            }
+            return result;
+        }
+
+        // Moller-Trumbore against the front face only: back faces are culled when drawing, so
+        // rays pass through them
+        bool IntersectTriangle(const glm::vec3 *triangle, const Ray &ray, float &distance) {
+            glm::vec3 edge1 = triangle[1] - triangle[0];
+            glm::vec3 edge2 = triangle[2] - triangle[0];
+            glm::vec3 p = glm::cross(ray.direction, edge2);
+            float determinant = glm::dot(edge1, p);
+            if (determinant <= 1e-12f) {
+                return false;
+            }
+            float inverse = 1.0f / determinant;
+            glm::vec3 s = ray.origin - triangle[0];
+            float u = glm::dot(s, p) * inverse;
+            if (u < 0.0f || u > 1.0f) {
+                return false;
+            }
+            glm::vec3 q = glm::cross(s, edge1);
+            float v = glm::dot(ray.direction, q) * inverse;
+            if (v < 0.0f || u + v > 1.0f) {
+                return false;
+            }
+            float t = glm::dot(edge2, q) * inverse;
+            if (t <= 0.0f) {
+                return false;
+            }
+            distance = t;
+            return true;
+        }
+    }
+
+    PotentiallyVisibleSet::PotentiallyVisibleSet() {
+        cellsX = cellsY = cellsZ = 0;
+        rowWords = 0;
+    }
+
+    uint32_t PotentiallyVisibleSet::AddObject(const Mesh &mesh, const glm::mat4 &transform) {
+        std::unordered_map<const Mesh *, uint32_t>::const_iterator found = meshObjects.find(&mesh);
+        if (found != meshObjects.end()) {
+            return found->second;
+        }
+
+        Object object;
+        object.bounds = Bvh::EmptyBox();
+        object.firstTriangle = (uint32_t)triangleObjects.size();
+        uint32_t index = (uint32_t)objects.size();
+
+        std::vector<glm::mat4> placements = mesh.instances;
+        if (placements.empty()) {
+            placements.push_back(glm::mat4(1.0f));
+        }
+        for (size_t p = 0; p < placements.size(); p++) {
+            glm::mat4 placement = transform * placements[p];
+            for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+                for (int corner = 0; corner < 3; corner++) {
+                    glm::vec3 point(placement * glm::vec4(mesh.vertices[mesh.indices[i + corner]].Position, 1.0f));
+                    corners.push_back(point);
+                    object.bounds.min = glm::min(object.bounds.min, point);
+                    object.bounds.max = glm::max(object.bounds.max, point);
+                }
+                triangleObjects.push_back(index);
+            }
+        }
+        object.triangleCount = (uint32_t)triangleObjects.size() - object.firstTriangle;
+
+        objects.push_back(object);
+        meshObjects[&mesh] = index;
+        return index;
+    }
+
+    void PotentiallyVisibleSet::AddObjects(Model3D &model, const glm::mat4 &transform) {
+        std::vector<Mesh> &meshes = model.getMeshes();
+        for (size_t i = 0; i < meshes.size(); i++) {
+            AddObject(meshes[i], transform);
+        }
+    }
+
+    void PotentiallyVisibleSet::Prepare(const std::string &fileName, const PvsSettings &settings) {
+        if (Load(fileName, settings)) {
+            return;
+        }
+        Bake(settings);
+        Save(fileName);
+    }
+
+    void PotentiallyVisibleSet::Bake(const PvsSettings &settings) {
+        SetGrid(settings);
+        size_t cellCount = getCellCount();
+        rowWords = (objects.size() + 63) / 64;
+        std::vector<uint64_t> cellBits(cellCount * rowWords, 0);
+
+        // triangles for the rays, object bounds for the cells the camera can stand inside
+        std::vector<BoundingBox> boxes(triangleObjects.size());
+        for (size_t t = 0; t < boxes.size(); t++) {
+            const glm::vec3 *triangle = &corners[t * 3];
+            boxes[t].min = glm::min(triangle[0], glm::min(triangle[1], triangle[2]));
+            boxes[t].max = glm::max(triangle[0], glm::max(triangle[1], triangle[2]));
+        }
+        Bvh triangleTree;
+        triangleTree.Build(boxes);
+        std::vector<BoundingBox> objectBoxes(objects.size());
+        for (size_t i = 0; i < objects.size(); i++) {
+            objectBoxes[i] = objects[i].bounds;
+        }
+        Bvh objectTree;
+        objectTree.Build(objectBoxes);
+
+        // Fibonacci lattice: evenly spread directions over the sphere
+        std::vector<glm::vec3> directions(std::max(settings.raysPerSample, 1));
+        for (size_t i = 0; i < directions.size(); i++) {
+            float y = 1.0f - 2.0f * ((float)i + 0.5f) / (float)directions.size();
+            float radius = std::sqrt(std::max(0.0f, 1.0f - y * y));
+            float phi = GOLDEN_ANGLE * (float)i;
+            directions[i] = glm::vec3(std::cos(phi) * radius, y, std::sin(phi) * radius);
+        }
+
+        // mean angle between neighbouring lattice directions; an object narrower than that from
+        // some eye in a cell can fall between the rays
+        float spacing = std::sqrt(4.0f * 3.14159265f / (float)directions.size());
+        float sinSpacing = std::sin(std::min(spacing, 1.57079633f));
+
+        Bvh::ItemRayTest test = [this](uint32_t triangle, const Ray &ray, float &distance) {
+            return IntersectTriangle(&corners[triangle * 3], ray, distance);
+        };
+
+        // one job per cell, each writing only its own row
+        ThreadPool &pool = ThreadPool::Shared();
+        std::vector<std::future<void> > jobs;
+        for (size_t cell = 0; cell < cellCount && rowWords > 0; cell++) {
+            jobs.push_back(pool.Submit([&, cell]() {
+                int x = (int)(cell % cellsX);
+                int y = (int)((cell / cellsX) % cellsY);
+                int z = (int)(cell / ((size_t)cellsX * cellsY));
+                BoundingBox cellBox;
+                cellBox.min = settings.min + glm::vec3((float)x, (float)y, (float)z) * settings.cellSize;
+                cellBox.max = glm::min(cellBox.min + glm::vec3(settings.cellSize), settings.max);
+                uint64_t *bits = &cellBits[cell * rowWords];
+
+                std::vector<uint32_t> inside;
+                objectTree.QueryOverlap(cellBox, inside);
+                for (size_t i = 0; i < inside.size(); i++) {
+                    bits[inside[i] / 64] |= 1ULL << (inside[i] % 64);
+                }
+
+                // objects whose bounding sphere, seen from the farthest point of the cell, is
+                // smaller than the ray spacing are kept without relying on the samples
+                for (size_t i = 0; i < objects.size(); i++) {
+                    const BoundingBox &bounds = objects[i].bounds;
+                    glm::vec3 center = (bounds.min + bounds.max) * 0.5f;
+                    float radius = glm::length(bounds.max - bounds.min) * 0.5f;
+                    glm::vec3 farthest = glm::max(glm::abs(center - cellBox.min), glm::abs(center - cellBox.max));
+                    if (radius < glm::length(farthest) * sinSpacing) {
+                        bits[i / 64] |= 1ULL << (i % 64);
+                    }
+                }
+
+                for (int s = 0; s < settings.samplesPerCell; s++) {
+                    glm::vec3 jitter(Halton(s + 1, 2), Halton(s + 1, 3), Halton(s + 1, 5));
+                    Ray ray;
+                    ray.origin = glm::mix(cellBox.min, cellBox.max, jitter);
+                    // each sample turns the lattice about y so the samples cover different directions
+                    float turn = TWO_PI * Halton(s + 1, 7);
+                    float c = std::cos(turn), n = std::sin(turn);
+                    for (size_t d = 0; d < directions.size(); d++) {
+                        const glm::vec3 &direction = directions[d];
+                        ray.direction = glm::vec3(c * direction.x - n * direction.z, direction.y, n * direction.x + c * direction.z);
+                        RayHit hit;
+                        if (triangleTree.RayCast(ray, MAX_RAY_DISTANCE, hit, test)) {
+                            uint32_t object = triangleObjects[hit.item];
+                            bits[object / 64] |= 1ULL << (object % 64);
+                        }
+                    }
+                }
+            }));
+        }
+        for (size_t i = 0; i < jobs.size(); i++) {
+            jobs[i].get();
+        }
+
+        // a cell also takes what its face neighbours see, covering eyes near its boundary that
+        // the samples missed
+        std::vector<uint64_t> dilated(cellBits);
+        for (int z = 0; z < cellsZ; z++) {
+            for (int y = 0; y < cellsY; y++) {
+                for (int x = 0; x < cellsX; x++) {
+                    size_t cell = ((size_t)z * cellsY + y) * cellsX + x;
+                    const int offsets[6][3] = { { -1, 0, 0 }, { 1, 0, 0 }, { 0, -1, 0 }, { 0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 } };
+                    for (int o = 0; o < 6; o++) {
+                        int nx = x + offsets[o][0], ny = y + offsets[o][1], nz = z + offsets[o][2];
+                        if (nx < 0 || ny < 0 || nz < 0 || nx >= cellsX || ny >= cellsY || nz >= cellsZ) {
+                            continue;
+                        }
+                        size_t neighbour = ((size_t)nz * cellsY + ny) * cellsX + nx;
+                        for (size_t w = 0; w < rowWords; w++) {
+                            dilated[cell * rowWords + w] |= cellBits[neighbour * rowWords + w];
+                        }
+                    }
+                }
+            }
+        }
+
+        // cells with equal sets share a row
+        std::map<std::vector<uint64_t>, uint32_t> distinct;
+        cellRows.assign(cellCount, 0);
+        rows.clear();
+        for (size_t cell = 0; cell < cellCount; cell++) {
+            std::vector<uint64_t> row(dilated.begin() + cell * rowWords, dilated.begin() + (cell + 1) * rowWords);
+            std::map<std::vector<uint64_t>, uint32_t>::iterator found = distinct.find(row);
+            if (found == distinct.end()) {
+                uint32_t index = (uint32_t)distinct.size();
+                found = distinct.insert(std::make_pair(row, index)).first;
+                rows.insert(rows.end(), row.begin(), row.end());
+            }
+            cellRows[cell] = found->second;
+        }
+    }
+
+    bool PotentiallyVisibleSet::Load(const std::string &fileName, const PvsSettings &settings) {
+        FILE *in = fopen(fileName.c_str(), "rb");
+        if (!in) {
+            return false;
+        }
+        PvsHeader header;
+        bool valid = fread(&header, sizeof(header), 1, in) == 1 &&
+                     std::memcmp(header.magic, PVS_MAGIC, sizeof(PVS_MAGIC)) == 0 &&
+                     header.version == PVS_VERSION &&
+                     header.key == Key(settings) &&
+                     header.objectCount == objects.size() &&
+                     header.rowWords == (objects.size() + 63) / 64;
+        if (valid) {
+            SetGrid(settings);
+            valid = header.cellsX == cellsX && header.cellsY == cellsY && header.cellsZ == cellsZ;
+        }
+        if (valid) {
+            rowWords = header.rowWords;
+            cellRows.resize(getCellCount());
+            rows.resize((size_t)header.rowCount * rowWords);
+            valid = (cellRows.empty() || fread(&cellRows[0], sizeof(uint32_t), cellRows.size(), in) == cellRows.size()) &&
+                    (rows.empty() || fread(&rows[0], sizeof(uint64_t), rows.size(), in) == rows.size());
+            for (size_t i = 0; valid && i < cellRows.size(); i++) {
+                valid = cellRows[i] < header.rowCount;
+            }
+        }
+        fclose(in);
+        if (!valid) {
+            cellRows.clear();
+            rows.clear();
+        }
+        return valid;
+    }
+
+    bool PotentiallyVisibleSet::Save(const std::string &fileName) const {
+        FILE *out = fopen(fileName.c_str(), "wb");
+        if (!out) {
+            return false;
+        }
+        PvsHeader header;
+        std::memcpy(header.magic, PVS_MAGIC, sizeof(PVS_MAGIC));
+        header.version = PVS_VERSION;
+        header.key = Key(baked);
+        header.cellsX = cellsX;
+        header.cellsY = cellsY;
+        header.cellsZ = cellsZ;
+        header.objectCount = (uint32_t)objects.size();
+        header.rowCount = rowWords == 0 ? 0 : (uint32_t)(rows.size() / rowWords);
+        header.rowWords = (uint32_t)rowWords;
+        bool written = fwrite(&header, sizeof(header), 1, out) == 1 &&
+                       (cellRows.empty() || fwrite(&cellRows[0], sizeof(uint32_t), cellRows.size(), out) == cellRows.size()) &&
+                       (rows.empty() || fwrite(&rows[0], sizeof(uint64_t), rows.size(), out) == rows.size());
+        return fclose(out) == 0 && written;
+    }
+
+    int PotentiallyVisibleSet::getCell(const glm::vec3 &position) const {
+        if (cellRows.empty() ||
+            position.x < baked.min.x || position.y < baked.min.y || position.z < baked.min.z ||
+            position.x > baked.max.x || position.y > baked.max.y || position.z > baked.max.z) {
+            return -1;
+        }
+        glm::vec3 local = (position - baked.min) / baked.cellSize;
+        int x = std::min((int)local.x, cellsX - 1);
+        int y = std::min((int)local.y, cellsY - 1);
+        int z = std::min((int)local.z, cellsZ - 1);
+        return (z * cellsY + y) * cellsX + x;
+    }
+
+    void PotentiallyVisibleSet::getVisibleObjects(int cell, std::vector<uint32_t> &visible) const {
+        if (cell < 0 || (size_t)cell >= cellRows.size() || rows.empty()) {
+            return;
+        }
+        const uint64_t *bits = &rows[0] + (size_t)cellRows[cell] * rowWords;
+        for (uint32_t object = 0; object < objects.size(); object++) {
+            if (bits[object / 64] & (1ULL << (object % 64))) {
+                visible.push_back(object);
+            }
+        }
+    }
+
+    bool PotentiallyVisibleSet::IsVisible(int cell, const Mesh *mesh) const {
+        if (cell < 0 || (size_t)cell >= cellRows.size()) {
+            return true;
+        }
+        std::unordered_map<const Mesh *, uint32_t>::const_iterator found = meshObjects.find(mesh);
+        if (found == meshObjects.end()) {
+            return true;
+        }
+        uint32_t object = found->second;
+        return (rows[(size_t)cellRows[cell] * rowWords + object / 64] & (1ULL << (object % 64))) != 0;
+    }
+
+    size_t PotentiallyVisibleSet::getObjectCount() const {
+        return objects.size();
+    }
+
+    size_t PotentiallyVisibleSet::getCellCount() const {
+        return (size_t)cellsX * cellsY * cellsZ;
+    }
+
+    size_t PotentiallyVisibleSet::getRowCount() const {
+        return rowWords == 0 ? 0 : rows.size() / rowWords;
+    }
+
+    uint64_t PotentiallyVisibleSet::Key(const PvsSettings &settings) const {
+        uint64_t hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < objects.size(); i++) {
+            hash = HashBytes(hash, &objects[i].triangleCount, sizeof(objects[i].triangleCount));
+        }
+        if (!corners.empty()) {
+            hash = HashBytes(hash, &corners[0], corners.size() * sizeof(glm::vec3));
+        }
+        hash = HashBytes(hash, &settings.min, sizeof(settings.min));
+        hash = HashBytes(hash, &settings.max, sizeof(settings.max));
+        hash = HashBytes(hash, &settings.cellSize, sizeof(settings.cellSize));
+        hash = HashBytes(hash, &settings.samplesPerCell, sizeof(settings.samplesPerCell));
+        hash = HashBytes(hash, &settings.raysPerSample, sizeof(settings.raysPerSample));
+        return hash;
+    }
+
+    void PotentiallyVisibleSet::SetGrid(const PvsSettings &settings) {
+        baked = settings;
+        glm::vec3 size = glm::max(settings.max - settings.min, glm::vec3(0.0f));
+        cellsX = std::max(1, (int)std::ceil(size.x / settings.cellSize));
+        cellsY = std::max(1, (int)std::ceil(size.y / settings.cellSize));
+        cellsZ = std::max(1, (int)std::ceil(size.z / settings.cellSize));
+    }
+
+}
@@ -0,0 +1,87 @@
+#ifndef PotentiallyVisibleSet_hpp
+#define PotentiallyVisibleSet_hpp
+
+#include "Model3D.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+    // Grid and sampling density of a bake
+    struct PvsSettings {
+        // box of camera positions, e.g. the camera movement bounds
+        glm::vec3 min = glm::vec3(0.0f);
+        glm::vec3 max = glm::vec3(0.0f);
+        float cellSize = 4.0f;
+        // jittered eye positions per cell and rays cast from each of them; objects narrower than
+        // the angle between rays, seen from the far side of a cell, are always kept for it
+        int samplesPerCell = 8;
+        int raysPerSample = 512;
+    };
+
+    // Objects visible from each cell of a box of camera positions. Static meshes are registered
+    // as objects; Bake casts rays from sample points of every cell against their triangles on the
+    // shared thread pool and records the objects hit. Each cell stores an index into a table of
+    // distinct bit rows, one bit per object.
+    class PotentiallyVisibleSet {
+
+    public:
+        PotentiallyVisibleSet();
+
+        // registers the mesh, with every placement of an instanced one, under transform and
+        // returns its object index; a mesh is registered once
+        uint32_t AddObject(const Mesh &mesh, const glm::mat4 &transform);
+        void AddObjects(Model3D &model, const glm::mat4 &transform);
+
+        // reads the sets from fileName when they were baked for the same objects and settings,
+        // otherwise bakes them and writes the file
+        void Prepare(const std::string &fileName, const PvsSettings &settings);
+        void Bake(const PvsSettings &settings);
+        bool Load(const std::string &fileName, const PvsSettings &settings);
+        bool Save(const std::string &fileName) const;
+
+        // cell holding the position, -1 outside the volume or before a bake
+        int getCell(const glm::vec3 &position) const;
+        // appends the objects visible from the cell
+        void getVisibleObjects(int cell, std::vector<uint32_t> &visible) const;
+        // false only for a registered mesh that cannot be seen from the cell
+        bool IsVisible(int cell, const Mesh *mesh) const;
+
+        size_t getObjectCount() const;
+        size_t getCellCount() const;
+        // distinct visibility rows shared by the cells
+        size_t getRowCount() const;
+
+    private:
+        struct Object {
+            BoundingBox bounds;
+            uint32_t firstTriangle;
+            uint32_t triangleCount;
+        };
+
+        std::vector<Object> objects;
+        std::unordered_map<const Mesh *, uint32_t> meshObjects;
+        // three corners per triangle, in the space of the cells
+        std::vector<glm::vec3> corners;
+        std::vector<uint32_t> triangleObjects;
+
+        PvsSettings baked;
+        int cellsX, cellsY, cellsZ;
+        std::vector<uint32_t> cellRows;
+        std::vector<uint64_t> rows;
+        size_t rowWords;
+
+        // hash of the objects' geometry and the settings, stored with the baked sets
+        uint64_t Key(const PvsSettings &settings) const;
+        void SetGrid(const PvsSettings &settings);
+    };
+
+}
+
+#endif /* PotentiallyVisibleSet_hpp */
@@ -0,0 +1,298 @@
+#include "RenderQueue.hpp"
+#include "GLState.hpp"
+#include "UniformBuffer.hpp"
+
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace gps {
+
+    namespace {
+
+        const int DEPTH_BITS = 3;
+        const int MATERIAL_BITS = 32;
+        const int UNUSED_BITS = 64 - 8 - DEPTH_BITS - MATERIAL_BITS;
+        const uint32_t DEPTH_BUCKETS = 1u << DEPTH_BITS;
+        const uint32_t NO_DRAW = 0xFFFFFFFFu;
+
+        // [program 8][depth bucket 3][material 32][unused 21]: packets of one program are
+        // drawn front to back in a few coarse buckets, meshes sharing a material are adjacent
+        // within a bucket
+        uint64_t MakeKey(GLuint program, uint32_t depthBucket, uint32_t material) {
+            return ((uint64_t)(program & 0xFFu) << (DEPTH_BITS + MATERIAL_BITS + UNUSED_BITS)) |
+                   ((uint64_t)depthBucket << (MATERIAL_BITS + UNUSED_BITS)) |
+                   ((uint64_t)material << UNUSED_BITS);
+        }
+
+        // depth past nearDepth on a logarithmic scale, 0 at nearDepth and 1 at farDepth
+        float DepthFraction(float depth, float nearDepth, float farDepth) {
+            float t = std::log1p(std::max(depth - nearDepth, 0.0f)) / std::log1p(farDepth - nearDepth);
+            return std::min(t, 1.0f);
+        }
+
+        // buckets widen with distance, so the near ones stay ordered and the far ones group materials
+        uint32_t DepthBucket(float fraction) {
+            return std::min((uint32_t)(fraction * DEPTH_BUCKETS), DEPTH_BUCKETS - 1);
+        }
+
+        // FNV-1a over the texture names and diffuse color, equal for meshes binding the same state
+        uint32_t MaterialKey(const Mesh &mesh) {
+            uint32_t hash = 2166136261u;
+            for (size_t i = 0; i < mesh.textures.size(); i++) {
+                hash ^= mesh.textures[i].id;
+                hash *= 16777619u;
+            }
+            uint32_t words[3];
+            std::memcpy(words, &mesh.material.diffuse, sizeof(words));
+            for (int i = 0; i < 3; i++) {
+                hash ^= words[i];
+                hash *= 16777619u;
+            }
+            return hash;
+        }
+
+        struct KeyLess {
+            template <typename P>
+            bool operator()(const P &a, const P &b) const {
+                return a.key < b.key;
+            }
+        };
+    }
+
+    void RenderQueue::Clear() {
+        if (uploaded) {
+            // every command reading the last region has been issued by now
+            drawBuffer.Fence();
+            uploaded = false;
+        }
+        objects.clear();
+        draws.clear();
+        culler.Clear();
+        hierarchyCurrent = false;
+        for (int pass = 0; pass < RENDER_PASS_COUNT; pass++) {
+            queued[pass].clear();
+            packets[pass].clear();
+            culled[pass] = 0;
+            occluded[pass] = 0;
+        }
+    }
+
+    void RenderQueue::Add(Model3D &model, const glm::mat4 &transform, int fogEnabled, unsigned int passMask) {
+        Object object;
+        object.transform = transform;
+        object.fogEnabled = fogEnabled;
+        uint32_t objectIndex = (uint32_t)objects.size();
+        objects.push_back(object);
+
+        std::vector<Mesh> &meshes = model.getMeshes();
+        for (size_t i = 0; i < meshes.size(); i++) {
+            Draw draw;
+            draw.mesh = &meshes[i];
+            draw.object = objectIndex;
+            uint32_t drawIndex = (uint32_t)draws.size();
+            draws.push_back(draw);
+            culler.Add(meshes[i].bounds, transform);
+
+            for (int pass = 0; pass < RENDER_PASS_COUNT; pass++) {
+                if (passMask & (1u << pass)) {
+                    Packet packet;
+                    packet.key = 0;
+                    packet.draw = drawIndex;
+                    queued[pass].push_back(packet);
+                }
+            }
+        }
+    }
+
+    void RenderQueue::Upload(const glm::mat4 &view) {
+        if (draws.empty()) {
+            return;
+        }
+        GLsizeiptr alignment = UniformBuffer::getOffsetAlignment();
+        drawStride = ((GLsizeiptr)sizeof(DrawUniforms) + alignment - 1) / alignment * alignment;
+
+        std::vector<glm::mat4> normalMatrices(objects.size());
+        for (size_t i = 0; i < objects.size(); i++) {
+            normalMatrices[i] = glm::inverseTranspose(view * objects[i].transform);
+        }
+
+        unsigned char *records = (unsigned char *)drawBuffer.Map((GLsizeiptr)draws.size() * drawStride);
+        if (!records) {
+            return;
+        }
+        for (size_t i = 0; i < draws.size(); i++) {
+            const Draw &draw = draws[i];
+            const Object &object = objects[draw.object];
+            DrawUniforms block;
+            block.model = object.transform;
+            block.normalMatrix = normalMatrices[draw.object];
+            block.materialDiffuse = glm::vec4(draw.mesh->material.diffuse, 1.0f);
+            block.flags[0] = object.fogEnabled;
+            block.flags[1] = draw.mesh->hasDiffuseTexture;
+            block.flags[2] = draw.mesh->hasSpecularTexture;
+            block.flags[3] = draw.mesh->getFirstInstance();
+            std::memcpy(records + i * drawStride, &block, sizeof(block));
+        }
+        drawOffset = drawBuffer.Unmap();
+        uploaded = true;
+    }
+
+    void RenderQueue::Sort(const RenderPass &pass) {
+        std::vector<Packet> &bucket = packets[pass.id];
+        bucket = queued[pass.id];
+        culled[pass.id] = 0;
+        occluded[pass.id] = 0;
+        if (pass.cull) {
+            if (!hierarchyCurrent) {
+                UpdateHierarchy();
+            }
+            hierarchyHits.clear();
+            hierarchy.QueryFrustum(Frustum::FromMatrix(pass.cullMatrix), hierarchyHits);
+            visible.assign(draws.size(), 0);
+            for (size_t i = 0; i < hierarchyHits.size(); i++) {
+                visible[itemDraws[hierarchyHits[i]]] = 1;
+            }
+            if (pass.visibility && pass.visibilityCell >= 0) {
+                for (size_t i = 0; i < draws.size(); i++) {
+                    if (visible[i] && !pass.visibility->IsVisible(pass.visibilityCell, draws[i].mesh)) {
+                        visible[i] = 0;
+                    }
+                }
+            }
+            size_t kept = 0;
+            for (size_t i = 0; i < bucket.size(); i++) {
+                if (visible[bucket[i].draw]) {
+                    bucket[kept++] = bucket[i];
+                }
+            }
+            culled[pass.id] = bucket.size() - kept;
+            bucket.resize(kept);
+        }
+        if (pass.occlusion) {
+            size_t kept = 0;
+            for (size_t i = 0; i < bucket.size(); i++) {
+                if (pass.occlusion->IsVisible(culler.getBounds(bucket[i].draw))) {
+                    bucket[kept++] = bucket[i];
+                }
+            }
+            occluded[pass.id] = bucket.size() - kept;
+            bucket.resize(kept);
+        }
+
+        // the depth pass binds no material state, so the material field carries the fine depth
+        // and its draws stay strictly front to back
+        bool keepMaterials = !pass.depthOnly;
+        for (size_t i = 0; i < bucket.size(); i++) {
+            Packet &packet = bucket[i];
+            const Draw &draw = draws[packet.draw];
+            const Object &object = objects[draw.object];
+            glm::vec4 center = pass.view * (object.transform * glm::vec4(draw.mesh->sphere.center, 1.0f));
+            float depth = DepthFraction(-center.z, pass.nearDepth, pass.farDepth);
+            uint32_t material = keepMaterials ? MaterialKey(*draw.mesh) : (uint32_t)(depth * 4294967040.0f);
+            packet.key = MakeKey(pass.shader.shaderProgram, DepthBucket(depth), material);
+        }
+        std::stable_sort(bucket.begin(), bucket.end(), KeyLess());
+    }
+
+    void RenderQueue::Submit(const RenderPass &pass) {
+        if (!uploaded) {
+            return;
+        }
+        gps::Shader shader = pass.shader;
+        shader.useShaderProgram();
+        if (pass.depthOnly) {
+            // the only sampler a depth program reads, set here since no material binding is built
+            Uniform<int> instanceSampler = shader.getUniform<int>("instanceTransforms");
+            if (instanceSampler.isValid()) {
+                shader.setUniform(instanceSampler, INSTANCE_TEXTURE_UNIT);
+            }
+        }
+
+        const std::vector<Packet> &bucket = packets[pass.id];
+        for (size_t i = 0; i < bucket.size(); i++) {
+            const Packet &packet = bucket[i];
+            GLState::BindBufferRange(GL_UNIFORM_BUFFER, DRAW_UNIFORMS_BINDING, drawBuffer.getId(),
+                                     drawOffset + packet.draw * drawStride, sizeof(DrawUniforms));
+            if (pass.depthOnly) {
+                draws[packet.draw].mesh->DrawDepth();
+            } else {
+                draws[packet.draw].mesh->Draw(shader);
+            }
+        }
+    }
+
+    void RenderQueue::UpdateHierarchy() {
+        hierarchyCurrent = true;
+
+        std::vector<uint32_t> drawItems(draws.size());
+        std::unordered_map<const Mesh *, size_t> seen;
+        bool rebuild = false;
+        for (size_t i = 0; i < draws.size() && !rebuild; i++) {
+            size_t occurrence = seen[draws[i].mesh]++;
+            std::unordered_map<const Mesh *, std::vector<uint32_t> >::const_iterator it = meshItems.find(draws[i].mesh);
+            if (it == meshItems.end() || occurrence >= it->second.size()) {
+                rebuild = true;
+            } else {
+                drawItems[i] = it->second[occurrence];
+            }
+        }
+
+        if (rebuild) {
+            std::vector<BoundingBox> boxes(draws.size());
+            meshItems.clear();
+            for (size_t i = 0; i < draws.size(); i++) {
+                boxes[i] = culler.getBounds(i);
+                meshItems[draws[i].mesh].push_back((uint32_t)i);
+                drawItems[i] = (uint32_t)i;
+            }
+            hierarchy.Build(boxes);
+        } else {
+            // static meshes land on the same box every frame and are left alone
+            std::vector<uint8_t> claimed(hierarchy.getItemCount(), 0);
+            for (size_t i = 0; i < draws.size(); i++) {
+                uint32_t item = drawItems[i];
+                claimed[item] = 1;
+                BoundingBox box = culler.getBounds(i);
+                const BoundingBox &current = hierarchy.getItemBounds(item);
+                if (box.min != current.min || box.max != current.max) {
+                    hierarchy.Update(item, box);
+                }
+            }
+            // meshes not queued this frame (e.g. the hidden rabbit) keep their item, emptied
+            for (uint32_t item = 0; item < claimed.size(); item++) {
+                if (!claimed[item] && !Bvh::IsEmpty(hierarchy.getItemBounds(item))) {
+                    hierarchy.Update(item, Bvh::EmptyBox());
+                }
+            }
+        }
+
+        itemDraws.assign(hierarchy.getItemCount(), NO_DRAW);
+        for (size_t i = 0; i < draws.size(); i++) {
+            itemDraws[drawItems[i]] = (uint32_t)i;
+        }
+    }
+
+    size_t RenderQueue::getPacketCount(RenderPassId pass) const {
+        return queued[pass].size();
+    }
+
+    size_t RenderQueue::getCulledCount(RenderPassId pass) const {
+        return culled[pass];
+    }
+
+    size_t RenderQueue::getOccludedCount(RenderPassId pass) const {
+        return occluded[pass];
+    }
+
+    size_t RenderQueue::getUploadStalls() const {
+        return drawBuffer.getStalls();
+    }
+
+    const Bvh &RenderQueue::getHierarchy() const {
+        return hierarchy;
+    }
+
+}
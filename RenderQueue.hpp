@@ -0,0 +1,138 @@
+#ifndef RenderQueue_hpp
+#define RenderQueue_hpp
+
+#include "Bvh.hpp"
+#include "FrustumCuller.hpp"
+#include "Model3D.hpp"
+#include "OcclusionCuller.hpp"
+#include "PotentiallyVisibleSet.hpp"
+#include "SceneUniforms.hpp"
+#include "RingBuffer.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+    // RENDER_PASS_DEPTH draws the shadow casters that move every frame, RENDER_PASS_STATIC_DEPTH
+    // the ones that only need drawing when the cached static shadow map is invalidated
+    enum RenderPassId {
+        RENDER_PASS_DEPTH = 0,
+        RENDER_PASS_MAIN = 1,
+        RENDER_PASS_STATIC_DEPTH = 2,
+        RENDER_PASS_COUNT = 3
+    };
+
+    const unsigned int RENDER_PASS_DEPTH_BIT = 1u << RENDER_PASS_DEPTH;
+    const unsigned int RENDER_PASS_MAIN_BIT = 1u << RENDER_PASS_MAIN;
+    const unsigned int RENDER_PASS_STATIC_DEPTH_BIT = 1u << RENDER_PASS_STATIC_DEPTH;
+    // moving objects: drawn and casting into the per-frame shadow map
+    const unsigned int RENDER_PASS_ALL_BITS = RENDER_PASS_DEPTH_BIT | RENDER_PASS_MAIN_BIT;
+    // static objects: drawn and casting into the cached shadow map
+    const unsigned int RENDER_PASS_STATIC_BITS = RENDER_PASS_STATIC_DEPTH_BIT | RENDER_PASS_MAIN_BIT;
+
+    // How one pass draws the queued packets
+    struct RenderPass {
+        RenderPassId id = RENDER_PASS_MAIN;
+        gps::Shader shader;
+        // camera or light view; packets are sorted on their depth along it
+        glm::mat4 view = glm::mat4(1.0f);
+        // view depth range mapped, on a logarithmic scale, onto the depth buckets of the sort key
+        float nearDepth = 0.0f;
+        float farDepth = 1.0f;
+        // packets whose world bounds fall outside the frustum of cullMatrix (projection * view)
+        // are dropped by Sort
+        bool cull = false;
+        glm::mat4 cullMatrix = glm::mat4(1.0f);
+        // when set with a cell, meshes the set does not list for that cell are dropped before
+        // the frustum test
+        const PotentiallyVisibleSet *visibility = NULL;
+        int visibilityCell = -1;
+        // draws positions only, with no texture or material binding (Mesh::DrawDepth)
+        bool depthOnly = false;
+        // when set, packets left by the frustum test whose bounds are hidden in its depth buffer
+        // are dropped too; the buffer must be finished before Sort
+        const OcclusionCuller *occlusion = NULL;
+    };
+
+    // Meshes of the frame's objects collected into per-pass packets and submitted sorted on
+    // program, front-to-back depth bucket and material so consecutive draws share state
+    class RenderQueue {
+
+    public:
+        // fences the previous frame's draw records and drops its packets
+        void Clear();
+        // queues every mesh of the model for the passes in passMask
+        void Add(Model3D &model, const glm::mat4 &transform, int fogEnabled, unsigned int passMask = RENDER_PASS_ALL_BITS);
+        // writes the DrawBlock of every queued mesh into the frame's region of the ring buffer;
+        // normal matrices are computed against the camera view
+        void Upload(const glm::mat4 &view);
+        // culls the queued packets of the pass through the hierarchy, then builds their keys from
+        // its view and sorts them; a pass may be sorted again with another view or frustum (e.g.
+        // one per shadow cascade), each Sort starting from every queued packet
+        void Sort(const RenderPass &pass);
+        // draws the packets of the pass in key order, binding each draw's block range
+        void Submit(const RenderPass &pass);
+
+        size_t getPacketCount(RenderPassId pass) const;
+        // packets the last Sort of the pass dropped as outside its frustum
+        size_t getCulledCount(RenderPassId pass) const;
+        // packets the last Sort of the pass dropped as occluded
+        size_t getOccludedCount(RenderPassId pass) const;
+        // frames whose upload waited for the GPU
+        size_t getUploadStalls() const;
+        // tree over the world bounds of the queued meshes as of the last culled Sort
+        const Bvh &getHierarchy() const;
+
+    private:
+        struct Object {
+            glm::mat4 transform;
+            int fogEnabled;
+        };
+
+        // one mesh of one object, shared by the packets of every pass
+        struct Draw {
+            Mesh *mesh;
+            uint32_t object;
+        };
+
+        struct Packet {
+            // program | depth bucket | material, see MakeKey
+            uint64_t key;
+            uint32_t draw;
+        };
+
+        std::vector<Object> objects;
+        std::vector<Draw> draws;
+        // packets queued for each pass, and those the last Sort of the pass kept, in key order
+        std::vector<Packet> queued[RENDER_PASS_COUNT];
+        std::vector<Packet> packets[RENDER_PASS_COUNT];
+        // world bounds of the draws, by draw index
+        FrustumCuller culler;
+        std::vector<uint8_t> visible;
+        size_t culled[RENDER_PASS_COUNT] = {};
+        size_t occluded[RENDER_PASS_COUNT] = {};
+        // tree over the draws' world bounds, kept across frames: items are matched to the draws
+        // by mesh and order of appearance, so only the boxes that moved are refit
+        Bvh hierarchy;
+        std::unordered_map<const Mesh *, std::vector<uint32_t> > meshItems;
+        // draw of each item this frame
+        std::vector<uint32_t> itemDraws;
+        std::vector<uint32_t> hierarchyHits;
+        bool hierarchyCurrent = false;
+        // DrawUniforms records spaced by the uniform buffer offset alignment
+        RingBuffer drawBuffer;
+        GLintptr drawOffset = 0;
+        GLsizeiptr drawStride = 0;
+        bool uploaded = false;
+
+        // refits the hierarchy to this frame's draws, rebuilding it when a draw has no item
+        void UpdateHierarchy();
+    };
+
+}
+
+#endif /* RenderQueue_hpp */
@@ -0,0 +1,101 @@
+#include "RingBuffer.hpp"
+#include "GLState.hpp"
+
+namespace gps {
+
+    namespace {
+
+        // buffer sizes are rounded up so small growth does not reallocate every frame
+        const GLsizeiptr REGION_GRANULARITY = 16 * 1024;
+        const GLuint64 WAIT_TIMEOUT_NS = 1000000;
+    }
+
+    RingBuffer::RingBuffer(GLenum target, int regionCount) {
+        this->target = target;
+        id = 0;
+        regionSize = 0;
+        current = regionCount - 1;
+        fences.assign(regionCount, (GLsync)0);
+        stalls = 0;
+    }
+
+    void *RingBuffer::Map(GLsizeiptr size) {
+        if (size > regionSize) {
+            Allocate((size + REGION_GRANULARITY - 1) / REGION_GRANULARITY * REGION_GRANULARITY);
+        }
+        current = (current + 1) % (int)fences.size();
+        WaitFor(current);
+
+        glBindBuffer(target, id);
+        // the fence guarantees the GPU is done with the region, no driver synchronization needed
+        return glMapBufferRange(target, current * regionSize, size,
+                                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    }
+
+    GLintptr RingBuffer::Unmap() {
+        glBindBuffer(target, id);
+        glUnmapBuffer(target);
+        glBindBuffer(target, 0);
+        return current * regionSize;
+    }
+
+    void RingBuffer::Fence() {
+        if (id == 0) {
+            return;
+        }
+        if (fences[current]) {
+            glDeleteSync(fences[current]);
+        }
+        fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    void RingBuffer::Destroy() {
+        for (size_t i = 0; i < fences.size(); i++) {
+            if (fences[i]) {
+                glDeleteSync(fences[i]);
+                fences[i] = 0;
+            }
+        }
+        if (id != 0) {
+            glDeleteBuffers(1, &id);
+            GLState::OnBufferDeleted(id);
+        }
+        id = 0;
+        regionSize = 0;
+    }
+
+    GLuint RingBuffer::getId() const {
+        return id;
+    }
+
+    size_t RingBuffer::getStalls() const {
+        return stalls;
+    }
+
+    void RingBuffer::Allocate(GLsizeiptr size) {
+        // GL keeps the old storage alive until the commands reading it complete
+        Destroy();
+        regionSize = size;
+        glGenBuffers(1, &id);
+        glBindBuffer(target, id);
+        glBufferData(target, regionSize * (GLsizeiptr)fences.size(), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(target, 0);
+    }
+
+    void RingBuffer::WaitFor(int region) {
+        GLsync fence = fences[region];
+        if (!fence) {
+            return;
+        }
+        GLenum result = glClientWaitSync(fence, 0, 0);
+        if (result == GL_TIMEOUT_EXPIRED) {
+            stalls++;
+            do {
+                result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, WAIT_TIMEOUT_NS);
+            } while (result == GL_TIMEOUT_EXPIRED);
+        }
+        glDeleteSync(fence);
+        fences[region] = 0;
+    }
+
+}
@@ -0,0 +1,55 @@
+#ifndef RingBuffer_hpp
+#define RingBuffer_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <cstddef>
+#include <vector>
+
+namespace gps {
+
+    // GL buffer split into a few regions written in turn, one per frame. Each region is mapped
+    // unsynchronized and protected by a fence, so writing the current frame's data never waits
+    // for the GPU to finish reading the regions of the frames still in flight.
+    class RingBuffer {
+
+    public:
+        explicit RingBuffer(GLenum target = GL_UNIFORM_BUFFER, int regionCount = 3);
+
+        // waits for the next region's fence and maps size bytes of it for writing;
+        // regions grow, and the buffer is reallocated, when size does not fit
+        void *Map(GLsizeiptr size);
+        // unmaps the region and returns its offset in the buffer
+        GLintptr Unmap();
+        // fences the commands issued since Map, which read the current region
+        void Fence();
+        void Destroy();
+
+        GLuint getId() const;
+        // times Map had to block on a region the GPU was still reading
+        size_t getStalls() const;
+
+    private:
+        RingBuffer(const RingBuffer &);
+        RingBuffer &operator=(const RingBuffer &);
+
+        void Allocate(GLsizeiptr regionSize);
+        void WaitFor(int region);
+
+        GLenum target;
+        GLuint id;
+        GLsizeiptr regionSize;
+        int current;
+        std::vector<GLsync> fences;
+        size_t stalls;
+    };
+
+}
+
+#endif /* RingBuffer_hpp */
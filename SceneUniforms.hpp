@@ -0,0 +1,55 @@
+#ifndef SceneUniforms_hpp
+#define SceneUniforms_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+namespace gps {
+
+    // Binding points of the blocks, assigned to every program with Shader::bindUniformBlock
+    const GLuint FRAME_UNIFORMS_BINDING = 0;
+    const GLuint DRAW_UNIFORMS_BINDING = 1;
+
+    // layers of the cascaded shadow map the frame block has room for
+    const int MAX_SHADOW_CASCADES = 4;
+
+    // std140 mirror of FrameBlock in shaders/basic.vert, basic.frag and depth.vert.
+    // Everything here is fixed for the frame, eye-space values are transformed once on the CPU.
+    struct FrameUniforms {
+        glm::mat4 view;
+        glm::mat4 projection;
+        // world to the light space of each shadow cascade
+        glm::mat4 lightSpaceTrMatrix[MAX_SHADOW_CASCADES];
+        glm::vec4 lightDirEye;          // xyz: normalized direction towards the light
+        glm::vec4 lightColor;           // rgb
+        glm::vec4 spotPosEye[2];        // xyz
+        glm::vec4 spotDirEye[2];        // xyz: normalized, w: cosine of the cutoff angle
+        glm::vec4 spotAttenuation[2];   // constant, linear, quadratic, intensity
+        glm::vec4 fogColor;             // rgb, a: density
+        glm::vec4 fogCenter;            // xyz: world-space center, w: animation time
+        glm::vec4 fogInvRadius2;        // 1/r^2 along x, z, y below and y above the center
+        glm::vec4 cascadeSplits;        // far view distance of each cascade, 0 for unused ones
+    };
+
+    // std140 mirror of DrawBlock; one instance per queued mesh, bound by range for its draw
+    struct DrawUniforms {
+        glm::mat4 model;
+        glm::mat4 normalMatrix;         // upper 3x3: inverse transpose of view * model
+        glm::vec4 materialDiffuse;      // rgb
+        GLint flags[4];                 // x: fog enabled, y: has diffuse texture, z: has specular texture,
+                                        // w: first instance transform, -1 when not instanced
+    };
+
+    static_assert(sizeof(FrameUniforms) == (2 + MAX_SHADOW_CASCADES) * 64 + 12 * 16, "FrameUniforms must match the std140 layout of FrameBlock");
+    static_assert(sizeof(DrawUniforms) == 2 * 64 + 2 * 16, "DrawUniforms must match the std140 layout of DrawBlock");
+
+}
+
+#endif /* SceneUniforms_hpp */
@@ -7,6 +7,9 @@
 //
 
 #include "Shader.hpp"
+#include "GLState.hpp"
+
+#include <cstring>
 
 namespace gps
 {
@@ -93,11 +96,227 @@ namespace gps
         glDeleteShader(fragmentShader);
         // check linking info
         shaderLinkLog(this->shaderProgram);
+
+        reflectUniforms();
     }
 
     void Shader::useShaderProgram()
     {
-        glUseProgram(this->shaderProgram);
+        GLState::UseProgram(this->shaderProgram);
+    }
+
+    void Shader::reflectUniforms()
+    {
+
+        std::shared_ptr<UniformTable> table = std::make_shared<UniformTable>();
+
+        GLint uniformCount = 0;
+        GLint maxNameLength = 0;
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORMS, &uniformCount);
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+        std::vector<GLchar> nameBuffer(maxNameLength > 0 ? maxNameLength : 1);
+
+        for (GLint i = 0; i < uniformCount; i++)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(this->shaderProgram, (GLuint)i, (GLsizei)nameBuffer.size(), &length, &size, &type, &nameBuffer[0]);
+
+            // members of uniform blocks are fed from buffers, not glUniform*
+            GLuint index = (GLuint)i;
+            GLint blockIndex = -1;
+            glGetActiveUniformsiv(this->shaderProgram, 1, &index, GL_UNIFORM_BLOCK_INDEX, &blockIndex);
+            if (blockIndex != -1)
+            {
+                continue;
+            }
+
+            std::string name(&nameBuffer[0], length);
+            bool isArray = name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0;
+            if (isArray)
+            {
+                name.erase(name.size() - 3);
+            }
+
+            for (GLint element = 0; element < size; element++)
+            {
+                std::string elementName = isArray ? name + "[" + std::to_string(element) + "]" : name;
+
+                UniformSlot slot;
+                slot.location = glGetUniformLocation(this->shaderProgram, elementName.c_str());
+                slot.type = type;
+                slot.hasValue = false;
+                table->slots.push_back(slot);
+
+                int slotIndex = (int)table->slots.size() - 1;
+                table->slotsByName[elementName] = slotIndex;
+                if (element == 0)
+                {
+                    table->slotsByName[name] = slotIndex;
+                }
+            }
+        }
+
+        GLint blockCount = 0;
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORM_BLOCKS, &blockCount);
+        for (GLint i = 0; i < blockCount; i++)
+        {
+            GLint nameLength = 0;
+            glGetActiveUniformBlockiv(this->shaderProgram, (GLuint)i, GL_UNIFORM_BLOCK_NAME_LENGTH, &nameLength);
+            std::vector<GLchar> blockName(nameLength > 0 ? nameLength : 1);
+            GLsizei length = 0;
+            glGetActiveUniformBlockName(this->shaderProgram, (GLuint)i, (GLsizei)blockName.size(), &length, &blockName[0]);
+
+            UniformBlock block;
+            block.index = (GLuint)i;
+            block.size = 0;
+            glGetActiveUniformBlockiv(this->shaderProgram, (GLuint)i, GL_UNIFORM_BLOCK_DATA_SIZE, &block.size);
+            table->blocks[std::string(&blockName[0], length)] = block;
+        }
+
+        this->uniforms = table;
+    }
+
+    int Shader::findSlot(const std::string &name, GLenum kind) const
+    {
+
+        if (!this->uniforms)
+        {
+            return -1;
+        }
+        std::unordered_map<std::string, int>::const_iterator it = this->uniforms->slotsByName.find(name);
+        if (it == this->uniforms->slotsByName.end())
+        {
+            return -1;
+        }
+
+        GLenum type = this->uniforms->slots[it->second].type;
+        bool matches = (type == kind);
+        if (kind == GL_INT)
+        {
+            // glUniform1i also sets bools and samplers
+            matches = matches || type == GL_BOOL || type == GL_SAMPLER_2D || type == GL_SAMPLER_3D ||
+                      type == GL_SAMPLER_CUBE || type == GL_SAMPLER_2D_SHADOW || type == GL_SAMPLER_2D_ARRAY ||
+                      type == GL_SAMPLER_2D_ARRAY_SHADOW || type == GL_SAMPLER_CUBE_SHADOW ||
+                      type == GL_SAMPLER_BUFFER;
+        }
+        return matches ? it->second : -1;
+    }
+
+    GLint Shader::getUniformLocation(const std::string &name) const
+    {
+
+        if (!this->uniforms)
+        {
+            return -1;
+        }
+        std::unordered_map<std::string, int>::const_iterator it = this->uniforms->slotsByName.find(name);
+        return it != this->uniforms->slotsByName.end() ? this->uniforms->slots[it->second].location : -1;
+    }
+
+    GLuint Shader::getUniformBlockIndex(const std::string &name) const
+    {
+
+        if (!this->uniforms)
+        {
+            return GL_INVALID_INDEX;
+        }
+        std::unordered_map<std::string, UniformBlock>::const_iterator it = this->uniforms->blocks.find(name);
+        return it != this->uniforms->blocks.end() ? it->second.index : GL_INVALID_INDEX;
+    }
+
+    GLint Shader::getUniformBlockSize(const std::string &name) const
+    {
+
+        if (!this->uniforms)
+        {
+            return 0;
+        }
+        std::unordered_map<std::string, UniformBlock>::const_iterator it = this->uniforms->blocks.find(name);
+        return it != this->uniforms->blocks.end() ? it->second.size : 0;
+    }
+
+    void Shader::bindUniformBlock(const std::string &name, GLuint bindingPoint)
+    {
+
+        GLuint index = getUniformBlockIndex(name);
+        if (index != GL_INVALID_INDEX)
+        {
+            glUniformBlockBinding(this->shaderProgram, index, bindingPoint);
+        }
+    }
+
+    GLint Shader::updateSlot(int slot, const void *value, size_t size)
+    {
+
+        if (slot < 0 || !this->uniforms)
+        {
+            return -1;
+        }
+        UniformSlot &current = this->uniforms->slots[slot];
+        if (current.hasValue && std::memcmp(current.value, value, size) == 0)
+        {
+            this->uniforms->skippedUploads++;
+            return -1;
+        }
+        std::memcpy(current.value, value, size);
+        current.hasValue = true;
+        return current.location;
+    }
+
+    void Shader::setUniform(Uniform<int> handle, int value)
+    {
+        GLint location = updateSlot(handle.slot, &value, sizeof(value));
+        if (location != -1)
+            glProgramUniform1i(this->shaderProgram, location, value);
+    }
+
+    void Shader::setUniform(Uniform<float> handle, float value)
+    {
+        GLint location = updateSlot(handle.slot, &value, sizeof(value));
+        if (location != -1)
+            glProgramUniform1f(this->shaderProgram, location, value);
+    }
+
+    void Shader::setUniform(Uniform<glm::vec2> handle, const glm::vec2 &value)
+    {
+        GLint location = updateSlot(handle.slot, &value, sizeof(value));
+        if (location != -1)
+            glProgramUniform2fv(this->shaderProgram, location, 1, &value[0]);
+    }
+
+    void Shader::setUniform(Uniform<glm::vec3> handle, const glm::vec3 &value)
+    {
+        GLint location = updateSlot(handle.slot, &value, sizeof(value));
+        if (location != -1)
+            glProgramUniform3fv(this->shaderProgram, location, 1, &value[0]);
+    }
+
+    void Shader::setUniform(Uniform<glm::vec4> handle, const glm::vec4 &value)
+    {
+        GLint location = updateSlot(handle.slot, &value, sizeof(value));
+        if (location != -1)
+            glProgramUniform4fv(this->shaderProgram, location, 1, &value[0]);
+    }
+
+    void Shader::setUniform(Uniform<glm::mat3> handle, const glm::mat3 &value)
+    {
+        GLint location = updateSlot(handle.slot, &value, sizeof(value));
+        if (location != -1)
+            glProgramUniformMatrix3fv(this->shaderProgram, location, 1, GL_FALSE, &value[0][0]);
+    }
+
+    void Shader::setUniform(Uniform<glm::mat4> handle, const glm::mat4 &value)
+    {
+        GLint location = updateSlot(handle.slot, &value, sizeof(value));
+        if (location != -1)
+            glProgramUniformMatrix4fv(this->shaderProgram, location, 1, GL_FALSE, &value[0][0]);
+    }
+
+    size_t Shader::getSkippedUploads() const
+    {
+        return this->uniforms ? this->uniforms->skippedUploads : 0;
     }
 
 }
@@ -17,25 +17,104 @@
     #include <GL/glew.h>
 #endif
 
+#include <glm/glm.hpp>
+
 #include <fstream>
+#include <memory>
 #include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 
 namespace gps {
-    
+
+    // Typed handle to an active uniform of one Shader; invalid when the program
+    // does not use the name or declares it with another type
+    template <typename T>
+    struct Uniform {
+        int slot = -1;
+        bool isValid() const { return slot >= 0; }
+    };
+
+    // GL type a handle type binds to; int also covers bool and sampler uniforms
+    template <typename T> struct UniformKind;
+    template <> struct UniformKind<int> { static const GLenum value = GL_INT; };
+    template <> struct UniformKind<float> { static const GLenum value = GL_FLOAT; };
+    template <> struct UniformKind<glm::vec2> { static const GLenum value = GL_FLOAT_VEC2; };
+    template <> struct UniformKind<glm::vec3> { static const GLenum value = GL_FLOAT_VEC3; };
+    template <> struct UniformKind<glm::vec4> { static const GLenum value = GL_FLOAT_VEC4; };
+    template <> struct UniformKind<glm::mat3> { static const GLenum value = GL_FLOAT_MAT3; };
+    template <> struct UniformKind<glm::mat4> { static const GLenum value = GL_FLOAT_MAT4; };
+
     class Shader {
 
     public:
         GLuint shaderProgram;
         void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName);
         void useShaderProgram();
-    
+
+        // O(1) lookup in the table built after linking; array elements are listed as "name[i]",
+        // and "name" alone refers to element 0
+        template <typename T>
+        Uniform<T> getUniform(const std::string &name) const {
+            Uniform<T> handle;
+            handle.slot = findSlot(name, UniformKind<T>::value);
+            return handle;
+        }
+        GLint getUniformLocation(const std::string &name) const;
+        // GL_INVALID_INDEX when the program has no such block
+        GLuint getUniformBlockIndex(const std::string &name) const;
+        GLint getUniformBlockSize(const std::string &name) const;
+        // assigns the block to an indexed binding point; ignored when the program lacks the block
+        void bindUniformBlock(const std::string &name, GLuint bindingPoint);
+
+        // Upload only when the value differs from the last one set through this program's table;
+        // the program does not need to be current. Invalid handles are ignored.
+        void setUniform(Uniform<int> handle, int value);
+        void setUniform(Uniform<float> handle, float value);
+        void setUniform(Uniform<glm::vec2> handle, const glm::vec2 &value);
+        void setUniform(Uniform<glm::vec3> handle, const glm::vec3 &value);
+        void setUniform(Uniform<glm::vec4> handle, const glm::vec4 &value);
+        void setUniform(Uniform<glm::mat3> handle, const glm::mat3 &value);
+        void setUniform(Uniform<glm::mat4> handle, const glm::mat4 &value);
+
+        // uploads skipped because the shadowed value was already current
+        size_t getSkippedUploads() const;
+
     private:
+        struct UniformSlot {
+            GLint location;
+            GLenum type;
+            bool hasValue;
+            // last uploaded value, large enough for a mat4
+            float value[16];
+        };
+
+        struct UniformBlock {
+            GLuint index;
+            GLint size;
+        };
+
+        // shared by copies of the Shader, which are passed around by value
+        struct UniformTable {
+            std::vector<UniformSlot> slots;
+            std::unordered_map<std::string, int> slotsByName;
+            std::unordered_map<std::string, UniformBlock> blocks;
+            size_t skippedUploads = 0;
+        };
+        std::shared_ptr<UniformTable> uniforms;
+
         std::string readShaderFile(std::string fileName);
         void shaderCompileLog(GLuint shaderId);
         void shaderLinkLog(GLuint shaderProgramId);
+        // enumerates the active uniforms and uniform blocks of the linked program
+        void reflectUniforms();
+        int findSlot(const std::string &name, GLenum kind) const;
+        // stores the value and returns the location when it has to be uploaded, -1 otherwise
+        GLint updateSlot(int slot, const void *value, size_t size);
     };
-    
+
 }
 
 #endif /* Shader_hpp */
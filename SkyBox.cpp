@@ -1,5 +1,6 @@
 #include "SkyBox.hpp"
-#include "stb_image.h"
+#include "TextureDecoder.hpp"
+#include "GLState.hpp"
 
 namespace gps {
 
@@ -8,6 +9,7 @@ SkyBox::SkyBox()
     skyboxVAO = 0;
     skyboxVBO = 0;
     cubemapTexture = 0;
+    uniformProgram = 0;
 }
 
 void SkyBox::Load(const std::vector<const GLchar*> &cubeMapFaces)
@@ -20,53 +22,59 @@ void SkyBox::Draw(gps::Shader shader, glm::mat4 viewMatrix, glm::mat4 projection
 {
     shader.useShaderProgram();
 
+    if (uniformProgram != shader.shaderProgram) {
+        viewUniform = shader.getUniform<glm::mat4>("view");
+        projectionUniform = shader.getUniform<glm::mat4>("projection");
+        skyboxUniform = shader.getUniform<int>("skybox");
+        uniformProgram = shader.shaderProgram;
+    }
+
     // set the view and projection matrices
     glm::mat4 transformedView = glm::mat4(glm::mat3(viewMatrix));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(transformedView));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projectionMatrix));
+    shader.setUniform(viewUniform, transformedView);
+    shader.setUniform(projectionUniform, projectionMatrix);
 
-    glDepthFunc(GL_LEQUAL);
+    GLState::DepthFunc(GL_LEQUAL);
 
-    glBindVertexArray(skyboxVAO);
-    glActiveTexture(GL_TEXTURE0);
-    glUniform1i(glGetUniformLocation(shader.shaderProgram, "skybox"), 0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+    GLState::BindVertexArray(skyboxVAO);
+    shader.setUniform(skyboxUniform, 0);
+    GLState::BindTexture(0, GL_TEXTURE_CUBE_MAP, cubemapTexture);
     glDrawArrays(GL_TRIANGLES, 0, 36);
-    glBindVertexArray(0);
 
-    glDepthFunc(GL_LESS);
+    GLState::DepthFunc(GL_LESS);
 }
 
 GLuint SkyBox::LoadSkyBoxTextures(const std::vector<const GLchar*> &skyBoxFaces)
 {
-    GLuint textureID;
-    glGenTextures(1, &textureID);
-    glActiveTexture(GL_TEXTURE0);
-
-    int width,height, n;
-    unsigned char* image;
-    int force_channels = 3;
-
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-    for(GLuint i = 0; i < skyBoxFaces.size(); i++)
-    {
-        image = stbi_load(skyBoxFaces[i], &width, &height, &n, force_channels);
-        if (!image) {
+    // decode all faces in parallel before touching GL; cube map faces are not flipped
+    std::vector<std::string> fileNames(skyBoxFaces.begin(), skyBoxFaces.end());
+    std::vector<ImageData> faces = TextureDecoder::DecodeAll(fileNames, 3, false);
+    for (size_t i = 0; i < faces.size(); i++) {
+        if (!faces[i].pixels) {
             // failed to load skybox face
             return 0;
         }
+    }
+
+    GLuint textureID;
+    glGenTextures(1, &textureID);
+    GLState::BindTexture(0, GL_TEXTURE_CUBE_MAP, textureID);
+    // RGB rows are tightly packed
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for(GLuint i = 0; i < faces.size(); i++)
+    {
         glTexImage2D(
                      GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0,
-                     GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image
+                     GL_RGB, faces[i].width, faces[i].height, 0, GL_RGB, GL_UNSIGNED_BYTE, faces[i].pixels.get()
                      );
-        stbi_image_free(image);
     }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    GLState::BindTexture(0, GL_TEXTURE_CUBE_MAP, 0);
 
     return textureID;
 }
@@ -120,14 +128,14 @@ void SkyBox::InitSkyBox()
     glGenVertexArrays(1, &(this->skyboxVAO));
     glGenBuffers(1, &skyboxVBO);
 
-    glBindVertexArray(skyboxVAO);
+    GLState::BindVertexArray(skyboxVAO);
     glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
 
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
 
-    glBindVertexArray(0);
+    GLState::BindVertexArray(0);
 }
 
 GLuint SkyBox::GetTextureId()
@@ -27,6 +27,11 @@ namespace gps {
         GLuint skyboxVAO;
         GLuint skyboxVBO;
         GLuint cubemapTexture;
+        // uniform handles, resolved for the program they were looked up in
+        GLuint uniformProgram;
+        gps::Uniform<glm::mat4> viewUniform;
+        gps::Uniform<glm::mat4> projectionUniform;
+        gps::Uniform<int> skyboxUniform;
         GLuint LoadSkyBoxTextures(const std::vector<const GLchar*> &cubeMapFaces);
         void InitSkyBox();
     };
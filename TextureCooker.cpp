@@ -0,0 +1,449 @@
+#include "TextureCooker.hpp"
+#include "ThreadPool.hpp"
+#include "GLState.hpp"
+
+#include <sys/stat.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+namespace gps {
+
+    namespace {
+
+        const unsigned char KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+        const uint32_t KTX_ENDIANNESS = 0x04030201;
+        // key/value entry holding the source stamp; bump the version whenever cooking changes
+        const char STAMP_KEY[] = "GPSsource";
+        const int COOK_VERSION = 1;
+
+        struct KtxHeader {
+            unsigned char identifier[12];
+            uint32_t endianness;
+            uint32_t glType;
+            uint32_t glTypeSize;
+            uint32_t glFormat;
+            uint32_t glInternalFormat;
+            uint32_t glBaseInternalFormat;
+            uint32_t pixelWidth;
+            uint32_t pixelHeight;
+            uint32_t pixelDepth;
+            uint32_t numberOfArrayElements;
+            uint32_t numberOfFaces;
+            uint32_t numberOfMipmapLevels;
+            uint32_t bytesOfKeyValueData;
+        };
+
+        size_t Align4(size_t offset) {
+            return (offset + 3) & ~(size_t)3;
+        }
+
+        // identifies the source file the texture was cooked from
+        bool SourceStamp(const std::string &fileName, std::string &stamp) {
+            struct stat fileInfo;
+            if (stat(fileName.c_str(), &fileInfo) != 0) {
+                return false;
+            }
+            char text[64];
+            snprintf(text, sizeof(text), "%d %llu %lld", COOK_VERSION,
+                     (unsigned long long)fileInfo.st_size, (long long)fileInfo.st_mtime);
+            stamp = text;
+            return true;
+        }
+
+        const float *SrgbToLinearTable() {
+            static std::vector<float> table;
+            static std::once_flag built;
+            std::call_once(built, []() {
+                table.resize(256);
+                for (int i = 0; i < 256; i++) {
+                    float c = i / 255.0f;
+                    table[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+                }
+            });
+            return &table[0];
+        }
+
+        // linear values quantized to 12 bits, enough to round-trip every 8-bit sRGB value
+        const unsigned char *LinearToSrgbTable() {
+            static std::vector<unsigned char> table;
+            static std::once_flag built;
+            std::call_once(built, []() {
+                table.resize(4096);
+                for (int i = 0; i < 4096; i++) {
+                    float l = i / 4095.0f;
+                    float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+                    table[i] = (unsigned char)(c * 255.0f + 0.5f);
+                }
+            });
+            return &table[0];
+        }
+
+        bool DriverCompressesS3TC() {
+            static int supported = -1;
+            if (supported < 0) {
+                bool s3tc = false, srgb = false;
+                GLint count = 0;
+                glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+                for (GLint i = 0; i < count; i++) {
+                    const char *name = (const char *)glGetStringi(GL_EXTENSIONS, i);
+                    if (!name) {
+                        continue;
+                    }
+                    s3tc = s3tc || std::strcmp(name, "GL_EXT_texture_compression_s3tc") == 0;
+                    srgb = srgb || std::strcmp(name, "GL_EXT_texture_sRGB") == 0;
+                }
+                supported = (s3tc && srgb) ? 1 : 0;
+            }
+            return supported == 1;
+        }
+
+    }
+
+    size_t CookedTexture::byteSize() const {
+        size_t bytes = 0;
+        for (size_t i = 0; i < levels.size(); i++) {
+            bytes += levels[i].size;
+        }
+        return bytes;
+    }
+
+    CookedTexture TextureCooker::Load(const std::string &fileName) {
+        CookedTexture texture;
+        if (!Read(fileName, texture)) {
+            // RGBA8, flipped for GL; the cooked levels keep that orientation
+            texture = Cook(TextureDecoder::Decode(fileName, 4, true));
+            if (!texture.levels.empty()) {
+                Write(fileName, texture);
+            }
+        }
+        texture.sourcePath = fileName;
+        return texture;
+    }
+
+    CookedTexture TextureCooker::Cook(const ImageData &image) {
+        CookedTexture texture;
+        if (!image.pixels || image.channels != 4) {
+            return texture;
+        }
+
+        int width = image.width;
+        int height = image.height;
+        const unsigned char *pixels = image.pixels.get();
+        size_t pixelCount = (size_t)width * (size_t)height;
+
+        bool opaque = true;
+        for (size_t i = 0; i < pixelCount && opaque; i++) {
+            opaque = pixels[i * 4 + 3] == 255;
+        }
+        int channels = opaque ? 3 : 4;
+        texture.format = opaque ? GL_RGB : GL_RGBA;
+        texture.internalFormat = opaque ? GL_SRGB8 : GL_SRGB8_ALPHA8;
+        texture.data = std::make_shared<std::vector<unsigned char> >();
+
+        // filter in linear space so the smaller levels do not darken; alpha is already linear
+        const float *toLinear = SrgbToLinearTable();
+        const unsigned char *toSrgb = LinearToSrgbTable();
+        std::vector<float> linear(pixelCount * 4);
+        for (size_t i = 0; i < pixelCount; i++) {
+            linear[i * 4 + 0] = toLinear[pixels[i * 4 + 0]];
+            linear[i * 4 + 1] = toLinear[pixels[i * 4 + 1]];
+            linear[i * 4 + 2] = toLinear[pixels[i * 4 + 2]];
+            linear[i * 4 + 3] = pixels[i * 4 + 3] / 255.0f;
+        }
+
+        std::vector<float> smaller;
+        while (true) {
+            CookedLevel level;
+            level.width = width;
+            level.height = height;
+            size_t rowBytes = Align4((size_t)width * channels);
+            level.offset = texture.data->size();
+            level.size = rowBytes * height;
+            texture.data->resize(level.offset + level.size, 0);
+
+            for (int y = 0; y < height; y++) {
+                unsigned char *row = &(*texture.data)[level.offset + y * rowBytes];
+                const float *src = &linear[(size_t)y * width * 4];
+                for (int x = 0; x < width; x++) {
+                    for (int c = 0; c < 3; c++) {
+                        row[x * channels + c] = toSrgb[(int)(src[x * 4 + c] * 4095.0f + 0.5f)];
+                    }
+                    if (channels == 4) {
+                        row[x * 4 + 3] = (unsigned char)(src[x * 4 + 3] * 255.0f + 0.5f);
+                    }
+                }
+            }
+            texture.levels.push_back(level);
+
+            if (width == 1 && height == 1) {
+                break;
+            }
+
+            // 2x2 box filter, clamped at the edges of odd-sized levels
+            int nextWidth = width > 1 ? width / 2 : 1;
+            int nextHeight = height > 1 ? height / 2 : 1;
+            smaller.assign((size_t)nextWidth * nextHeight * 4, 0.0f);
+            for (int y = 0; y < nextHeight; y++) {
+                int y0 = y * 2;
+                int y1 = y0 + 1 < height ? y0 + 1 : y0;
+                for (int x = 0; x < nextWidth; x++) {
+                    int x0 = x * 2;
+                    int x1 = x0 + 1 < width ? x0 + 1 : x0;
+                    float *dst = &smaller[((size_t)y * nextWidth + x) * 4];
+                    const float *a = &linear[((size_t)y0 * width + x0) * 4];
+                    const float *b = &linear[((size_t)y0 * width + x1) * 4];
+                    const float *c = &linear[((size_t)y1 * width + x0) * 4];
+                    const float *d = &linear[((size_t)y1 * width + x1) * 4];
+                    for (int k = 0; k < 4; k++) {
+                        dst[k] = (a[k] + b[k] + c[k] + d[k]) * 0.25f;
+                    }
+                }
+            }
+            linear.swap(smaller);
+            width = nextWidth;
+            height = nextHeight;
+        }
+
+        return texture;
+    }
+
+    bool TextureCooker::Read(const std::string &fileName, CookedTexture &texture) {
+        std::string stamp;
+        if (!SourceStamp(fileName, stamp)) {
+            return false;
+        }
+
+        FILE *in = fopen(CookedPath(fileName).c_str(), "rb");
+        if (!in) {
+            return false;
+        }
+        std::shared_ptr<std::vector<unsigned char> > data = std::make_shared<std::vector<unsigned char> >();
+        fseek(in, 0, SEEK_END);
+        long fileSize = ftell(in);
+        fseek(in, 0, SEEK_SET);
+        if (fileSize > 0) {
+            data->resize((size_t)fileSize);
+            if (fread(&(*data)[0], 1, data->size(), in) != data->size()) {
+                data->clear();
+            }
+        }
+        fclose(in);
+
+        KtxHeader header;
+        if (data->size() < sizeof(header)) {
+            return false;
+        }
+        std::memcpy(&header, &(*data)[0], sizeof(header));
+        if (std::memcmp(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) != 0 ||
+            header.endianness != KTX_ENDIANNESS || header.pixelDepth != 0 ||
+            header.numberOfArrayElements != 0 || header.numberOfFaces != 1 || header.numberOfMipmapLevels == 0) {
+            return false;
+        }
+
+        // the stamp must match the source as it is now
+        size_t offset = sizeof(header);
+        size_t keyValueEnd = offset + header.bytesOfKeyValueData;
+        if (keyValueEnd > data->size()) {
+            return false;
+        }
+        bool fresh = false;
+        while (offset + sizeof(uint32_t) <= keyValueEnd) {
+            uint32_t pairSize;
+            std::memcpy(&pairSize, &(*data)[offset], sizeof(pairSize));
+            offset += sizeof(pairSize);
+            if (offset + pairSize > keyValueEnd) {
+                return false;
+            }
+            const char *pair = (const char *)&(*data)[offset];
+            size_t keyLength = strnlen(pair, pairSize);
+            if (keyLength < pairSize && std::strcmp(pair, STAMP_KEY) == 0) {
+                std::string value(pair + keyLength + 1, strnlen(pair + keyLength + 1, pairSize - keyLength - 1));
+                fresh = (value == stamp);
+            }
+            offset = Align4(offset + pairSize);
+        }
+        if (!fresh) {
+            return false;
+        }
+
+        offset = keyValueEnd;
+        int width = (int)header.pixelWidth;
+        int height = (int)header.pixelHeight;
+        std::vector<CookedLevel> levels;
+        for (uint32_t i = 0; i < header.numberOfMipmapLevels; i++) {
+            uint32_t imageSize;
+            if (offset + sizeof(imageSize) > data->size()) {
+                return false;
+            }
+            std::memcpy(&imageSize, &(*data)[offset], sizeof(imageSize));
+            offset += sizeof(imageSize);
+            if (offset + imageSize > data->size()) {
+                return false;
+            }
+
+            CookedLevel level;
+            level.width = width;
+            level.height = height;
+            level.offset = offset;
+            level.size = imageSize;
+            levels.push_back(level);
+
+            offset = Align4(offset + imageSize);
+            width = width > 1 ? width / 2 : 1;
+            height = height > 1 ? height / 2 : 1;
+        }
+
+        texture.internalFormat = header.glInternalFormat;
+        texture.format = header.glBaseInternalFormat;
+        texture.compressed = (header.glType == 0);
+        texture.levels = levels;
+        texture.data = data;
+        return true;
+    }
+
+    bool TextureCooker::Write(const std::string &fileName, const CookedTexture &texture) {
+        std::string stamp;
+        if (texture.levels.empty() || !SourceStamp(fileName, stamp)) {
+            return false;
+        }
+
+        std::vector<char> pair(STAMP_KEY, STAMP_KEY + sizeof(STAMP_KEY));
+        pair.insert(pair.end(), stamp.begin(), stamp.end());
+        pair.push_back('\0');
+        uint32_t pairSize = (uint32_t)pair.size();
+
+        KtxHeader header;
+        std::memcpy(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER));
+        header.endianness = KTX_ENDIANNESS;
+        header.glType = texture.compressed ? 0 : GL_UNSIGNED_BYTE;
+        header.glTypeSize = 1;
+        header.glFormat = texture.compressed ? 0 : texture.format;
+        header.glInternalFormat = texture.internalFormat;
+        header.glBaseInternalFormat = texture.format;
+        header.pixelWidth = (uint32_t)texture.levels[0].width;
+        header.pixelHeight = (uint32_t)texture.levels[0].height;
+        header.pixelDepth = 0;
+        header.numberOfArrayElements = 0;
+        header.numberOfFaces = 1;
+        header.numberOfMipmapLevels = (uint32_t)texture.levels.size();
+        header.bytesOfKeyValueData = (uint32_t)Align4(sizeof(pairSize) + pair.size());
+
+        // write to a temporary file first so a partially written texture is never picked up
+        std::string cookedPath = CookedPath(fileName);
+        std::string tempPath = cookedPath + ".tmp";
+        FILE *out = fopen(tempPath.c_str(), "wb");
+        if (!out) {
+            return false;
+        }
+
+        static const char zeros[4] = { 0, 0, 0, 0 };
+        fwrite(&header, sizeof(header), 1, out);
+        fwrite(&pairSize, sizeof(pairSize), 1, out);
+        fwrite(&pair[0], 1, pair.size(), out);
+        fwrite(zeros, 1, header.bytesOfKeyValueData - sizeof(pairSize) - pair.size(), out);
+        for (size_t i = 0; i < texture.levels.size(); i++) {
+            const CookedLevel &level = texture.levels[i];
+            uint32_t imageSize = (uint32_t)level.size;
+            fwrite(&imageSize, sizeof(imageSize), 1, out);
+            fwrite(&(*texture.data)[level.offset], 1, level.size, out);
+            fwrite(zeros, 1, Align4(level.size) - level.size, out);
+        }
+
+        bool ok = (ferror(out) == 0);
+        ok = (fclose(out) == 0) && ok;
+        if (!ok) {
+            remove(tempPath.c_str());
+            return false;
+        }
+
+        remove(cookedPath.c_str());
+        return rename(tempPath.c_str(), cookedPath.c_str()) == 0;
+    }
+
+    std::string TextureCooker::CookedPath(const std::string &fileName) {
+        return fileName + ".ktx";
+    }
+
+    GLuint TextureCooker::Upload(const CookedTexture &texture, size_t &gpuBytes) {
+        gpuBytes = 0;
+        if (texture.levels.empty()) {
+            return 0;
+        }
+
+        bool compress = !texture.compressed && DriverCompressesS3TC();
+        GLenum internalFormat = texture.internalFormat;
+        if (compress) {
+            internalFormat = texture.format == GL_RGB ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+                                                      : GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+        }
+
+        GLuint textureID;
+        glGenTextures(1, &textureID);
+        GLState::BindTexture(0, GL_TEXTURE_2D, textureID);
+        for (size_t i = 0; i < texture.levels.size(); i++) {
+            const CookedLevel &level = texture.levels[i];
+            const unsigned char *pixels = &(*texture.data)[level.offset];
+            if (texture.compressed) {
+                glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)i, internalFormat, level.width, level.height, 0,
+                                       (GLsizei)level.size, pixels);
+            } else {
+                glTexImage2D(GL_TEXTURE_2D, (GLint)i, internalFormat, level.width, level.height, 0,
+                             texture.format, GL_UNSIGNED_BYTE, pixels);
+            }
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)texture.levels.size() - 1);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        gpuBytes = texture.byteSize();
+
+        GLint isCompressed = GL_FALSE;
+        if (compress) {
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &isCompressed);
+        }
+        if (isCompressed) {
+            // read the driver's blocks back so later runs upload them directly
+            CookedTexture blocks;
+            blocks.sourcePath = texture.sourcePath;
+            blocks.internalFormat = internalFormat;
+            blocks.format = texture.format;
+            blocks.compressed = true;
+            blocks.data = std::make_shared<std::vector<unsigned char> >();
+            for (size_t i = 0; i < texture.levels.size(); i++) {
+                GLint size = 0;
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, (GLint)i, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+                CookedLevel level = texture.levels[i];
+                level.offset = blocks.data->size();
+                level.size = (size_t)size;
+                blocks.data->resize(level.offset + level.size);
+                if (level.size > 0) {
+                    glGetCompressedTexImage(GL_TEXTURE_2D, (GLint)i, &(*blocks.data)[level.offset]);
+                }
+                blocks.levels.push_back(level);
+            }
+            gpuBytes = blocks.byteSize();
+            ThreadPool::Shared().Submit([blocks]() {
+                return Write(blocks.sourcePath, blocks);
+            });
+        }
+        GLState::BindTexture(0, GL_TEXTURE_2D, 0);
+
+        return textureID;
+    }
+
+}
@@ -0,0 +1,66 @@
+#ifndef TextureCooker_hpp
+#define TextureCooker_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include "TextureDecoder.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // One mip level inside CookedTexture::data
+    struct CookedLevel {
+        int width = 0;
+        int height = 0;
+        size_t offset = 0;
+        size_t size = 0;
+    };
+
+    // Texture with its complete mip chain in the final GPU format
+    struct CookedTexture {
+        // source image the texture was cooked from
+        std::string sourcePath;
+        // GL_SRGB8, GL_SRGB8_ALPHA8 or a block-compressed sRGB format
+        GLenum internalFormat = 0;
+        // GL_RGB or GL_RGBA, also the base format of compressed textures
+        GLenum format = 0;
+        bool compressed = false;
+        std::vector<CookedLevel> levels;
+        // level data, uncompressed rows padded to 4 bytes as glTexImage2D expects by default
+        std::shared_ptr<std::vector<unsigned char> > data;
+
+        size_t byteSize() const;
+    };
+
+    // Cooks images into mip-complete KTX 1.1 files ("grass.jpg" -> "grass.jpg.ktx").
+    // A cooked file is only used while the size and modification time of its source match.
+    class TextureCooker {
+
+    public:
+        // CPU stage: reads the cooked file, or decodes the source, cooks it and writes the cooked file;
+        // returns a texture without levels if the image cannot be read
+        static CookedTexture Load(const std::string &fileName);
+        // builds the gamma-correct mip chain of a decoded RGBA8 image, dropping alpha when it is opaque
+        static CookedTexture Cook(const ImageData &image);
+        // read and write the cooked file belonging to the source image fileName
+        static bool Read(const std::string &fileName, CookedTexture &texture);
+        static bool Write(const std::string &fileName, const CookedTexture &texture);
+        static std::string CookedPath(const std::string &fileName);
+
+        // GL stage: uploads every level. Uncompressed textures are compressed by the driver when it
+        // supports S3TC, and the cooked file is rewritten in the background with the compressed levels.
+        static GLuint Upload(const CookedTexture &texture, size_t &gpuBytes);
+    };
+
+}
+
+#endif /* TextureCooker_hpp */
@@ -0,0 +1,62 @@
+#include "TextureDecoder.hpp"
+
+#include "stb_image.h"
+
+#include <cstring>
+
+namespace gps {
+
+    std::shared_future<ImageData> TextureDecoder::DecodeAsync(const std::string &fileName, int channels, bool flipVertically) {
+        return ThreadPool::Shared().Submit([fileName, channels, flipVertically]() {
+            return Decode(fileName, channels, flipVertically);
+        }).share();
+    }
+
+    std::vector<ImageData> TextureDecoder::DecodeAll(const std::vector<std::string> &fileNames, int channels, bool flipVertically) {
+        std::vector<std::shared_future<ImageData> > pending;
+        for (size_t i = 0; i < fileNames.size(); i++) {
+            pending.push_back(DecodeAsync(fileNames[i], channels, flipVertically));
+        }
+
+        std::vector<ImageData> images;
+        for (size_t i = 0; i < pending.size(); i++) {
+            images.push_back(pending[i].get());
+        }
+        return images;
+    }
+
+    ImageData TextureDecoder::Decode(const std::string &fileName, int channels, bool flipVertically) {
+        ImageData image;
+        int width, height, n;
+        unsigned char *pixels = stbi_load(fileName.c_str(), &width, &height, &n, channels);
+        if (!pixels) {
+            // decoding failed, pixels stays empty
+            return image;
+        }
+
+        if (flipVertically) {
+            FlipRows(pixels, width, height, channels);
+        }
+
+        image.width = width;
+        image.height = height;
+        image.channels = channels;
+        image.pixels = std::shared_ptr<unsigned char>(pixels, stbi_image_free);
+        return image;
+    }
+
+    // Swaps whole rows with memcpy instead of byte by byte
+    void TextureDecoder::FlipRows(unsigned char *pixels, int width, int height, int channels) {
+        size_t rowBytes = (size_t)width * (size_t)channels;
+        std::vector<unsigned char> temp(rowBytes);
+
+        for (int row = 0; row < height / 2; row++) {
+            unsigned char *top = pixels + row * rowBytes;
+            unsigned char *bottom = pixels + (height - row - 1) * rowBytes;
+            std::memcpy(&temp[0], top, rowBytes);
+            std::memcpy(top, bottom, rowBytes);
+            std::memcpy(bottom, &temp[0], rowBytes);
+        }
+    }
+
+}
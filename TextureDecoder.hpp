@@ -0,0 +1,39 @@
+#ifndef TextureDecoder_hpp
+#define TextureDecoder_hpp
+
+#include "ThreadPool.hpp"
+
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Pixel data decoded off the GL thread, ready for glTexImage2D
+    struct ImageData {
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        // tightly packed rows, flipped for GL when requested
+        std::shared_ptr<unsigned char> pixels;
+    };
+
+    // Decodes image files with stb_image on the shared thread pool
+    class TextureDecoder {
+
+    public:
+        // starts decoding the file; channels is forwarded to stbi_load as the forced channel count
+        static std::shared_future<ImageData> DecodeAsync(const std::string &fileName, int channels, bool flipVertically);
+        // decodes several files in parallel and waits for all of them
+        static std::vector<ImageData> DecodeAll(const std::vector<std::string> &fileNames, int channels, bool flipVertically);
+        // decodes on the calling thread
+        static ImageData Decode(const std::string &fileName, int channels, bool flipVertically);
+
+    private:
+        static void FlipRows(unsigned char *pixels, int width, int height, int channels);
+    };
+
+}
+
+#endif /* TextureDecoder_hpp */
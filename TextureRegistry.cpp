@@ -0,0 +1,163 @@
+#include "TextureRegistry.hpp"
+#include "MappedFile.hpp"
+#include "GLState.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+#if !defined(_WIN32)
+#include <climits>
+#endif
+
+namespace gps {
+
+    TextureRegistry &TextureRegistry::Shared() {
+        // never destroyed: models held in globals release their textures during static destruction
+        static TextureRegistry *registry = new TextureRegistry();
+        return *registry;
+    }
+
+    std::vector<TextureRegistry::Key> TextureRegistry::Prepare(const std::vector<std::string> &fileNames) {
+        std::vector<Key> keys(fileNames.size(), 0);
+        std::vector<std::shared_future<CookedTexture> > decoding;
+
+        for (size_t i = 0; i < fileNames.size(); i++) {
+            std::string path = CanonicalPath(fileNames[i]);
+
+            bool known = false;
+            {
+                std::lock_guard<std::mutex> lock(registryMutex);
+                std::unordered_map<std::string, Key>::iterator it = keysByPath.find(path);
+                if (it != keysByPath.end()) {
+                    keys[i] = it->second;
+                    known = true;
+                }
+            }
+            if (!known) {
+                // hashed outside the lock, a concurrent caller may do the same work but stores the same key
+                keys[i] = HashFile(fileNames[i]);
+                std::lock_guard<std::mutex> lock(registryMutex);
+                keysByPath[path] = keys[i];
+            }
+            if (keys[i] == 0) {
+                continue;
+            }
+
+            std::lock_guard<std::mutex> lock(registryMutex);
+            Entry &entry = entries[keys[i]];
+            if (!entry.uploaded && !entry.image.valid()) {
+                std::string fileName = fileNames[i];
+                entry.image = ThreadPool::Shared().Submit([fileName]() {
+                    return TextureCooker::Load(fileName);
+                }).share();
+            }
+            if (entry.image.valid()) {
+                decoding.push_back(entry.image);
+            }
+        }
+
+        for (size_t i = 0; i < decoding.size(); i++) {
+            decoding[i].wait();
+        }
+        return keys;
+    }
+
+    GLuint TextureRegistry::Acquire(Key key) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        std::unordered_map<Key, Entry>::iterator it = entries.find(key);
+        if (it == entries.end()) {
+            return 0;
+        }
+
+        Entry &entry = it->second;
+        if (!entry.uploaded) {
+            if (!entry.image.valid()) {
+                return 0;
+            }
+            entry.id = TextureCooker::Upload(entry.image.get(), entry.bytes);
+            entry.uploaded = true;
+            entry.image = std::shared_future<CookedTexture>();
+            if (entry.id != 0) {
+                keysById[entry.id] = key;
+            }
+        }
+
+        if (entry.id != 0) {
+            entry.refCount++;
+        }
+        return entry.id;
+    }
+
+    void TextureRegistry::Release(GLuint textureId) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        std::unordered_map<GLuint, Key>::iterator it = keysById.find(textureId);
+        if (it == keysById.end()) {
+            return;
+        }
+
+        Entry &entry = entries[it->second];
+        if (--entry.refCount == 0) {
+            glDeleteTextures(1, &entry.id);
+            GLState::OnTextureDeleted(entry.id);
+            entries.erase(it->second);
+            keysById.erase(it);
+        }
+    }
+
+    TextureRegistryStats TextureRegistry::getStats() {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        TextureRegistryStats stats;
+        for (std::unordered_map<Key, Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+            if (it->second.id == 0) {
+                continue;
+            }
+            stats.textures++;
+            stats.references += it->second.refCount;
+            stats.uploadedBytes += it->second.bytes;
+            // every reference past the first would otherwise hold its own copy
+            stats.savedBytes += (it->second.refCount - 1) * it->second.bytes;
+        }
+        return stats;
+    }
+
+    std::string TextureRegistry::CanonicalPath(const std::string &fileName) {
+#if defined(_WIN32)
+        char resolved[_MAX_PATH];
+        if (_fullpath(resolved, fileName.c_str(), _MAX_PATH)) {
+            return resolved;
+        }
+#else
+        char resolved[PATH_MAX];
+        if (realpath(fileName.c_str(), resolved)) {
+            return resolved;
+        }
+#endif
+        return fileName;
+    }
+
+    // FNV-1a over the file bytes, eight at a time
+    TextureRegistry::Key TextureRegistry::HashFile(const std::string &fileName) {
+        MappedFile file;
+        if (!file.Open(fileName)) {
+            return 0;
+        }
+
+        const uint64_t prime = 1099511628211ULL;
+        uint64_t hash = 14695981039346656037ULL ^ (uint64_t)file.size();
+        const char *data = file.data();
+        size_t size = file.size();
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, data + i, 8);
+            hash = (hash ^ word) * prime;
+        }
+        for (; i < size; i++) {
+            hash = (hash ^ (unsigned char)data[i]) * prime;
+        }
+
+        // 0 is reserved for unreadable files
+        return hash != 0 ? hash : 1;
+    }
+
+}
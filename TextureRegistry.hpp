@@ -0,0 +1,73 @@
+#ifndef TextureRegistry_hpp
+#define TextureRegistry_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include "TextureCooker.hpp"
+
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+    // Memory accounting of the registry
+    struct TextureRegistryStats {
+        size_t textures = 0;      // GL textures alive
+        size_t references = 0;    // outstanding Acquire calls
+        size_t uploadedBytes = 0; // VRAM of the live textures, mips included
+        size_t savedBytes = 0;    // VRAM one texture per reference would use on top of that
+    };
+
+    // Process-wide texture cache: every image file is decoded and uploaded once,
+    // whichever model references it and under whichever path
+    class TextureRegistry {
+
+    public:
+        // hash of the file contents, 0 when the file cannot be read
+        typedef uint64_t Key;
+
+        static TextureRegistry &Shared();
+
+        // CPU stage, thread-safe: resolves each file to its content key, loads the cooked
+        // textures not seen before and waits for them
+        std::vector<Key> Prepare(const std::vector<std::string> &fileNames);
+        // GL stage: returns the texture of a prepared key, uploading it on first use,
+        // and takes a reference to it; 0 if the image could not be decoded
+        GLuint Acquire(Key key);
+        // drops a reference, the texture is deleted with the last one
+        void Release(GLuint textureId);
+
+        TextureRegistryStats getStats();
+
+    private:
+        struct Entry {
+            GLuint id = 0;
+            size_t refCount = 0;
+            size_t bytes = 0;
+            bool uploaded = false;
+            // cooked levels, released after the upload
+            std::shared_future<CookedTexture> image;
+        };
+
+        static std::string CanonicalPath(const std::string &fileName);
+        static Key HashFile(const std::string &fileName);
+
+        std::mutex registryMutex;
+        std::unordered_map<std::string, Key> keysByPath;
+        std::unordered_map<Key, Entry> entries;
+        std::unordered_map<GLuint, Key> keysById;
+    };
+
+}
+
+#endif /* TextureRegistry_hpp */
@@ -0,0 +1,63 @@
+#include "ThreadPool.hpp"
+
+namespace gps {
+
+    ThreadPool::ThreadPool(unsigned int threadCount) {
+        stopping = false;
+        if (threadCount == 0) {
+            threadCount = std::thread::hardware_concurrency();
+        }
+        if (threadCount == 0) {
+            threadCount = 1;
+        }
+        for (unsigned int i = 0; i < threadCount; i++) {
+            workers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+        }
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(jobsMutex);
+            stopping = true;
+        }
+        jobsAvailable.notify_all();
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+    }
+
+    unsigned int ThreadPool::getThreadCount() const {
+        return (unsigned int)workers.size();
+    }
+
+    ThreadPool &ThreadPool::Shared() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    void ThreadPool::Push(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock(jobsMutex);
+            jobs.push_back(job);
+        }
+        jobsAvailable.notify_one();
+    }
+
+    void ThreadPool::WorkerLoop() {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(jobsMutex);
+                jobsAvailable.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                // pending jobs are still run on shutdown so no future is left unsatisfied
+                if (jobs.empty()) {
+                    return;
+                }
+                job = jobs.front();
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+}
@@ -0,0 +1,54 @@
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gps {
+
+    // Fixed set of worker threads executing submitted jobs in FIFO order
+    class ThreadPool {
+
+    public:
+        // 0 threads = one per hardware thread
+        explicit ThreadPool(unsigned int threadCount = 0);
+        ~ThreadPool();
+
+        // queues a job and returns a future for its result
+        template <typename F>
+        std::future<typename std::result_of<F()>::type> Submit(F job) {
+            typedef typename std::result_of<F()>::type Result;
+            std::shared_ptr<std::packaged_task<Result()> > task(new std::packaged_task<Result()>(job));
+            std::future<Result> result = task->get_future();
+            Push([task]() { (*task)(); });
+            return result;
+        }
+
+        unsigned int getThreadCount() const;
+
+        // pool shared by the loaders, created on first use
+        static ThreadPool &Shared();
+
+    private:
+        ThreadPool(const ThreadPool &);
+        ThreadPool &operator=(const ThreadPool &);
+
+        void Push(std::function<void()> job);
+        void WorkerLoop();
+
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()> > jobs;
+        std::mutex jobsMutex;
+        std::condition_variable jobsAvailable;
+        bool stopping;
+    };
+
+}
+
+#endif /* ThreadPool_hpp */
@@ -0,0 +1,62 @@
+#include "UniformBuffer.hpp"
+#include "GLState.hpp"
+
+namespace gps {
+
+    UniformBuffer::UniformBuffer() {
+        id = 0;
+        capacity = 0;
+        size = 0;
+    }
+
+    void UniformBuffer::Update(const void *data, GLsizeiptr dataSize) {
+        if (id == 0) {
+            glGenBuffers(1, &id);
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, id);
+        if (dataSize > capacity) {
+            glBufferData(GL_UNIFORM_BUFFER, dataSize, data, GL_DYNAMIC_DRAW);
+            capacity = dataSize;
+        } else {
+            // orphan the storage the previous frame may still be reading
+            glBufferData(GL_UNIFORM_BUFFER, capacity, NULL, GL_DYNAMIC_DRAW);
+            glBufferSubData(GL_UNIFORM_BUFFER, 0, dataSize, data);
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        size = dataSize;
+    }
+
+    void UniformBuffer::Bind(GLuint bindingPoint) {
+        BindRange(bindingPoint, 0, size);
+    }
+
+    void UniformBuffer::BindRange(GLuint bindingPoint, GLintptr offset, GLsizeiptr rangeSize) {
+        GLState::BindBufferRange(GL_UNIFORM_BUFFER, bindingPoint, id, offset, rangeSize);
+    }
+
+    void UniformBuffer::Destroy() {
+        if (id != 0) {
+            glDeleteBuffers(1, &id);
+            GLState::OnBufferDeleted(id);
+        }
+        id = 0;
+        capacity = 0;
+        size = 0;
+    }
+
+    GLuint UniformBuffer::getId() const {
+        return id;
+    }
+
+    GLint UniformBuffer::getOffsetAlignment() {
+        static GLint alignment = 0;
+        if (alignment == 0) {
+            glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+            if (alignment <= 0) {
+                alignment = 256;
+            }
+        }
+        return alignment;
+    }
+
+}
@@ -0,0 +1,39 @@
+#ifndef UniformBuffer_hpp
+#define UniformBuffer_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+namespace gps {
+
+    // GL buffer holding the contents of one or more std140 uniform blocks
+    class UniformBuffer {
+
+    public:
+        UniformBuffer();
+
+        // replaces the contents, growing the buffer when they no longer fit
+        void Update(const void *data, GLsizeiptr size);
+        // attaches the whole buffer, or a range of it, to an indexed uniform block binding point
+        void Bind(GLuint bindingPoint);
+        void BindRange(GLuint bindingPoint, GLintptr offset, GLsizeiptr size);
+        void Destroy();
+
+        GLuint getId() const;
+        // alignment required of BindRange offsets, for packing several blocks in one buffer
+        static GLint getOffsetAlignment();
+
+    private:
+        GLuint id;
+        GLsizeiptr capacity;
+        GLsizeiptr size;
+    };
+
+}
+
+#endif /* UniformBuffer_hpp */
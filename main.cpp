@@ -14,12 +14,20 @@
 #include <glm/gtc/type_ptr.hpp>         //glm extension for accessing the internal data structure of glm types
 #include <glm/gtc/constants.hpp>
 #include <algorithm>
+#include <cmath>
 
 #include "Window.h"
 #include "Shader.hpp"
 #include "Camera.hpp"
 #include "Model3D.hpp"
+#include "ModelLoader.hpp"
 #include "SkyBox.hpp"
+#include "GLState.hpp"
+#include "OcclusionCuller.hpp"
+#include "PotentiallyVisibleSet.hpp"
+#include "RenderQueue.hpp"
+#include "SceneUniforms.hpp"
+#include "UniformBuffer.hpp"
 
 // window
 gps::Window myWindow;
@@ -34,31 +42,11 @@ glm::mat3 normalMatrix;
 glm::vec3 lightDir;
 glm::vec3 lightColor;
 
-// shader uniform locations
-GLint modelLoc;
-GLint viewLoc;
-GLint projectionLoc;
-GLint normalMatrixLoc;
-GLint lightDirLoc;
-GLint lightColorLoc;
-// fog uniform locations
-GLint fogColorLoc;
-GLint fogDensityLoc;
-GLint fogRadiusLoc;
-GLint fogRadiusXLoc;
-GLint hatCenterLoc;
-GLint fogStretchLoc;
-GLint fogEnabledLoc;
-GLint fogTimeLoc;
-GLint flatShadingLoc = -1;
-// spotlight uniform locations
-GLint spotPosLoc[2];
-GLint spotDirLoc[2];
-GLint spotConstLoc[2];
-GLint spotLinearLoc[2];
-GLint spotQuadLoc[2];
-GLint spotCutoffLoc[2];
-GLint spotIntensityLoc[2];
+// per-frame lighting, fog and camera block shared by the basic and depth shaders
+gps::FrameUniforms frameUniforms;
+gps::UniformBuffer frameUniformBuffer;
+// shader uniform handles
+gps::Uniform<int> flatShadingUniform;
 
 // camera
 gps::Camera myCamera(
@@ -133,6 +121,14 @@ gps::Model3D SceneModel;
 gps::Model3D SwingModel;
 gps::Model3D WheelModel;
 gps::Model3D TreesModel;
+// merged static geometry drawn with the global model matrix, with and without fog
+const bool STATIC_BATCHING = true;
+// trees repeated in NewTrees.obj are stored once and drawn instanced
+const bool TREE_INSTANCING = true;
+// meshes wider than this (the ground, the tree rows) are cut into spatial clusters for culling
+const float SCENE_CLUSTER_EXTENT = 12.0f;
+gps::Model3D StaticFoggedBatch;
+gps::Model3D StaticClearBatch;
 GLfloat angle;
 
 // shaders
@@ -146,20 +142,56 @@ gps::Shader skyboxShader;
 // rain fullscreen quad
 GLuint rainQuadVAO = 0;
 GLuint rainQuadVBO = 0;
-GLint rainTimeLoc = -1;
-GLint rainCamPosLoc = -1;
-GLint rainIntensityLoc = -1;
-GLint rainColorLoc = -1;
-GLint rainDropWidthLoc = -1;
-GLint rainFallSpeedLoc = -1;
-GLint rainColumnScaleLoc = -1;
-GLint rainRotationLoc = -1;
-// shadow map
-GLuint depthMapFBO = 0;
+gps::Uniform<float> rainTimeUniform;
+gps::Uniform<glm::vec3> rainCamPosUniform;
+gps::Uniform<float> rainIntensityUniform;
+gps::Uniform<glm::vec3> rainColorUniform;
+gps::Uniform<float> rainDropWidthUniform;
+gps::Uniform<float> rainFallSpeedUniform;
+gps::Uniform<float> rainColumnScaleUniform;
+gps::Uniform<float> rainRotationUniform;
+// cascaded shadow map: the view up to SHADOW_DISTANCE is cut into SHADOW_CASCADES slices, each
+// drawn into its own layer of depthMap from a light box fitted around the slice;
+// SHADOW_SPLIT_LAMBDA blends logarithmic (1) and uniform (0) split distances
+const int SHADOW_CASCADES = 3;
+const float SHADOW_DISTANCE = 120.0f;
+const float SHADOW_SPLIT_LAMBDA = 0.75f;
+// a cascade's light box only moves in steps of this fraction of its width, and is widened so its
+// slice stays inside between steps (by 1 / (1 - step), about 7%); the cached static layer is
+// redrawn only when the box steps. 1/16 of 1024 texels is a whole 64 texels
+const float SHADOW_CASCADE_STEP = 1.0f / 16.0f;
+static_assert(SHADOW_CASCADES <= gps::MAX_SHADOW_CASCADES, "FrameBlock holds at most MAX_SHADOW_CASCADES cascades");
+// one framebuffer per layer
+GLuint depthMapFBO[SHADOW_CASCADES] = {};
 GLuint depthMap = 0;
-const GLuint SHADOW_WIDTH = 2048, SHADOW_HEIGHT = 2048;
-GLint shadowMapLoc = -1;
-GLint lightSpaceLoc = -1;
+// depth of the static casters alone, copied into depthMap every frame before the moving casters
+// are drawn; a layer is re-rendered only when its cascade moved or the static models' transform changed
+GLuint staticDepthMapFBO[SHADOW_CASCADES] = {};
+GLuint staticDepthMap = 0;
+bool staticShadowValid = false;
+glm::mat4 staticShadowLightSpace[SHADOW_CASCADES];
+glm::mat4 staticShadowModel;
+const GLuint SHADOW_WIDTH = 1024, SHADOW_HEIGHT = 1024;
+gps::Uniform<int> shadowMapUniform;
+// kernel of ShadowCalculation in basic.frag: 0 one hardware 2x2 PCF lookup, 1 a 16-tap Poisson
+// disk, 2 the Poisson disk with an early out on fully lit or fully shadowed blocks
+const int SHADOW_FILTER = 2;
+gps::Uniform<int> shadowFilterUniform;
+gps::Uniform<int> cascadeUniform;
+// depth range of every cascade along the light view, deep enough for casters outside the camera slice
+const float LIGHT_NEAR_PLANE = -100.0f, LIGHT_FAR_PLANE = 100.0f;
+// frame's objects, shared by the depth and main passes
+gps::RenderQueue renderQueue;
+gps::RenderPass depthPass;
+gps::RenderPass staticDepthPass;
+gps::RenderPass mainPass;
+// Ferris wheel, playground and trees rasterized on the CPU; the main pass skips what they hide
+const bool OCCLUSION_CULLING = true;
+gps::OcclusionCuller occlusionCuller;
+// static meshes visible from each cell of the camera movement bounds, baked once and cached
+const bool PVS_CULLING = true;
+const char *PVS_FILE = "models/Scene/Scene.gpspvs";
+gps::PotentiallyVisibleSet visibilitySet;
 float rainIntensity = 0.15f;
 glm::vec3 rainColor = glm::vec3(0.6f, 0.6f, 0.9f);
 
@@ -194,32 +226,28 @@ void keyboardCallback(GLFWwindow *window, int key, int scancode, int action, int
             if (key == GLFW_KEY_7)
             {
                 currentRenderMode = RENDER_SOLID;
-                glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+                gps::GLState::PolygonMode(GL_FILL);
             }
             if (key == GLFW_KEY_8)
             {
                 currentRenderMode = RENDER_WIREFRAME;
-                glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+                gps::GLState::PolygonMode(GL_LINE);
             }
             if (key == GLFW_KEY_9)
             {
                 currentRenderMode = RENDER_POLYGONAL;
-                glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+                gps::GLState::PolygonMode(GL_FILL);
                 // immediately upload flatShading uniform
-                myBasicShader.useShaderProgram();
-                if (flatShadingLoc != -1)
-                    glUniform1i(flatShadingLoc, 1);
+                myBasicShader.setUniform(flatShadingUniform, 1);
             }
             if (key == GLFW_KEY_0)
             {
                 currentRenderMode = RENDER_POINTS;
-                glPolygonMode(GL_FRONT_AND_BACK, GL_POINT);
+                gps::GLState::PolygonMode(GL_POINT);
                 // set a sensible point size for vertex rendering
                 glPointSize(4.0f);
-                // ensure shader program active and disable flat shading
-                myBasicShader.useShaderProgram();
-                if (flatShadingLoc != -1)
-                    glUniform1i(flatShadingLoc, 0);
+                // disable flat shading
+                myBasicShader.setUniform(flatShadingUniform, 0);
             }
             if (key == GLFW_KEY_P)
             { // toggle clap animation
@@ -290,10 +318,8 @@ void mouseCallback(GLFWwindow *window, double xpos, double ypos)
 
     // pitch, yaw (rotate expects pitch then yaw)
     myCamera.rotate(yoff, xoff);
-    // update view uniform
+    // update view matrix, uploaded with the next frame's uniforms
     view = myCamera.getViewMatrix();
-    myBasicShader.useShaderProgram();
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 }
 
 void mouseButtonCallback(GLFWwindow *window, int button, int action, int mods)
@@ -312,32 +338,24 @@ void processMovement()
         myCamera.move(gps::MOVE_FORWARD, cameraSpeed);
         // update view matrix for all models
         view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
     }
 
     if (pressedKeys[GLFW_KEY_UP])
     {
         myCamera.move(gps::MOVE_UP, cameraSpeed);
         view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
     }
     if (pressedKeys[GLFW_KEY_S])
     {
         myCamera.move(gps::MOVE_BACKWARD, cameraSpeed);
         // update view matrix for all models
         view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
     }
 
     if (pressedKeys[GLFW_KEY_DOWN])
     {
         myCamera.move(gps::MOVE_DOWN, cameraSpeed);
         view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
     }
 
     if (pressedKeys[GLFW_KEY_A])
@@ -345,8 +363,6 @@ void processMovement()
         myCamera.move(gps::MOVE_LEFT, cameraSpeed);
         // update view matrix for all models
         view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
     }
 
     if (pressedKeys[GLFW_KEY_D])
@@ -354,8 +370,6 @@ void processMovement()
         myCamera.move(gps::MOVE_RIGHT, cameraSpeed);
         // update view matrix for all models
         view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
     }
 
     if (pressedKeys[GLFW_KEY_Q])
@@ -413,27 +427,104 @@ void initOpenGLState()
     // match scene clear color to fog base color
     glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
     glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
-    glEnable(GL_FRAMEBUFFER_SRGB);
-    glEnable(GL_DEPTH_TEST); // enable depth-testing
-    glDepthFunc(GL_LESS);    // depth-testing interprets a smaller value as "closer"
-    glEnable(GL_CULL_FACE);  // cull face
-    glCullFace(GL_BACK);     // cull back face
+    gps::GLState::Enable(GL_FRAMEBUFFER_SRGB);
+    gps::GLState::Enable(GL_DEPTH_TEST); // enable depth-testing
+    gps::GLState::DepthFunc(GL_LESS);    // depth-testing interprets a smaller value as "closer"
+    gps::GLState::Enable(GL_CULL_FACE);  // cull face
+    gps::GLState::CullFace(GL_BACK);     // cull back face
     glFrontFace(GL_CCW);     // GL_CCW for counter clock-wise
 }
 
 void initModels()
 {
-    FerisWheelModel.LoadModel("models/FerisWheel/FerisWhee;.obj");
-    HatModel.LoadModel("models/Hat/Hat.obj");
-    IceCreamModel.LoadModel("models/IceCream/IceCream.obj");
-    LeftHandsModel.LoadModel("models/LeftHands/LeftHands.obj");
-    PlaygroundModel.LoadModel("models/Playground/Playground.obj");
-    RabbitModel.LoadModel("models/Rabbit/Rabbit.obj");
-    RightHandsModel.LoadModel("models/RightHands/RightHands.obj");
-    SceneModel.LoadModel("models/Scene/Scene.obj");
-    SwingModel.LoadModel("models/Swing/Swing.obj");
-    WheelModel.LoadModel("models/Wheel/Wheel.obj");
-    TreesModel.LoadModel("models/MoreTrees/NewTrees.obj");
+    // parse and decode all models concurrently, upload them here as they finish
+    gps::ModelLoader loader;
+    // the animated models are drawn as loaded, no load-time pass reads their geometry back
+    LeftHandsModel.setKeepsGeometry(false);
+    RightHandsModel.setKeepsGeometry(false);
+    RabbitModel.setKeepsGeometry(false);
+    SwingModel.setKeepsGeometry(false);
+    loader.Enqueue(FerisWheelModel, "models/FerisWheel/FerisWhee;.obj");
+    loader.Enqueue(HatModel, "models/Hat/Hat.obj");
+    loader.Enqueue(IceCreamModel, "models/IceCream/IceCream.obj");
+    loader.Enqueue(LeftHandsModel, "models/LeftHands/LeftHands.obj");
+    loader.Enqueue(PlaygroundModel, "models/Playground/Playground.obj");
+    loader.Enqueue(RabbitModel, "models/Rabbit/Rabbit.obj");
+    loader.Enqueue(RightHandsModel, "models/RightHands/RightHands.obj");
+    loader.Enqueue(SceneModel, "models/Scene/Scene.obj");
+    loader.Enqueue(SwingModel, "models/Swing/Swing.obj");
+    loader.Enqueue(WheelModel, "models/Wheel/Wheel.obj");
+    loader.Enqueue(TreesModel, "models/MoreTrees/NewTrees.obj");
+    loader.Finish();
+
+    // before batching, which carries the instanced meshes over unmerged
+    if (TREE_INSTANCING)
+    {
+        TreesModel.InstanceRepeatedMeshes();
+    }
+
+    // occluder geometry is copied before batching hands the meshes over
+    if (OCCLUSION_CULLING)
+    {
+        occlusionCuller.AddOccluder(FerisWheelModel);
+        occlusionCuller.AddOccluder(PlaygroundModel);
+        occlusionCuller.AddOccluder(TreesModel);
+    }
+
+    // the hands, swing and rabbit keep their own transforms and stay separate
+    if (STATIC_BATCHING)
+    {
+        std::vector<gps::Model3D *> fogged;
+        fogged.push_back(&FerisWheelModel);
+        fogged.push_back(&IceCreamModel);
+        fogged.push_back(&PlaygroundModel);
+        fogged.push_back(&SceneModel);
+        fogged.push_back(&WheelModel);
+        fogged.push_back(&TreesModel);
+        StaticFoggedBatch.BuildStaticBatch(fogged);
+        // the hat is drawn without fog
+        StaticClearBatch.BuildStaticBatch(std::vector<gps::Model3D *>(1, &HatModel));
+    }
+
+    // split the scene-wide meshes so the render queue's hierarchy can reject most of them as a whole
+    if (STATIC_BATCHING)
+    {
+        StaticFoggedBatch.SplitIntoClusters(SCENE_CLUSTER_EXTENT);
+    }
+    else
+    {
+        SceneModel.SplitIntoClusters(SCENE_CLUSTER_EXTENT);
+        TreesModel.SplitIntoClusters(SCENE_CLUSTER_EXTENT);
+    }
+}
+
+void initVisibility()
+{
+    if (!PVS_CULLING)
+    {
+        return;
+    }
+    // the sets are baked in the space of the static models; the camera is brought into it per frame
+    glm::mat4 identity(1.0f);
+    if (STATIC_BATCHING)
+    {
+        visibilitySet.AddObjects(StaticFoggedBatch, identity);
+        visibilitySet.AddObjects(StaticClearBatch, identity);
+    }
+    else
+    {
+        visibilitySet.AddObjects(FerisWheelModel, identity);
+        visibilitySet.AddObjects(HatModel, identity);
+        visibilitySet.AddObjects(IceCreamModel, identity);
+        visibilitySet.AddObjects(PlaygroundModel, identity);
+        visibilitySet.AddObjects(SceneModel, identity);
+        visibilitySet.AddObjects(WheelModel, identity);
+        visibilitySet.AddObjects(TreesModel, identity);
+    }
+    gps::PvsSettings settings;
+    settings.min = myCamera.getMovementMin();
+    settings.max = myCamera.getMovementMax();
+    visibilitySet.Prepare(PVS_FILE, settings);
 }
 
 void initSkybox()
@@ -482,191 +573,200 @@ void initRain()
 
     glGenVertexArrays(1, &rainQuadVAO);
     glGenBuffers(1, &rainQuadVBO);
-    glBindVertexArray(rainQuadVAO);
+    gps::GLState::BindVertexArray(rainQuadVAO);
     glBindBuffer(GL_ARRAY_BUFFER, rainQuadVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), quadVertices, GL_STATIC_DRAW);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)0);
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)(3 * sizeof(float)));
-    glBindVertexArray(0);
-
-    rainTimeLoc = glGetUniformLocation(rainShader.shaderProgram, "time");
-    rainCamPosLoc = glGetUniformLocation(rainShader.shaderProgram, "camPos");
-    rainIntensityLoc = glGetUniformLocation(rainShader.shaderProgram, "intensity");
-    rainColorLoc = glGetUniformLocation(rainShader.shaderProgram, "rainColor");
-    rainDropWidthLoc = glGetUniformLocation(rainShader.shaderProgram, "dropWidth");
-    rainFallSpeedLoc = glGetUniformLocation(rainShader.shaderProgram, "fallSpeed");
-    rainColumnScaleLoc = glGetUniformLocation(rainShader.shaderProgram, "columnScale");
-    rainRotationLoc = glGetUniformLocation(rainShader.shaderProgram, "dropRotationDeg");
-
-    if (rainDropWidthLoc != -1)
-        glUniform1f(rainDropWidthLoc, 0.025f); // larger drops
-    if (rainFallSpeedLoc != -1)
-        glUniform1f(rainFallSpeedLoc, 0.8f); // slower fall
-    if (rainColumnScaleLoc != -1)
-        glUniform1f(rainColumnScaleLoc, 22.0f); // sparser columns
-    if (rainRotationLoc != -1)
-        glUniform1f(rainRotationLoc, 90.0f); // rotate drops 90 degrees
+    gps::GLState::BindVertexArray(0);
+
+    rainTimeUniform = rainShader.getUniform<float>("time");
+    rainCamPosUniform = rainShader.getUniform<glm::vec3>("camPos");
+    rainIntensityUniform = rainShader.getUniform<float>("intensity");
+    rainColorUniform = rainShader.getUniform<glm::vec3>("rainColor");
+    rainDropWidthUniform = rainShader.getUniform<float>("dropWidth");
+    rainFallSpeedUniform = rainShader.getUniform<float>("fallSpeed");
+    rainColumnScaleUniform = rainShader.getUniform<float>("columnScale");
+    rainRotationUniform = rainShader.getUniform<float>("dropRotationDeg");
+
+    rainShader.setUniform(rainDropWidthUniform, 0.025f); // larger drops
+    rainShader.setUniform(rainFallSpeedUniform, 0.8f);   // slower fall
+    rainShader.setUniform(rainColumnScaleUniform, 22.0f); // sparser columns
+    rainShader.setUniform(rainRotationUniform, 90.0f);   // rotate drops 90 degrees
 }
 
-void initShadowMap()
+void createShadowTarget(GLuint fbo[], GLuint &texture)
 {
-    // create FBO
-    glGenFramebuffers(1, &depthMapFBO);
-    // create depth texture
-    glGenTextures(1, &depthMap);
-    glBindTexture(GL_TEXTURE_2D, depthMap);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    // create depth texture, one layer per cascade
+    glGenTextures(1, &texture);
+    gps::GLState::BindTexture(5, GL_TEXTURE_2D_ARRAY, texture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, SHADOW_CASCADES, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    // sampled as a shadow sampler: lookups compare against the stored depth and blend the
+    // results of the 2x2 texels around the coordinate
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
     float borderColor[] = {1.0f, 1.0f, 1.0f, 1.0f};
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-
-    // attach
-    glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+
+    // create FBOs and attach a layer to each
+    glGenFramebuffers(SHADOW_CASCADES, fbo);
+    for (int i = 0; i < SHADOW_CASCADES; i++)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo[i]);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, i);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+    }
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-glm::mat4 computeLightSpaceTrMatrix()
+void initShadowMap()
+{
+    // same format for both, so the static depth can be blitted into the per-frame map;
+    // created last, the sampled map stays bound to unit 5
+    createShadowTarget(staticDepthMapFBO, staticDepthMap);
+    createShadowTarget(depthMapFBO, depthMap);
+}
+
+glm::mat4 computeLightViewMatrix()
 {
-    // Use a fixed orthographic shadow box.
     glm::vec3 lightPos = lightDir;
-    glm::mat4 lightView = glm::lookAt(lightPos, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-    float near_plane = -100.0f, far_plane = 100.0f;
-    float orthoSize = 80.0f; // increased further to better cover the scene
-    glm::mat4 lightProjection = glm::ortho(-orthoSize, orthoSize, -orthoSize, orthoSize, near_plane, far_plane);
-    return lightProjection * lightView;
+    return glm::lookAt(lightPos, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+// Split distances and light-space matrices of the cascades for the current camera. Each slice of
+// the view frustum is enclosed in the smallest sphere centered on the view axis, whose size does
+// not change as the camera turns. The light box around it snaps to a grid of SHADOW_CASCADE_STEP
+// of its width, a whole number of texels, so still shadows do not shimmer and the box stays put
+// while the camera moves or turns within a grid cell.
+void computeCascades(glm::mat4 lightSpace[], float splits[])
+{
+    glm::mat4 lightView = computeLightViewMatrix();
+    glm::mat4 cameraToWorld = glm::inverse(view);
+    // squared distance of a frustum corner from the view axis, at unit view distance
+    float tanHalfX = 1.0f / projection[0][0];
+    float tanHalfY = 1.0f / projection[1][1];
+    float cornerSpread2 = tanHalfX * tanHalfX + tanHalfY * tanHalfY;
+    float cameraNear = mainPass.nearDepth;
+    float sliceNear = cameraNear;
+    for (int i = 0; i < SHADOW_CASCADES; i++)
+    {
+        float t = (float)(i + 1) / SHADOW_CASCADES;
+        float logSplit = cameraNear * std::pow(SHADOW_DISTANCE / cameraNear, t);
+        float uniformSplit = cameraNear + (SHADOW_DISTANCE - cameraNear) * t;
+        float sliceFar = SHADOW_SPLIT_LAMBDA * logSplit + (1.0f - SHADOW_SPLIT_LAMBDA) * uniformSplit;
+        splits[i] = sliceFar;
+
+        // center equidistant from the near and far corners, or on the far plane for thin slices
+        float centerDistance = std::min((sliceNear + sliceFar) * (1.0f + cornerSpread2) * 0.5f, sliceFar);
+        float farOffset = sliceFar - centerDistance;
+        float radius = std::sqrt(farOffset * farOffset + sliceFar * sliceFar * cornerSpread2);
+        glm::vec4 centerWorld = cameraToWorld * glm::vec4(0.0f, 0.0f, -centerDistance, 1.0f);
+        glm::vec3 centerLight = glm::vec3(lightView * centerWorld);
+
+        // rounding moves the center by at most half a step, which the widened box absorbs
+        float halfSize = radius / (1.0f - SHADOW_CASCADE_STEP);
+        float step = 2.0f * halfSize * SHADOW_CASCADE_STEP;
+        centerLight.x = std::floor(centerLight.x / step + 0.5f) * step;
+        centerLight.y = std::floor(centerLight.y / step + 0.5f) * step;
+        glm::mat4 lightProjection = glm::ortho(centerLight.x - halfSize, centerLight.x + halfSize,
+                                               centerLight.y - halfSize, centerLight.y + halfSize,
+                                               LIGHT_NEAR_PLANE, LIGHT_FAR_PLANE);
+        lightSpace[i] = lightProjection * lightView;
+        sliceNear = sliceFar;
+    }
 }
 
 void initUniforms()
 {
-    myBasicShader.useShaderProgram();
+    // both programs read the per-frame and per-draw blocks
+    myBasicShader.bindUniformBlock("FrameBlock", gps::FRAME_UNIFORMS_BINDING);
+    myBasicShader.bindUniformBlock("DrawBlock", gps::DRAW_UNIFORMS_BINDING);
+    depthShader.bindUniformBlock("FrameBlock", gps::FRAME_UNIFORMS_BINDING);
+    depthShader.bindUniformBlock("DrawBlock", gps::DRAW_UNIFORMS_BINDING);
 
     // create model matrix for teapot
     model = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
-    modelLoc = glGetUniformLocation(myBasicShader.shaderProgram, "model");
 
     // get view matrix for current camera
     view = myCamera.getViewMatrix();
-    viewLoc = glGetUniformLocation(myBasicShader.shaderProgram, "view");
-    // send view matrix to shader
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 
     normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    normalMatrixLoc = glGetUniformLocation(myBasicShader.shaderProgram, "normalMatrix");
 
     // create projection matrix
     projection = glm::perspective(glm::radians(45.0f), (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height, 0.1f, 1000.0f);
-    projectionLoc = glGetUniformLocation(myBasicShader.shaderProgram, "projection");
-    // send projection matrix to shader
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    frameUniforms.projection = projection;
 
     // set the light direction (direction towards the light)
     lightDir = glm::vec3(0.0f, 1.0f, 1.0f);
-    lightDirLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightDir");
-    // send light dir to shader
-    glUniform3fv(lightDirLoc, 1, glm::value_ptr(lightDir));
 
     // set light color
     lightColor = glm::vec3(1.0f, 1.0f, 1.0f); // white light
-    lightColorLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightColor");
-    // send light color to shader
-    glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
+    frameUniforms.lightColor = glm::vec4(lightColor, 1.0f);
 
     // fog defaults
-    fogColorLoc = glGetUniformLocation(myBasicShader.shaderProgram, "fogColor");
-    fogDensityLoc = glGetUniformLocation(myBasicShader.shaderProgram, "fogDensity");
-    fogRadiusLoc = glGetUniformLocation(myBasicShader.shaderProgram, "fogRadius");
-    hatCenterLoc = glGetUniformLocation(myBasicShader.shaderProgram, "hatCenterWorld");
-
     glm::vec3 fogColor = glm::vec3(1.0f, 0.0f, 1.0f); // magenta
     float fogDensity = 1.10f;                         // increased density (clamped in shader)
     float fogRadius = 3.5f;                           // depth (Z) radius
     float fogRadiusX = 9.0f;                          // left/right (X) radius
     float fogStretchDown = 2.0f;                      // keep tall vertical stretch
 
-    glUniform3fv(fogColorLoc, 1, glm::value_ptr(fogColor));
-    glUniform1f(fogDensityLoc, fogDensity);
-    glUniform1f(fogRadiusLoc, fogRadius);
-    fogRadiusXLoc = glGetUniformLocation(myBasicShader.shaderProgram, "fogRadiusX");
-    if (fogRadiusXLoc != -1)
-        glUniform1f(fogRadiusXLoc, fogRadiusX);
-    fogStretchLoc = glGetUniformLocation(myBasicShader.shaderProgram, "fogStretchDown");
-    if (fogStretchLoc != -1)
-        glUniform1f(fogStretchLoc, fogStretchDown);
-    fogEnabledLoc = glGetUniformLocation(myBasicShader.shaderProgram, "fogEnabled");
-    if (fogEnabledLoc != -1)
-        glUniform1i(fogEnabledLoc, 1);
-    // time uniform for animated fog
-    fogTimeLoc = glGetUniformLocation(myBasicShader.shaderProgram, "fogTime");
-    if (fogTimeLoc != -1)
-        glUniform1f(fogTimeLoc, 0.0f);
+    frameUniforms.fogColor = glm::vec4(fogColor, fogDensity);
+    // ellipsoid radii: x, z, y below the center (stretched) and y above it
+    glm::vec4 fogRadii = glm::vec4(fogRadiusX, fogRadius, fogRadius * fogStretchDown, fogRadius * 0.9f);
+    frameUniforms.fogInvRadius2 = glm::vec4(1.0f) / (fogRadii * fogRadii);
     // flat/polygonal shading uniform
-    flatShadingLoc = glGetUniformLocation(myBasicShader.shaderProgram, "flatShading");
-    if (flatShadingLoc != -1)
-        glUniform1i(flatShadingLoc, 0);
-    // shadow map sampler and light-space uniform
-    shadowMapLoc = glGetUniformLocation(myBasicShader.shaderProgram, "shadowMap");
-    if (shadowMapLoc != -1)
-        glUniform1i(shadowMapLoc, 5); // bind depth map to texture unit 5
-    lightSpaceLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightSpaceTrMatrix");
-    // spotlight uniform locations and defaults (2 outer spotlights)
+    flatShadingUniform = myBasicShader.getUniform<int>("flatShading");
+    myBasicShader.setUniform(flatShadingUniform, 0);
+    // shadow map sampler
+    shadowMapUniform = myBasicShader.getUniform<int>("shadowMap");
+    myBasicShader.setUniform(shadowMapUniform, 5); // bind depth map to texture unit 5
+    shadowFilterUniform = myBasicShader.getUniform<int>("shadowFilter");
+    myBasicShader.setUniform(shadowFilterUniform, SHADOW_FILTER);
+    // layer the depth pass draws into
+    cascadeUniform = depthShader.getUniform<int>("cascade");
+    // render queue passes; per-draw data comes from the queue's DrawBlock ring buffer
+    depthPass.id = gps::RENDER_PASS_DEPTH;
+    depthPass.shader = depthShader;
+    depthPass.nearDepth = LIGHT_NEAR_PLANE;
+    depthPass.farDepth = LIGHT_FAR_PLANE;
+    depthPass.cull = true;
+    depthPass.depthOnly = true;
+    staticDepthPass = depthPass;
+    staticDepthPass.id = gps::RENDER_PASS_STATIC_DEPTH;
+    mainPass.id = gps::RENDER_PASS_MAIN;
+    mainPass.shader = myBasicShader;
+    mainPass.nearDepth = 0.1f;
+    mainPass.farDepth = 1000.0f;
+    mainPass.cull = true;
+    mainPass.visibility = PVS_CULLING ? &visibilitySet : NULL;
+    mainPass.occlusion = OCCLUSION_CULLING ? &occlusionCuller : NULL;
+    // spotlight defaults (2 outer spotlights): constant, linear, quadratic attenuation and intensity
     for (int i = 0; i < 2; ++i)
     {
-        std::string idx = std::to_string(i);
-        spotPosLoc[i] = glGetUniformLocation(myBasicShader.shaderProgram, ("spotPos[" + idx + "]").c_str());
-        spotDirLoc[i] = glGetUniformLocation(myBasicShader.shaderProgram, ("spotDir[" + idx + "]").c_str());
-        spotConstLoc[i] = glGetUniformLocation(myBasicShader.shaderProgram, ("spotConstant[" + idx + "]").c_str());
-        spotLinearLoc[i] = glGetUniformLocation(myBasicShader.shaderProgram, ("spotLinear[" + idx + "]").c_str());
-        spotQuadLoc[i] = glGetUniformLocation(myBasicShader.shaderProgram, ("spotQuadratic[" + idx + "]").c_str());
-        spotCutoffLoc[i] = glGetUniformLocation(myBasicShader.shaderProgram, ("spotCutoffCos[" + idx + "]").c_str());
-        spotIntensityLoc[i] = glGetUniformLocation(myBasicShader.shaderProgram, ("spotIntensity[" + idx + "]").c_str());
-        // set some safe defaults
-        if (spotConstLoc[i] != -1)
-            glUniform1f(spotConstLoc[i], 1.0f);
-        if (spotLinearLoc[i] != -1)
-            glUniform1f(spotLinearLoc[i], 0.0045f);
-        if (spotQuadLoc[i] != -1)
-            glUniform1f(spotQuadLoc[i], 0.0075f);
-        if (spotCutoffLoc[i] != -1)
-            glUniform1f(spotCutoffLoc[i], cos(glm::radians(25.0f))); // ~25deg cone
-        if (spotIntensityLoc[i] != -1)
-            glUniform1f(spotIntensityLoc[i], 3.0f); // default stronger intensity
+        frameUniforms.spotAttenuation[i] = glm::vec4(1.0f, 0.0045f, 0.0075f, 3.0f);
     }
 }
 
-// Helper: set model matrix and its normal matrix once per object
-static inline void setModelUniforms(const glm::mat4 &M)
-{
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(M));
-    glm::mat3 nm = glm::mat3(glm::inverseTranspose(view * M));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(nm));
-}
-
-void renderModels(gps::Shader shader)
+// Fills the frame block from the current camera, light and animation state and uploads it once
+void updateFrameUniforms(const glm::mat4 lightSpace[], const float cascadeSplits[])
 {
-    shader.useShaderProgram();
-
-    // apply global render mode settings for this shader pass
-    if (currentRenderMode == RENDER_WIREFRAME)
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    else if (currentRenderMode == RENDER_POINTS)
+    frameUniforms.view = view;
+    for (int i = 0; i < gps::MAX_SHADOW_CASCADES; i++)
     {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_POINT);
-        // choose an appropriate point size for visibility
-        glPointSize(4.0f);
+        // unused cascades never match, fragments past the last split are left unshadowed
+        frameUniforms.lightSpaceTrMatrix[i] = i < SHADOW_CASCADES ? lightSpace[i] : glm::mat4(1.0f);
+        frameUniforms.cascadeSplits[i] = i < SHADOW_CASCADES ? cascadeSplits[i] : 0.0f;
     }
-    else
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-    // compute flat shading flag to forward to draws
-    int flatFlag = (currentRenderMode == RENDER_POLYGONAL) ? 1 : 0;
-    // update hat center uniform (compute in world space)
+    // directional light, normalized once in eye space
+    frameUniforms.lightDirEye = glm::vec4(glm::normalize(glm::vec3(view * glm::vec4(lightDir, 0.0f))), 0.0f);
+
     // compute hat bounds in world space and set fog center at mid-height of hat
     glm::vec3 hatMinModel = HatModel.getMinBounds();
     glm::vec3 hatMaxModel = HatModel.getMaxBounds();
@@ -675,8 +775,9 @@ void renderModels(gps::Shader shader)
     glm::vec3 hatCenterWorld = glm::vec3((hatMinWorld + hatMaxWorld) * 0.5f);
     // shift center slightly down so fog sits below mid-hat and extends toward the scene
     hatCenterWorld.y -= 0.40f;
-    if (hatCenterLoc != -1)
-        glUniform3fv(hatCenterLoc, 1, glm::value_ptr(hatCenterWorld));
+    // fog center with the animated fog time
+    frameUniforms.fogCenter = glm::vec4(hatCenterWorld, (float)glfwGetTime());
+
     // compute rabbit center in world space for spotlight targeting
     glm::vec3 rabbitCenterModel = RabbitModel.getCenter();
     glm::vec3 rabbitCenterWorld = glm::vec3(model * glm::vec4(rabbitCenterModel, 1.0f));
@@ -687,132 +788,86 @@ void renderModels(gps::Shader shader)
         glm::vec3(-6.7394f, 2.94475f, -20.4938f), // outer-left
         glm::vec3(7.66052f, 2.94475f, -20.506f)   // outer-right
     };
-    // upload spot positions and directions and attenuation
+    // spot positions and directions in eye space, with the ~25deg cone cutoff
     for (int i = 0; i < 2; ++i)
     {
-        if (spotPosLoc[i] != -1)
-            glUniform3fv(spotPosLoc[i], 1, glm::value_ptr(spotOrigins[i]));
         glm::vec3 dir = glm::normalize(spotTarget - spotOrigins[i]);
-        if (spotDirLoc[i] != -1)
-            glUniform3fv(spotDirLoc[i], 1, glm::value_ptr(dir));
-        // attenuation choices: constant=1.0, linear=0.0045, quadratic=0.0075
-        if (spotConstLoc[i] != -1)
-            glUniform1f(spotConstLoc[i], 1.0f);
-        if (spotLinearLoc[i] != -1)
-            glUniform1f(spotLinearLoc[i], 0.0045f);
-        if (spotQuadLoc[i] != -1)
-            glUniform1f(spotQuadLoc[i], 0.0075f);
-        if (spotCutoffLoc[i] != -1)
-            glUniform1f(spotCutoffLoc[i], cos(glm::radians(25.0f)));
-        if (spotIntensityLoc[i] != -1)
-            glUniform1f(spotIntensityLoc[i], 3.0f);
+        frameUniforms.spotPosEye[i] = view * glm::vec4(spotOrigins[i], 1.0f);
+        frameUniforms.spotDirEye[i] = glm::vec4(glm::normalize(glm::vec3(view * glm::vec4(dir, 0.0f))), (float)cos(glm::radians(25.0f)));
     }
-    // update animated fog time uniform
-    if (fogTimeLoc != -1)
+
+    frameUniformBuffer.Update(&frameUniforms, sizeof(frameUniforms));
+    frameUniformBuffer.Bind(gps::FRAME_UNIFORMS_BINDING);
+}
+
+void renderModels(gps::Shader shader)
+{
+    shader.useShaderProgram();
+
+    // apply global render mode settings for this shader pass
+    if (currentRenderMode == RENDER_WIREFRAME)
+        gps::GLState::PolygonMode(GL_LINE);
+    else if (currentRenderMode == RENDER_POINTS)
     {
-        float t = (float)glfwGetTime();
-        glUniform1f(fogTimeLoc, t);
+        gps::GLState::PolygonMode(GL_POINT);
+        // choose an appropriate point size for visibility
+        glPointSize(4.0f);
     }
+    else
+        gps::GLState::PolygonMode(GL_FILL);
     // set flat shading uniform based on current render mode
-    if (flatShadingLoc != -1)
-    {
-        if (currentRenderMode == RENDER_POLYGONAL)
-            glUniform1i(flatShadingLoc, 1);
-        else
-            glUniform1i(flatShadingLoc, 0);
-    }
-
-    setModelUniforms(model);
-    FerisWheelModel.Draw(shader, flatFlag);
-
-    setModelUniforms(model);
-    // disable fog when drawing the hat itself so texture isn't fogged
-    if (fogEnabledLoc != -1)
-        glUniform1i(fogEnabledLoc, 0);
-    HatModel.Draw(shader, flatFlag);
-    if (fogEnabledLoc != -1)
-        glUniform1i(fogEnabledLoc, 1);
+    int flatFlag = (currentRenderMode == RENDER_POLYGONAL) ? 1 : 0;
+    shader.setUniform(flatShadingUniform, flatFlag);
+
+    // draw the queued objects front to back, grouped by material
+    mainPass.shader = shader;
+    mainPass.view = view;
+    mainPass.cullMatrix = projection * view;
+    mainPass.visibilityCell = visibilitySet.getCell(glm::vec3(glm::inverse(model) * glm::vec4(myCamera.getPosition(), 1.0f)));
+    renderQueue.Sort(mainPass);
+    renderQueue.Submit(mainPass);
+}
 
-    setModelUniforms(model);
-    IceCreamModel.Draw(shader, flatFlag);
+// Collects the frame's objects with their animated transforms for both passes
+void queueModels()
+{
+    renderQueue.Clear();
 
-    // Left hand, apply clap translation
+    if (STATIC_BATCHING)
+    {
+        renderQueue.Add(StaticFoggedBatch, model, 1, gps::RENDER_PASS_STATIC_BITS);
+        renderQueue.Add(StaticClearBatch, model, 0, gps::RENDER_PASS_STATIC_BITS);
+    }
+    else
     {
-        glm::mat4 leftModel = model;
-        leftModel = glm::translate(leftModel, glm::vec3(clapOffset, 0.0f, 0.0f));
-        setModelUniforms(leftModel);
-        // during clap or cinematic appear/hold, draw hands without fog so they're in foreground
-        bool handsForeground = clapActive || (cinematicActive && (cinematicPhase == 1 || cinematicPhase == 2));
-        if (handsForeground && fogEnabledLoc != -1)
-            glUniform1i(fogEnabledLoc, 0);
-        LeftHandsModel.Draw(shader, flatFlag);
-        if (handsForeground && fogEnabledLoc != -1)
-            glUniform1i(fogEnabledLoc, 1);
+        renderQueue.Add(FerisWheelModel, model, 1, gps::RENDER_PASS_STATIC_BITS);
+        // disable fog when drawing the hat itself so texture isn't fogged
+        renderQueue.Add(HatModel, model, 0, gps::RENDER_PASS_STATIC_BITS);
+        renderQueue.Add(IceCreamModel, model, 1, gps::RENDER_PASS_STATIC_BITS);
+        renderQueue.Add(PlaygroundModel, model, 1, gps::RENDER_PASS_STATIC_BITS);
+        renderQueue.Add(SceneModel, model, 1, gps::RENDER_PASS_STATIC_BITS);
+        renderQueue.Add(WheelModel, model, 1, gps::RENDER_PASS_STATIC_BITS);
+        renderQueue.Add(TreesModel, model, 1, gps::RENDER_PASS_STATIC_BITS);
     }
 
-    setModelUniforms(model);
-    PlaygroundModel.Draw(shader, flatFlag);
+    // during clap or cinematic appear/hold, draw hands without fog so they're in foreground
+    bool handsForeground = clapActive || (cinematicActive && (cinematicPhase == 1 || cinematicPhase == 2));
+    // Left hand, apply clap translation
+    glm::mat4 leftModel = glm::translate(model, glm::vec3(clapOffset, 0.0f, 0.0f));
+    renderQueue.Add(LeftHandsModel, leftModel, handsForeground ? 0 : 1);
 
-    // Rabbit, apply scaling (appearing from hat)
+    // Rabbit, apply scaling (appearing from hat); only drawn if scale > 0 (hidden when 0)
+    if (rabbitScale > 0.0f)
     {
-        glm::mat4 rabbitModel = model;
-        rabbitModel = glm::scale(rabbitModel, glm::vec3(rabbitScale, rabbitScale, rabbitScale));
-        setModelUniforms(rabbitModel);
-        // ensure render mode is applied for the rabbit explicitly
-        if (currentRenderMode == RENDER_WIREFRAME)
-            glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-        else if (currentRenderMode == RENDER_POINTS)
-        {
-            glPolygonMode(GL_FRONT_AND_BACK, GL_POINT);
-            glPointSize(4.0f);
-        }
-        else
-            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-        // ensure program active and set flat shading uniform specifically for the rabbit draw
-        shader.useShaderProgram();
-        if (flatShadingLoc != -1)
-        {
-            if (currentRenderMode == RENDER_POLYGONAL)
-                glUniform1i(flatShadingLoc, 1);
-            else
-                glUniform1i(flatShadingLoc, 0);
-        }
+        glm::mat4 rabbitModel = glm::scale(model, glm::vec3(rabbitScale, rabbitScale, rabbitScale));
         // disable fog while drawing the rabbit so its texture isn't fogged
-        if (fogEnabledLoc != -1)
-            glUniform1i(fogEnabledLoc, 0);
-        // only draw if scale > 0 (hidden when 0)
-        if (rabbitScale > 0.0f)
-        {
-            RabbitModel.Draw(shader, flatFlag);
-        }
-        if (fogEnabledLoc != -1)
-            glUniform1i(fogEnabledLoc, 1);
-        // restore polygon mode to current global preference
-        if (currentRenderMode == RENDER_WIREFRAME)
-            glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-        else if (currentRenderMode == RENDER_POINTS)
-            glPolygonMode(GL_FRONT_AND_BACK, GL_POINT);
-        else
-            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        renderQueue.Add(RabbitModel, rabbitModel, 0);
     }
 
     // Right hand, apply clap translation
-    {
-        glm::mat4 rightModel = model;
-        rightModel = glm::translate(rightModel, glm::vec3(-clapOffset, 0.0f, 0.0f));
-        setModelUniforms(rightModel);
-        bool handsForegroundR = clapActive || (cinematicActive && (cinematicPhase == 1 || cinematicPhase == 2));
-        if (handsForegroundR && fogEnabledLoc != -1)
-            glUniform1i(fogEnabledLoc, 0);
-        RightHandsModel.Draw(shader, flatFlag);
-        if (handsForegroundR && fogEnabledLoc != -1)
-            glUniform1i(fogEnabledLoc, 1);
-    }
-
-    setModelUniforms(model);
-    SceneModel.Draw(shader, flatFlag);
+    glm::mat4 rightModel = glm::translate(model, glm::vec3(-clapOffset, 0.0f, 0.0f));
+    renderQueue.Add(RightHandsModel, rightModel, handsForeground ? 0 : 1);
 
-    setModelUniforms(model);
     // Swing: apply rotation around its top pivot
     {
         // choose pivot near top of the model in model space
@@ -820,108 +875,74 @@ void renderModels(gps::Shader shader)
         // small forward/back rotation
         float swingAmplitudeDeg = 6.0f; // degrees
         float swingSpeed = 0.8f;        // oscillations per second
-        float angle = glm::radians(swingAmplitudeDeg) * sin((float)glfwGetTime() * swingSpeed);
-        glm::mat4 swingTransform = model * glm::translate(glm::mat4(1.0f), swingPivotModel) * glm::rotate(glm::mat4(1.0f), angle, glm::vec3(1.0f, 0.0f, 0.0f)) * glm::translate(glm::mat4(1.0f), -swingPivotModel);
-        setModelUniforms(swingTransform);
-        SwingModel.Draw(shader, flatFlag);
-        // restore shared model matrix for subsequent draws
-        setModelUniforms(model);
+        float angleSwing = glm::radians(swingAmplitudeDeg) * sin((float)glfwGetTime() * swingSpeed);
+        glm::mat4 swingTransform = model * glm::translate(glm::mat4(1.0f), swingPivotModel) * glm::rotate(glm::mat4(1.0f), angleSwing, glm::vec3(1.0f, 0.0f, 0.0f)) * glm::translate(glm::mat4(1.0f), -swingPivotModel);
+        renderQueue.Add(SwingModel, swingTransform, 1);
     }
-    setModelUniforms(model);
-    WheelModel.Draw(shader, flatFlag);
-
-    setModelUniforms(model);
-    TreesModel.Draw(shader, flatFlag);
 }
 
 void renderScene()
 {
-    // Render scene to depth map from light's perspective
-    glm::mat4 lightSpace = computeLightSpaceTrMatrix();
-    // render depth map
-    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-    glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-    glClear(GL_DEPTH_BUFFER_BIT);
-    glCheckError();
-    depthShader.useShaderProgram();
-    GLint lsLoc = glGetUniformLocation(depthShader.shaderProgram, "lightSpaceTrMatrix");
-    if (lsLoc != -1)
-        glUniformMatrix4fv(lsLoc, 1, GL_FALSE, glm::value_ptr(lightSpace));
-    // render scene geometry into depth map
-    // For depth pass we only need to set model matrix and draw meshes
-    glm::mat4 nmModel = model;
-    GLint dModelLoc = glGetUniformLocation(depthShader.shaderProgram, "model");
-    if (dModelLoc != -1)
-        glUniformMatrix4fv(dModelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    FerisWheelModel.Draw(depthShader, 0);
-    if (dModelLoc != -1)
-        glUniformMatrix4fv(dModelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    HatModel.Draw(depthShader, 0);
-    if (dModelLoc != -1)
-        glUniformMatrix4fv(dModelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    IceCreamModel.Draw(depthShader, 0);
-    // Left hands
+    // Render scene to depth map from light's perspective, one cascade per layer
+    glm::mat4 lightSpace[SHADOW_CASCADES];
+    float cascadeSplits[SHADOW_CASCADES];
+    computeCascades(lightSpace, cascadeSplits);
+    // one queue for both passes
+    queueModels();
+    // frame and draw blocks are uploaded once and read by both passes
+    updateFrameUniforms(lightSpace, cascadeSplits);
+    renderQueue.Upload(view);
+    // the occluders rasterize on the worker threads while the shadow pass is issued
+    if (OCCLUSION_CULLING)
     {
-        glm::mat4 leftModel = model;
-        leftModel = glm::translate(leftModel, glm::vec3(clapOffset, 0.0f, 0.0f));
-        if (dModelLoc != -1)
-            glUniformMatrix4fv(dModelLoc, 1, GL_FALSE, glm::value_ptr(leftModel));
-        LeftHandsModel.Draw(depthShader, 0);
+        occlusionCuller.Begin(projection * view, model);
     }
-    if (dModelLoc != -1)
-        glUniformMatrix4fv(dModelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    PlaygroundModel.Draw(depthShader, 0);
-    // Rabbit
-    {
-        glm::mat4 rabbitModel = model;
-        rabbitModel = glm::scale(rabbitModel, glm::vec3(rabbitScale, rabbitScale, rabbitScale));
-        if (dModelLoc != -1)
-            glUniformMatrix4fv(dModelLoc, 1, GL_FALSE, glm::value_ptr(rabbitModel));
-        if (rabbitScale > 0.0f)
-            RabbitModel.Draw(depthShader, 0);
-    }
-    // Right hand
-    {
-        glm::mat4 rightModel = model;
-        rightModel = glm::translate(rightModel, glm::vec3(-clapOffset, 0.0f, 0.0f));
-        if (dModelLoc != -1)
-            glUniformMatrix4fv(dModelLoc, 1, GL_FALSE, glm::value_ptr(rightModel));
-        RightHandsModel.Draw(depthShader, 0);
-    }
-    if (dModelLoc != -1)
-        glUniformMatrix4fv(dModelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    SceneModel.Draw(depthShader, 0);
-    // Swing
+    // render depth map
+    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+    glm::mat4 lightView = computeLightViewMatrix();
+    bool staticModelChanged = !staticShadowValid || model != staticShadowModel;
+    for (int i = 0; i < SHADOW_CASCADES; i++)
     {
-        glm::vec3 swingPivotModel = SwingModel.getMaxBounds();
-        float swingAmplitudeDeg = 6.0f;
-        float swingSpeed = 0.8f;
-        float angleSwing = glm::radians(swingAmplitudeDeg) * sin((float)glfwGetTime() * swingSpeed);
-        glm::mat4 swingTransform = model * glm::translate(glm::mat4(1.0f), swingPivotModel) * glm::rotate(glm::mat4(1.0f), angleSwing, glm::vec3(1.0f, 0.0f, 0.0f)) * glm::translate(glm::mat4(1.0f), -swingPivotModel);
-        if (dModelLoc != -1)
-            glUniformMatrix4fv(dModelLoc, 1, GL_FALSE, glm::value_ptr(swingTransform));
-        SwingModel.Draw(depthShader, 0);
-        if (dModelLoc != -1)
-            glUniformMatrix4fv(dModelLoc, 1, GL_FALSE, glm::value_ptr(model));
+        depthShader.setUniform(cascadeUniform, i);
+        // static casters are redrawn only when the cascade moved or their transform (Q/E rotation) changed
+        if (staticModelChanged || lightSpace[i] != staticShadowLightSpace[i])
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, staticDepthMapFBO[i]);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            staticDepthPass.view = lightView;
+            staticDepthPass.cullMatrix = lightSpace[i];
+            renderQueue.Sort(staticDepthPass);
+            renderQueue.Submit(staticDepthPass);
+            staticShadowLightSpace[i] = lightSpace[i];
+        }
+        // start from the cached static depth, then add the hands, swing and rabbit
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, staticDepthMapFBO[i]);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, depthMapFBO[i]);
+        glBlitFramebuffer(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT, 0, 0, SHADOW_WIDTH, SHADOW_HEIGHT, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO[i]);
+        glCheckError();
+        // render the moving casters into the layer, nearest to the light first
+        // shadow casters outside the cascade's light box cannot reach the layer
+        depthPass.view = lightView;
+        depthPass.cullMatrix = lightSpace[i];
+        renderQueue.Sort(depthPass);
+        renderQueue.Submit(depthPass);
     }
-    WheelModel.Draw(depthShader, 0);
-    TreesModel.Draw(depthShader, 0);
+    staticShadowModel = model;
+    staticShadowValid = true;
     // done depth pass
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glCheckError();
+    occlusionCuller.Finish();
     // restore viewport
     glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
-    // Render scene as usual, but bind depth map and provide lightSpace matrix
+    // Render scene as usual, but bind depth map; the light-space matrix is in the frame block
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    myBasicShader.useShaderProgram();
-    if (lightSpaceLoc != -1)
-        glUniformMatrix4fv(lightSpaceLoc, 1, GL_FALSE, glm::value_ptr(lightSpace));
-    if (shadowMapLoc != -1)
+    if (shadowMapUniform.isValid())
     {
-        glActiveTexture(GL_TEXTURE0 + 5);
-        glBindTexture(GL_TEXTURE_2D, depthMap);
+        // unit 5 keeps the depth map, so this is a no-op after the first frame
+        gps::GLState::BindTexture(5, GL_TEXTURE_2D_ARRAY, depthMap);
         glCheckError();
-        glActiveTexture(GL_TEXTURE0);
     }
 
     // render all models normally
@@ -929,26 +950,18 @@ void renderScene()
     glCheckError();
 
     // render rain overlay across the whole view
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glDepthMask(GL_FALSE);
+    gps::GLState::Enable(GL_BLEND);
+    gps::GLState::BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    gps::GLState::DepthMask(GL_FALSE);
     rainShader.useShaderProgram();
-    if (rainTimeLoc != -1)
-        glUniform1f(rainTimeLoc, (float)glfwGetTime());
-    if (rainCamPosLoc != -1)
-    {
-        glm::vec3 cp = myCamera.getPosition();
-        glUniform3fv(rainCamPosLoc, 1, glm::value_ptr(cp));
-    }
-    if (rainIntensityLoc != -1)
-        glUniform1f(rainIntensityLoc, rainIntensity);
-    if (rainColorLoc != -1)
-        glUniform3fv(rainColorLoc, 1, glm::value_ptr(rainColor));
-    glBindVertexArray(rainQuadVAO);
+    rainShader.setUniform(rainTimeUniform, (float)glfwGetTime());
+    rainShader.setUniform(rainCamPosUniform, myCamera.getPosition());
+    rainShader.setUniform(rainIntensityUniform, rainIntensity);
+    rainShader.setUniform(rainColorUniform, rainColor);
+    gps::GLState::BindVertexArray(rainQuadVAO);
     glDrawArrays(GL_TRIANGLES, 0, 6);
-    glBindVertexArray(0);
-    glDepthMask(GL_TRUE);
-    glDisable(GL_BLEND);
+    gps::GLState::DepthMask(GL_TRUE);
+    gps::GLState::Disable(GL_BLEND);
 
     // draw skybox last
     mySkyBox.Draw(skyboxShader, view, projection);
@@ -982,8 +995,6 @@ void updateCinematic(float delta)
         myCamera.setPosition(pos);
         myCamera.setTarget(hatCenterWorld);
         view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
         if (t >= 1.0f)
         {
             cinematicPhase = 1;
@@ -1000,8 +1011,6 @@ void updateCinematic(float delta)
         myCamera.setPosition(nearPos);
         myCamera.setTarget(hatCenterWorld);
         view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
         if (t >= 1.0f)
         {
             // transition to hands-focus phase
@@ -1025,8 +1034,6 @@ void updateCinematic(float delta)
         myCamera.setPosition(pos);
         myCamera.setTarget(handsCenter);
         view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
         // once camera move completes, continue
         clapActive = true;
         if (moveT >= 1.0f)
@@ -1077,8 +1084,6 @@ void updateCinematic(float delta)
             myCamera.setPosition(pos);
             myCamera.setTarget(targets[cinematicExploreIndex]);
             view = myCamera.getViewMatrix();
-            myBasicShader.useShaderProgram();
-            glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 
             if (t >= 1.0f)
             {
@@ -1098,8 +1103,6 @@ void updateCinematic(float delta)
         myCamera.setPosition(pos);
         myCamera.setTarget(target);
         view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
         if (t >= 1.0f)
         {
             cinematicPhase = 5;
@@ -1141,6 +1144,7 @@ int main(int argc, const char *argv[])
     myCamera.setMovementBounds(
         glm::vec3(-16.6564f, 1.5543f, -20.506f),
         glm::vec3(27.2437f, 18.518449f, 19.3505f));
+    initVisibility();
     initUniforms();
     setWindowCallbacks();
 
@@ -1156,6 +1160,8 @@ int main(int argc, const char *argv[])
         updateCinematic(delta);
 
         processMovement();
+        // count state changes issued and saved per frame
+        gps::GLState::BeginFrame();
         renderScene();
 
         glfwPollEvents();
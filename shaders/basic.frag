@@ -1,40 +1,45 @@
 #version 410 core
 
-in vec3 fPosition;
 in vec3 fNormal;
 in vec2 fTexCoords;
-in vec4 fFragPosLightSpace;
+in vec3 fPosEye;
+in vec3 fPosWorld;
 
 out vec4 fColor;
 
+// per-frame data, see FrameUniforms in SceneUniforms.hpp
+layout(std140) uniform FrameBlock {
+    mat4 view;
+    mat4 projection;
+    mat4 lightSpaceTrMatrix[4];
+    vec4 lightDirEye;
+    vec4 lightColor;
+    vec4 spotPosEye[2];
+    vec4 spotDirEye[2];
+    vec4 spotAttenuation[2];
+    vec4 fogColor;
+    vec4 fogCenter;
+    vec4 fogInvRadius2;
+    vec4 cascadeSplits;
+};
+
+// per-draw data, see DrawUniforms in SceneUniforms.hpp
+layout(std140) uniform DrawBlock {
+    mat4 model;
+    mat4 normalMatrix;
+    vec4 materialDiffuse;
+    ivec4 drawFlags;
+};
+
 // shader uniforms
-uniform mat4 model;
-uniform mat4 view;
-uniform mat3 normalMatrix;
-uniform vec3 lightDir;
-uniform vec3 lightColor;
-uniform vec3 spotPos[2];
-uniform vec3 spotDir[2];
-uniform float spotConstant[2];
-uniform float spotLinear[2];
-uniform float spotQuadratic[2];
-uniform float spotCutoffCos[2];
-uniform float spotIntensity[2];
-uniform vec3 fogColor;
-uniform float fogDensity;
-uniform float fogRadius;
-uniform float fogRadiusX;
-uniform float fogStretchDown;
-uniform vec3 hatCenterWorld;
-uniform int fogEnabled;
-uniform float fogTime;
 uniform int flatShading;
 uniform sampler2D diffuseTexture;
 uniform sampler2D specularTexture;
-uniform vec3 materialDiffuse;
-uniform int hasDiffuseTexture;
-uniform int hasSpecularTexture;
-uniform sampler2D shadowMap;
+// depth compared in hardware, each lookup returns the lit fraction of a bilinear 2x2 footprint
+uniform sampler2DArrayShadow shadowMap;
+// 0: one 2x2 lookup, 1: 16-tap Poisson disk, 2: Poisson disk stopping after its four outer
+// taps when they agree (fully lit or fully shadowed)
+uniform int shadowFilter;
 
 vec3 ambient;
 float ambientStrength = 0.2f;
@@ -42,87 +47,113 @@ vec3 diffuse;
 vec3 specular;
 float specularStrength = 0.5f;
 
+// Poisson disk in unit radius; the first four taps lie in different quadrants near the rim
+const vec2 POISSON_DISK[16] = vec2[](
+    vec2(0.97484398, 0.75648379), vec2(-0.81409955, 0.91437590),
+    vec2(-0.81544232, -0.87912464), vec2(0.94558609, -0.76890725),
+    vec2(-0.94201624, -0.39906216), vec2(-0.094184101, -0.92938870),
+    vec2(0.34495938, 0.29387760), vec2(-0.91588581, 0.45771432),
+    vec2(-0.38277543, 0.27676845), vec2(0.44323325, -0.97511554),
+    vec2(0.53742981, -0.47373420), vec2(-0.26496911, -0.41893023),
+    vec2(0.79197514, 0.19090188), vec2(-0.24188840, 0.99706507),
+    vec2(0.19984126, 0.78641367), vec2(0.14383161, -0.14100790)
+);
+// disk radius in shadow-map texels
+const float POISSON_RADIUS = 2.0;
+
 // Shadow calculation helper
-float ShadowCalculation(vec4 fragPosLightSpace, vec3 normalEye) {
+float ShadowCalculation(vec3 posWorld, float viewDepth, vec3 normalEye) {
+    // first cascade reaching the fragment; past the last split nothing is shadowed
+    int cascade = 0;
+    while (cascade < 4 && viewDepth > cascadeSplits[cascade])
+        ++cascade;
+    if (cascade == 4)
+        return 0.0;
+    vec4 fragPosLightSpace = lightSpaceTrMatrix[cascade] * vec4(posWorld, 1.0);
     // perspective divide
     vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
     // transform to [0,1]
     projCoords = projCoords * 0.5 + 0.5;
     // if outside shadow map, not in shadow
     if (projCoords.z > 1.0) return 0.0;
-    // get closest depth from light's perspective (using [0,1] coords)
-    float closestDepth = texture(shadowMap, projCoords.xy).r;
     // current depth
     float currentDepth = projCoords.z;
     // reduce shadow acne
-    float bias = max(0.0025 * (1.0 - dot(normalEye, normalize(vec3(view * vec4(lightDir,0.0))))), 0.0005);
-    // PCF sampling
-    float shadow = 0.0;
-    float texelSize = 1.0 / 2048.0;
-    for(int x = -1; x <= 1; ++x) {
-        for(int y = -1; y <= 1; ++y) {
-            float pcfDepth = texture(shadowMap, projCoords.xy + vec2(x, y) * texelSize).r;
-            shadow += currentDepth - bias > pcfDepth ? 1.0 : 0.0;
-        }
-    }
-    shadow /= 9.0;
+    float bias = max(0.0025 * (1.0 - dot(normalEye, lightDirEye.xyz)), 0.0005);
+    float reference = currentDepth - bias;
+    float layer = float(cascade);
+    if (shadowFilter == 0)
+        return 1.0 - texture(shadowMap, vec4(projCoords.xy, layer, reference));
+
+    // Poisson taps, each a hardware-filtered 2x2 comparison, spaced from the actual map size
+    vec2 tapScale = POISSON_RADIUS / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    for (int i = 0; i < 4; ++i)
+        lit += texture(shadowMap, vec4(projCoords.xy + POISSON_DISK[i] * tapScale, layer, reference));
+    if (shadowFilter == 2 && (lit == 0.0 || lit == 4.0))
+        return 1.0 - lit * 0.25;
+    for (int i = 4; i < 16; ++i)
+        lit += texture(shadowMap, vec4(projCoords.xy + POISSON_DISK[i] * tapScale, layer, reference));
+    float shadow = 1.0 - lit / 16.0;
     return shadow;
 }
 
 void main() 
 {
-    // compute fragment positions
-    vec4 fPosEye = view * model * vec4(fPosition, 1.0);
-    vec3 fragPosWorld = vec3(model * vec4(fPosition, 1.0));
+    // fragment positions are interpolated from the vertex shader
+    vec3 fragPosWorld = fPosWorld;
+    mat3 normalMatrix3 = mat3(normalMatrix);
 
     // choose normal
     vec3 normalEye;
     if (flatShading == 1) {
         // compute geometric normal in world space using derivatives
         vec3 geomNormalWorld = normalize(cross(dFdx(fragPosWorld), dFdy(fragPosWorld)));
-        normalEye = normalize(normalMatrix * geomNormalWorld);
+        normalEye = normalize(normalMatrix3 * geomNormalWorld);
     } else {
-        normalEye = normalize(normalMatrix * fNormal);
+        normalEye = normalize(normalMatrix3 * fNormal);
     }
 
-    // normalize directional light direction
-    vec3 lightDirN = vec3(normalize(view * vec4(lightDir, 0.0f)));
+    // directional light, already normalized in eye space
+    vec3 lightDirN = lightDirEye.xyz;
+    vec3 lightRgb = lightColor.rgb;
 
     // view direction
-    vec3 viewDir = normalize(- fPosEye.xyz);
+    vec3 viewDir = normalize(- fPosEye);
 
     //compute base directional ambient/diffuse/specular
-    ambient = ambientStrength * lightColor;
-    diffuse = max(dot(normalEye, lightDirN), 0.0f) * lightColor;
+    ambient = ambientStrength * lightRgb;
+    diffuse = max(dot(normalEye, lightDirN), 0.0f) * lightRgb;
     vec3 reflectDir = reflect(-lightDirN, normalEye);
     float specCoeff = pow(max(dot(viewDir, reflectDir), 0.0f), 32);
-    specular = specularStrength * specCoeff * lightColor;
+    specular = specularStrength * specCoeff * lightRgb;
 
     // add contributions from spotlights
     vec3 spotAmbient = vec3(0.0);
     vec3 spotDiffuse = vec3(0.0);
     vec3 spotSpecular = vec3(0.0);
     for (int i = 0; i < 2; ++i) {
-        vec3 spotPosEye = vec3(view * vec4(spotPos[i], 1.0));
-        vec3 spotDirEye = normalize(vec3(view * vec4(spotDir[i], 0.0)));
-        vec3 lightDirSpot = normalize(spotPosEye - fPosEye.xyz);
-        float theta = dot(normalize(spotDirEye), lightDirSpot);
-        float dist = length(spotPosEye - fPosEye.xyz);
-        float att = 1.0 / (spotConstant[i] + spotLinear[i] * dist + spotQuadratic[i] * (dist * dist));
-        if (theta > spotCutoffCos[i]) {
-            float spotEffect = pow(theta, 20.0);
-            spotAmbient += att * ambientStrength * lightColor * spotEffect * spotIntensity[i];
+        // spot positions and directions arrive in eye space
+        vec3 toSpot = spotPosEye[i].xyz - fPosEye;
+        float dist = length(toSpot);
+        vec3 lightDirSpot = toSpot / dist;
+        float theta = dot(spotDirEye[i].xyz, lightDirSpot);
+        if (theta > spotDirEye[i].w) {
+            vec4 attenuation = spotAttenuation[i];
+            float att = 1.0 / (attenuation.x + attenuation.y * dist + attenuation.z * (dist * dist));
+            vec3 spotLight = att * lightRgb * pow(theta, 20.0) * attenuation.w;
+            spotAmbient += ambientStrength * spotLight;
             float diff = max(dot(normalEye, lightDirSpot), 0.0);
-            spotDiffuse += att * diff * lightColor * spotEffect * spotIntensity[i];
+            spotDiffuse += diff * spotLight;
             vec3 reflectSpot = reflect(-lightDirSpot, normalEye);
             float specC = pow(max(dot(viewDir, reflectSpot), 0.0), 32);
-            spotSpecular += att * specularStrength * specC * lightColor * spotEffect * spotIntensity[i];
+            spotSpecular += specularStrength * specC * spotLight;
         }
     }
 
     // determine diffuse color
-    vec3 diffCol = hasDiffuseTexture == 1 ? texture(diffuseTexture, fTexCoords).rgb : materialDiffuse;
-    vec3 specCol = hasSpecularTexture == 1 ? texture(specularTexture, fTexCoords).rgb : vec3(1.0);
+    vec3 diffCol = drawFlags.y == 1 ? texture(diffuseTexture, fTexCoords).rgb : materialDiffuse.rgb;
+    vec3 specCol = drawFlags.z == 1 ? texture(specularTexture, fTexCoords).rgb : vec3(1.0);
 
     // combine directional and spot contributions
     vec3 totalAmbient = ambient + spotAmbient;
@@ -130,30 +161,30 @@ void main()
     vec3 totalSpecular = specular + spotSpecular;
 
     // compute shadow and final color
-    float shadow = ShadowCalculation(fFragPosLightSpace, normalEye);
+    float shadow = ShadowCalculation(fPosWorld, -fPosEye.z, normalEye);
     vec3 lit = (totalAmbient + (1.0 - shadow) * totalDiffuse) * diffCol + (1.0 - shadow) * totalSpecular * specCol;
     vec3 color = min(lit, 1.0f);
 
     // compute ellipsoidal mask around hat center
-    vec3 delta = fragPosWorld - hatCenterWorld;
+    vec3 delta = fragPosWorld - fogCenter.xyz;
     float dx = delta.x;
     float dy = delta.y;
     float dz = delta.z;
+    float fogTime = fogCenter.w;
 
-    float rx = fogRadiusX;
-    float rz = fogRadius;
-    float ry = dy < 0.0 ? fogRadius * fogStretchDown : fogRadius * 0.9;
+    // inverse squared radii are precomputed per frame; the vertical one depends on the side
+    float invRy2 = dy < 0.0 ? fogInvRadius2.z : fogInvRadius2.w;
     float wobble = sin(fogTime * 1.2 + (dx + dz) * 0.5) * 0.25;
     dy += wobble;
-    float nd = sqrt((dx*dx)/(rx*rx) + (dz*dz)/(rz*rz) + (dy*dy)/(ry*ry));
+    float nd = sqrt(dx*dx * fogInvRadius2.x + dz*dz * fogInvRadius2.y + dy*dy * invRy2);
     float mask = clamp(1.0 - nd, 0.0, 1.0);
 
-    float fogStrength = clamp(mask * fogDensity, 0.0, 1.0) * float(fogEnabled);
+    float fogStrength = clamp(mask * fogColor.a, 0.0, 1.0) * float(drawFlags.x);
 
     // swirling modulation
     float swirl = 0.85 + 0.15 * sin(3.0 * (dx + dz) + fogTime * 2.0);
     fogStrength *= swirl;
 
     vec4 litColor = vec4(color, 1.0);
-    fColor = mix(litColor, vec4(fogColor, 1.0), fogStrength);
+    fColor = mix(litColor, vec4(fogColor.rgb, 1.0), fogStrength);
 }
@@ -4,21 +4,57 @@ layout(location=0) in vec3 vPosition;
 layout(location=1) in vec3 vNormal;
 layout(location=2) in vec2 vTexCoords;
 
-out vec3 fPosition;
 out vec3 fNormal;
 out vec2 fTexCoords;
-out vec4 fFragPosLightSpace;
+out vec3 fPosEye;
+out vec3 fPosWorld;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat4 lightSpaceTrMatrix;
+// per-frame data, see FrameUniforms in SceneUniforms.hpp
+layout(std140) uniform FrameBlock {
+	mat4 view;
+	mat4 projection;
+	mat4 lightSpaceTrMatrix[4];
+	vec4 lightDirEye;
+	vec4 lightColor;
+	vec4 spotPosEye[2];
+	vec4 spotDirEye[2];
+	vec4 spotAttenuation[2];
+	vec4 fogColor;
+	vec4 fogCenter;
+	vec4 fogInvRadius2;
+	vec4 cascadeSplits;
+};
+
+// per-draw data, see DrawUniforms in SceneUniforms.hpp
+layout(std140) uniform DrawBlock {
+	mat4 model;
+	mat4 normalMatrix;
+	vec4 materialDiffuse;
+	ivec4 drawFlags;
+};
+
+// instance placements, four texels per mat4, see MeshArena
+uniform samplerBuffer instanceTransforms;
+
+// placement of the current instance, identity for meshes drawn once
+mat4 instanceTransform()
+{
+	if (drawFlags.w < 0)
+		return mat4(1.0f);
+	int texel = (drawFlags.w + gl_InstanceID) * 4;
+	return mat4(texelFetch(instanceTransforms, texel), texelFetch(instanceTransforms, texel + 1),
+				texelFetch(instanceTransforms, texel + 2), texelFetch(instanceTransforms, texel + 3));
+}
 
 void main() 
 {
-	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
-	fPosition = vPosition;
-	fNormal = vNormal;
+	// placements are rigid, so they rotate normals as they rotate positions
+	mat4 instance = instanceTransform();
+	vec4 posWorld = model * instance * vec4(vPosition, 1.0f);
+	vec4 posEye = view * posWorld;
+	gl_Position = projection * posEye;
+	fNormal = mat3(instance) * vNormal;
 	fTexCoords = vTexCoords;
-	fFragPosLightSpace = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
+	fPosEye = posEye.xyz;
+	fPosWorld = posWorld.xyz;
 }
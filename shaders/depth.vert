@@ -2,9 +2,44 @@
 
 layout(location=0) in vec3 vPosition;
 
-uniform mat4 model;
-uniform mat4 lightSpaceTrMatrix;
+// per-frame data, see FrameUniforms in SceneUniforms.hpp
+layout(std140) uniform FrameBlock {
+    mat4 view;
+    mat4 projection;
+    mat4 lightSpaceTrMatrix[4];
+    vec4 lightDirEye;
+    vec4 lightColor;
+    vec4 spotPosEye[2];
+    vec4 spotDirEye[2];
+    vec4 spotAttenuation[2];
+    vec4 fogColor;
+    vec4 fogCenter;
+    vec4 fogInvRadius2;
+    vec4 cascadeSplits;
+};
+
+// per-draw data, see DrawUniforms in SceneUniforms.hpp
+layout(std140) uniform DrawBlock {
+    mat4 model;
+    mat4 normalMatrix;
+    vec4 materialDiffuse;
+    ivec4 drawFlags;
+};
+
+// shadow cascade being rendered
+uniform int cascade;
+
+// instance placements, four texels per mat4, see MeshArena
+uniform samplerBuffer instanceTransforms;
+
+mat4 instanceTransform() {
+    if (drawFlags.w < 0)
+        return mat4(1.0);
+    int texel = (drawFlags.w + gl_InstanceID) * 4;
+    return mat4(texelFetch(instanceTransforms, texel), texelFetch(instanceTransforms, texel + 1),
+                texelFetch(instanceTransforms, texel + 2), texelFetch(instanceTransforms, texel + 3));
+}
 
 void main() {
-    gl_Position = lightSpaceTrMatrix * model * vec4(vPosition, 1.0);
+    gl_Position = lightSpaceTrMatrix[cascade] * model * instanceTransform() * vec4(vPosition, 1.0);
 }
@@ -37,6 +37,7 @@
 #ifndef TINY_OBJ_LOADER_H_
 #define TINY_OBJ_LOADER_H_
 
+#include <functional>
 #include <map>
 #include <string>
 #include <vector>
@@ -228,6 +229,34 @@ namespace tinyobj {
                  std::istream *inStream, MaterialReader *readMatFn = NULL,
                  bool triangulate = true);
     
+    /// Runs job(0) .. job(count - 1), possibly concurrently, and returns once all
+    /// of them have finished. Lets the caller parse chunks on its own thread pool.
+    typedef std::function<void(size_t count, const std::function<void(size_t)> &job)> ParallelFor;
+    
+    /// Loads .obj from a file using several threads.
+    /// The file is memory mapped and split into line-aligned chunks whose
+    /// `v`/`vn`/`vt`/`f` records are parsed concurrently. The chunks are then
+    /// merged in file order, so the output is identical to LoadObj().
+    /// 'num_threads' is optional, 0 uses the hardware concurrency.
+    /// 'parallel_for' is optional; without it the extra chunks run on threads
+    /// started for this call.
+    /// 'readMatFn' is optional and replaces the reader of .mtl files under
+    /// 'mtl_basepath'.
+    bool LoadObjParallel(attrib_t *attrib, std::vector<shape_t> *shapes,
+                         std::vector<material_t> *materials, std::string *err,
+                         const char *filename, const char *mtl_basepath = NULL,
+                         bool triangulate = true, unsigned int num_threads = 0,
+                         const ParallelFor &parallel_for = ParallelFor(),
+                         MaterialReader *readMatFn = NULL);
+    
+    /// Same as LoadObjParallel() for .obj data that is already in memory.
+    bool LoadObjFromBuffer(attrib_t *attrib, std::vector<shape_t> *shapes,
+                           std::vector<material_t> *materials, std::string *err,
+                           const char *buffer, size_t buffer_size,
+                           MaterialReader *readMatFn = NULL,
+                           bool triangulate = true, unsigned int num_threads = 0,
+                           const ParallelFor &parallel_for = ParallelFor());
+    
     /// Loads materials into std::map
     void LoadMtl(std::map<std::string, int> *material_map,
                  std::vector<material_t> *materials, std::istream *inStream);
@@ -246,12 +275,35 @@ namespace tinyobj {
 #include <fstream>
 #include <sstream>
 
+#include <climits>
+#include <thread>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace tinyobj {
     
     MaterialReader::~MaterialReader() {}
     
 #define TINYOBJ_SSCANF_BUFFER_SIZE (4096)
     
+    // Smallest amount of .obj text worth handing to a separate thread.
+#ifndef TINYOBJ_PARALLEL_MIN_CHUNK_SIZE
+#define TINYOBJ_PARALLEL_MIN_CHUNK_SIZE (256 * 1024)
+#endif
+    
     struct vertex_index {
         int v_idx, vt_idx, vn_idx;
         vertex_index() : v_idx(-1), vt_idx(-1), vn_idx(-1) {}
@@ -1655,6 +1707,585 @@ namespace tinyobj {
         
         return true;
     }
+    
+    // Below is the parallel loader. Worker threads tokenize line-aligned chunks
+    // of the file; face indices are kept raw because relative indices depend on
+    // vertex counts of preceding chunks, and directives that change the shape
+    // state (usemtl, mtllib, g, o, t) are replayed in order during the merge.
+    
+    // Marks an index component that is absent from a face triple.
+    static const int kMissingIndex = INT_MIN;
+    
+    struct raw_triple {
+        int v_idx, vt_idx, vn_idx;
+    };
+    
+    struct deferred_face {
+        // number of v/vn/vt records read by this chunk before the face
+        int v_count, vn_count, vt_count;
+        size_t first_triple;
+        size_t num_triples;
+    };
+    
+    struct deferred_command {
+        bool is_face;
+        size_t index;  // into faces or directives
+    };
+    
+    struct obj_chunk {
+        const char *begin;
+        const char *end;
+        std::vector<float> v;
+        std::vector<float> vn;
+        std::vector<float> vt;
+        std::vector<raw_triple> triples;
+        std::vector<deferred_face> faces;
+        std::vector<std::string> directives;
+        std::vector<deferred_command> commands;
+    };
+    
+    // Same triple grammar as parseTriple(), but indices are resolved later.
+    static raw_triple parseDeferredTriple(const char **token) {
+        raw_triple rt;
+        rt.v_idx = kMissingIndex;
+        rt.vt_idx = kMissingIndex;
+        rt.vn_idx = kMissingIndex;
+        
+        rt.v_idx = atoi((*token));
+        (*token) += strcspn((*token), "/ \t\r");
+        if ((*token)[0] != '/') {
+            return rt;
+        }
+        (*token)++;
+        
+        // i//k
+        if ((*token)[0] == '/') {
+            (*token)++;
+            rt.vn_idx = atoi((*token));
+            (*token) += strcspn((*token), "/ \t\r");
+            return rt;
+        }
+        
+        // i/j/k or i/j
+        rt.vt_idx = atoi((*token));
+        (*token) += strcspn((*token), "/ \t\r");
+        if ((*token)[0] != '/') {
+            return rt;
+        }
+        
+        // i/j/k
+        (*token)++;  // skip '/'
+        rt.vn_idx = atoi((*token));
+        (*token) += strcspn((*token), "/ \t\r");
+        return rt;
+    }
+    
+    static inline int resolveIndex(int raw, int n) {
+        return raw == kMissingIndex ? -1 : fixIndex(raw, n);
+    }
+    
+    // Reads one line with the same end-of-line rules as safeGetline().
+    static const char *nextLine(const char *p, const char *end,
+                                std::string *line) {
+        const char *start = p;
+        while (p < end && *p != '\n' && *p != '\r') p++;
+        line->assign(start, p);
+        if (p < end) {
+            if (*p == '\r' && p + 1 < end && p[1] == '\n') p++;
+            p++;
+        }
+        return p;
+    }
+    
+    static void parseChunk(obj_chunk *chunk) {
+        std::string linebuf;
+        const char *p = chunk->begin;
+        while (p < chunk->end) {
+            p = nextLine(p, chunk->end, &linebuf);
+            
+            // Skip if empty line.
+            if (linebuf.empty()) {
+                continue;
+            }
+            
+            // Skip leading space.
+            const char *token = linebuf.c_str();
+            token += strspn(token, " \t");
+            
+            if (token[0] == '\0') continue;  // empty line
+            
+            if (token[0] == '#') continue;  // comment line
+            
+            // vertex
+            if (token[0] == 'v' && IS_SPACE((token[1]))) {
+                token += 2;
+                float x, y, z;
+                parseFloat3(&x, &y, &z, &token);
+                chunk->v.push_back(x);
+                chunk->v.push_back(y);
+                chunk->v.push_back(z);
+                continue;
+            }
+            
+            // normal
+            if (token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2]))) {
+                token += 3;
+                float x, y, z;
+                parseFloat3(&x, &y, &z, &token);
+                chunk->vn.push_back(x);
+                chunk->vn.push_back(y);
+                chunk->vn.push_back(z);
+                continue;
+            }
+            
+            // texcoord
+            if (token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2]))) {
+                token += 3;
+                float x, y;
+                parseFloat2(&x, &y, &token);
+                chunk->vt.push_back(x);
+                chunk->vt.push_back(y);
+                continue;
+            }
+            
+            // face
+            if (token[0] == 'f' && IS_SPACE((token[1]))) {
+                token += 2;
+                token += strspn(token, " \t");
+                
+                deferred_face face;
+                face.v_count = static_cast<int>(chunk->v.size() / 3);
+                face.vn_count = static_cast<int>(chunk->vn.size() / 3);
+                face.vt_count = static_cast<int>(chunk->vt.size() / 2);
+                face.first_triple = chunk->triples.size();
+                
+                while (!IS_NEW_LINE(token[0])) {
+                    chunk->triples.push_back(parseDeferredTriple(&token));
+                    size_t n = strspn(token, " \t\r");
+                    token += n;
+                }
+                face.num_triples = chunk->triples.size() - face.first_triple;
+                
+                deferred_command command;
+                command.is_face = true;
+                command.index = chunk->faces.size();
+                chunk->faces.push_back(face);
+                chunk->commands.push_back(command);
+                continue;
+            }
+            
+            // directives that change the shape state are replayed in order
+            if (((0 == strncmp(token, "usemtl", 6)) && IS_SPACE((token[6]))) ||
+                ((0 == strncmp(token, "mtllib", 6)) && IS_SPACE((token[6]))) ||
+                (token[0] == 'g' && IS_SPACE((token[1]))) ||
+                (token[0] == 'o' && IS_SPACE((token[1]))) ||
+                (token[0] == 't' && IS_SPACE((token[1])))) {
+                deferred_command command;
+                command.is_face = false;
+                command.index = chunk->directives.size();
+                chunk->directives.push_back(std::string(token));
+                chunk->commands.push_back(command);
+            }
+            
+            // Ignore unknown command.
+        }
+    }
+    
+    bool LoadObjFromBuffer(attrib_t *attrib, std::vector<shape_t> *shapes,
+                           std::vector<material_t> *materials, std::string *err,
+                           const char *buffer, size_t buffer_size,
+                           MaterialReader *readMatFn /*= NULL*/,
+                           bool triangulate, unsigned int num_threads,
+                           const ParallelFor &parallel_for) {
+        std::stringstream errss;
+        
+        if (num_threads == 0) {
+            num_threads = std::thread::hardware_concurrency();
+        }
+        // small files are not worth the thread start-up cost
+        size_t max_chunks = buffer_size / TINYOBJ_PARALLEL_MIN_CHUNK_SIZE + 1;
+        if (num_threads == 0) num_threads = 1;
+        if (num_threads > max_chunks) num_threads = static_cast<unsigned int>(max_chunks);
+        
+        // Split into chunks that start right after a line ending.
+        const char *buffer_end = buffer + buffer_size;
+        std::vector<obj_chunk> chunks(num_threads);
+        const char *chunk_begin = buffer;
+        for (unsigned int t = 0; t < num_threads; t++) {
+            const char *chunk_end = buffer_end;
+            if (t + 1 < num_threads) {
+                chunk_end = buffer + (buffer_size / num_threads) * (t + 1);
+                if (chunk_end < chunk_begin) chunk_end = chunk_begin;
+                while (chunk_end < buffer_end && *chunk_end != '\n' &&
+                       *chunk_end != '\r') {
+                    chunk_end++;
+                }
+                if (chunk_end < buffer_end) {
+                    if (*chunk_end == '\r' && chunk_end + 1 < buffer_end &&
+                        chunk_end[1] == '\n') {
+                        chunk_end++;
+                    }
+                    chunk_end++;
+                }
+            }
+            chunks[t].begin = chunk_begin;
+            chunks[t].end = chunk_end;
+            chunk_begin = chunk_end;
+        }
+        
+        if (num_threads == 1) {
+            parseChunk(&chunks[0]);
+        } else if (parallel_for) {
+            parallel_for(chunks.size(), [&chunks](size_t t) { parseChunk(&chunks[t]); });
+        } else {
+            std::vector<std::thread> workers;
+            workers.reserve(num_threads - 1);
+            for (unsigned int t = 1; t < num_threads; t++) {
+                workers.push_back(std::thread(parseChunk, &chunks[t]));
+            }
+            parseChunk(&chunks[0]);
+            for (size_t t = 0; t < workers.size(); t++) {
+                workers[t].join();
+            }
+        }
+        
+        // Concatenate vertex attributes in file order.
+        size_t v_total = 0, vn_total = 0, vt_total = 0;
+        for (size_t t = 0; t < chunks.size(); t++) {
+            v_total += chunks[t].v.size();
+            vn_total += chunks[t].vn.size();
+            vt_total += chunks[t].vt.size();
+        }
+        std::vector<float> v;
+        std::vector<float> vn;
+        std::vector<float> vt;
+        v.reserve(v_total);
+        vn.reserve(vn_total);
+        vt.reserve(vt_total);
+        for (size_t t = 0; t < chunks.size(); t++) {
+            v.insert(v.end(), chunks[t].v.begin(), chunks[t].v.end());
+            vn.insert(vn.end(), chunks[t].vn.begin(), chunks[t].vn.end());
+            vt.insert(vt.end(), chunks[t].vt.begin(), chunks[t].vt.end());
+        }
+        
+        // Replay faces and directives in order, exactly like LoadObj().
+        std::vector<tag_t> tags;
+        std::vector<std::vector<vertex_index> > faceGroup;
+        std::string name;
+        
+        // material
+        std::map<std::string, int> material_map;
+        int material = -1;
+        
+        shape_t shape;
+        
+        int v_offset = 0, vn_offset = 0, vt_offset = 0;
+        for (size_t t = 0; t < chunks.size(); t++) {
+            const obj_chunk &chunk = chunks[t];
+            
+            for (size_t c = 0; c < chunk.commands.size(); c++) {
+                const deferred_command &command = chunk.commands[c];
+                
+                if (command.is_face) {
+                    const deferred_face &df = chunk.faces[command.index];
+                    int vsize = v_offset + df.v_count;
+                    int vnsize = vn_offset + df.vn_count;
+                    int vtsize = vt_offset + df.vt_count;
+                    
+                    std::vector<vertex_index> face;
+                    face.reserve(df.num_triples);
+                    for (size_t k = 0; k < df.num_triples; k++) {
+                        const raw_triple &rt = chunk.triples[df.first_triple + k];
+                        vertex_index vi(-1);
+                        vi.v_idx = fixIndex(rt.v_idx, vsize);
+                        vi.vt_idx = resolveIndex(rt.vt_idx, vtsize);
+                        vi.vn_idx = resolveIndex(rt.vn_idx, vnsize);
+                        face.push_back(vi);
+                    }
+                    
+                    faceGroup.push_back(std::vector<vertex_index>());
+                    faceGroup[faceGroup.size() - 1].swap(face);
+                    continue;
+                }
+                
+                const char *token = chunk.directives[command.index].c_str();
+                
+                // use mtl
+                if ((0 == strncmp(token, "usemtl", 6)) && IS_SPACE((token[6]))) {
+                    char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
+                    token += 7;
+#ifdef _MSC_VER
+                    sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
+#else
+                    sscanf(token, "%s", namebuf);
+#endif
+                    
+                    int newMaterialId = -1;
+                    if (material_map.find(namebuf) != material_map.end()) {
+                        newMaterialId = material_map[namebuf];
+                    }
+                    
+                    if (newMaterialId != material) {
+                        exportFaceGroupToShape(&shape, faceGroup, tags, material, name,
+                                               triangulate);
+                        faceGroup.clear();
+                        material = newMaterialId;
+                    }
+                    
+                    continue;
+                }
+                
+                // load mtl
+                if ((0 == strncmp(token, "mtllib", 6)) && IS_SPACE((token[6]))) {
+                    if (readMatFn) {
+                        char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
+                        token += 7;
+#ifdef _MSC_VER
+                        sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
+#else
+                        sscanf(token, "%s", namebuf);
+#endif
+                        
+                        std::string err_mtl;
+                        bool ok = (*readMatFn)(namebuf, materials, &material_map, &err_mtl);
+                        if (err) {
+                            (*err) += err_mtl;
+                        }
+                        
+                        if (!ok) {
+                            faceGroup.clear();  // for safety
+                            return false;
+                        }
+                    }
+                    
+                    continue;
+                }
+                
+                // group name
+                if (token[0] == 'g' && IS_SPACE((token[1]))) {
+                    // flush previous face group.
+                    bool ret = exportFaceGroupToShape(&shape, faceGroup, tags, material,
+                                                      name, triangulate);
+                    if (ret) {
+                        shapes->push_back(shape);
+                    }
+                    
+                    shape = shape_t();
+                    faceGroup.clear();
+                    
+                    std::vector<std::string> names;
+                    names.reserve(2);
+                    
+                    while (!IS_NEW_LINE(token[0])) {
+                        std::string str = parseString(&token);
+                        names.push_back(str);
+                        token += strspn(token, " \t\r");  // skip tag
+                    }
+                    
+                    // names[0] must be 'g', so skip the 0th element.
+                    if (names.size() > 1) {
+                        name = names[1];
+                    } else {
+                        name = "";
+                    }
+                    
+                    continue;
+                }
+                
+                // object name
+                if (token[0] == 'o' && IS_SPACE((token[1]))) {
+                    // flush previous face group.
+                    bool ret = exportFaceGroupToShape(&shape, faceGroup, tags, material,
+                                                      name, triangulate);
+                    if (ret) {
+                        shapes->push_back(shape);
+                    }
+                    
+                    faceGroup.clear();
+                    shape = shape_t();
+                    
+                    char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
+                    token += 2;
+#ifdef _MSC_VER
+                    sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
+#else
+                    sscanf(token, "%s", namebuf);
+#endif
+                    name = std::string(namebuf);
+                    
+                    continue;
+                }
+                
+                if (token[0] == 't' && IS_SPACE(token[1])) {
+                    tag_t tag;
+                    
+                    char namebuf[4096];
+                    token += 2;
+#ifdef _MSC_VER
+                    sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
+#else
+                    sscanf(token, "%s", namebuf);
+#endif
+                    tag.name = std::string(namebuf);
+                    
+                    token += tag.name.size() + 1;
+                    
+                    tag_sizes ts = parseTagTriple(&token);
+                    
+                    tag.intValues.resize(static_cast<size_t>(ts.num_ints));
+                    
+                    for (size_t i = 0; i < static_cast<size_t>(ts.num_ints); ++i) {
+                        tag.intValues[i] = atoi(token);
+                        token += strcspn(token, "/ \t\r") + 1;
+                    }
+                    
+                    tag.floatValues.resize(static_cast<size_t>(ts.num_floats));
+                    for (size_t i = 0; i < static_cast<size_t>(ts.num_floats); ++i) {
+                        tag.floatValues[i] = parseFloat(&token);
+                        token += strcspn(token, "/ \t\r") + 1;
+                    }
+                    
+                    tag.stringValues.resize(static_cast<size_t>(ts.num_strings));
+                    for (size_t i = 0; i < static_cast<size_t>(ts.num_strings); ++i) {
+                        char stringValueBuffer[4096];
+                        
+#ifdef _MSC_VER
+                        sscanf_s(token, "%s", stringValueBuffer,
+                                 (unsigned)_countof(stringValueBuffer));
+#else
+                        sscanf(token, "%s", stringValueBuffer);
+#endif
+                        tag.stringValues[i] = stringValueBuffer;
+                        token += tag.stringValues[i].size() + 1;
+                    }
+                    
+                    tags.push_back(tag);
+                }
+            }
+            
+            v_offset += static_cast<int>(chunk.v.size() / 3);
+            vn_offset += static_cast<int>(chunk.vn.size() / 3);
+            vt_offset += static_cast<int>(chunk.vt.size() / 2);
+        }
+        
+        bool ret = exportFaceGroupToShape(&shape, faceGroup, tags, material, name,
+                                          triangulate);
+        if (ret || shape.mesh.indices.size()) {
+            shapes->push_back(shape);
+        }
+        faceGroup.clear();  // for safety
+        
+        if (err) {
+            (*err) += errss.str();
+        }
+        
+        attrib->vertices.swap(v);
+        attrib->normals.swap(vn);
+        attrib->texcoords.swap(vt);
+        
+        return true;
+    }
+    
+    bool LoadObjParallel(attrib_t *attrib, std::vector<shape_t> *shapes,
+                         std::vector<material_t> *materials, std::string *err,
+                         const char *filename, const char *mtl_basepath,
+                         bool triangulate, unsigned int num_threads,
+                         const ParallelFor &parallel_for,
+                         MaterialReader *readMatFn) {
+        attrib->vertices.clear();
+        attrib->normals.clear();
+        attrib->texcoords.clear();
+        shapes->clear();
+        
+        std::string basePath;
+        if (mtl_basepath) {
+            basePath = mtl_basepath;
+        }
+        MaterialFileReader matFileReader(basePath);
+        MaterialReader *matReader = readMatFn ? readMatFn : &matFileReader;
+        
+        std::stringstream errss;
+        errss << "Cannot open file [" << filename << "]" << std::endl;
+        
+#if defined(_WIN32)
+        HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                                  OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file == INVALID_HANDLE_VALUE) {
+            if (err) {
+                (*err) = errss.str();
+            }
+            return false;
+        }
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file, &file_size)) {
+            CloseHandle(file);
+            if (err) {
+                (*err) = errss.str();
+            }
+            return false;
+        }
+        if (file_size.QuadPart == 0) {
+            // nothing to map, an empty file yields no shapes
+            CloseHandle(file);
+            return LoadObjFromBuffer(attrib, shapes, materials, err, "", 0,
+                                     matReader, triangulate, num_threads, parallel_for);
+        }
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        const char *data = NULL;
+        if (mapping != NULL) {
+            data = static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        }
+        if (data == NULL) {
+            if (mapping != NULL) CloseHandle(mapping);
+            CloseHandle(file);
+            if (err) {
+                (*err) = errss.str();
+            }
+            return false;
+        }
+        
+        bool ret = LoadObjFromBuffer(attrib, shapes, materials, err, data,
+                                     static_cast<size_t>(file_size.QuadPart),
+                                     matReader, triangulate, num_threads, parallel_for);
+        
+        UnmapViewOfFile(data);
+        CloseHandle(mapping);
+        CloseHandle(file);
+#else
+        int fd = open(filename, O_RDONLY);
+        struct stat file_info;
+        if (fd < 0 || fstat(fd, &file_info) != 0) {
+            if (fd >= 0) close(fd);
+            if (err) {
+                (*err) = errss.str();
+            }
+            return false;
+        }
+        size_t size = static_cast<size_t>(file_info.st_size);
+        if (size == 0) {
+            // nothing to map, an empty file yields no shapes
+            close(fd);
+            return LoadObjFromBuffer(attrib, shapes, materials, err, "", 0,
+                                     matReader, triangulate, num_threads, parallel_for);
+        }
+        void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            if (err) {
+                (*err) = errss.str();
+            }
+            return false;
+        }
+        
+        bool ret = LoadObjFromBuffer(attrib, shapes, materials, err,
+                                     static_cast<const char *>(data), size,
+                                     matReader, triangulate, num_threads, parallel_for);
+        
+        munmap(data, size);
+#endif
+        
+        return ret;
+    }
 }  // namespace tinyobj
 
 #endif